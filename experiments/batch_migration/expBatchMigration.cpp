@@ -0,0 +1,109 @@
+#include <stdint.h>
+#include <unistd.h>
+
+#include <cstddef>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "distributed-allocator/RDMAMemory.hpp"
+
+/*
+    moves a shard of num_segments small segments from server 0 to server 1, first one segment
+    at a time (Prepare, accept, Transfer for each) and then with PrepareMany and TransferMany.
+    The sender reports the time until every segment was accepted and until every segment
+    was closed on the receiver, the receiver checks that every segment arrived.
+*/
+
+static void fill(std::vector<void*>& addresses, RDMAMemoryManager* manager, size_t num_segments, size_t segment_size) {
+    for (size_t i=0; i<num_segments; i++) {
+        #if FAULT_TOLERANT
+            void* address = manager->allocate(segment_size, (int64_t)i);
+        #else
+            void* address = manager->allocate(segment_size);
+        #endif
+        memset(address, 'x', segment_size);
+        addresses.push_back(address);
+    }
+}
+
+static void send(RDMAMemoryManager* manager, size_t num_segments, size_t segment_size, bool batched) {
+    std::vector<void*> addresses;
+    fill(addresses, manager, num_segments, segment_size);
+
+    MultiTimer t;
+    t.start();
+    if (batched) {
+        if (manager->PrepareMany(addresses, 1) < 0)
+            exit(1);
+        std::vector<RDMAMemory*> accepted;
+        while (accepted.size() < num_segments) {
+            manager->PollForAccepts(accepted, num_segments - accepted.size());
+        }
+        t.stop();
+        t.start();
+        if (manager->TransferMany(addresses, 1) < 0)
+            exit(1);
+    } else {
+        for (void* address : addresses) {
+            manager->Prepare(address, segment_size, 1);
+            while(manager->PollForAccept() == nullptr) {}
+        }
+        t.stop();
+        t.start();
+        for (void* address : addresses) {
+            manager->Transfer(address, segment_size, 1);
+        }
+    }
+    for (size_t closed = 0; closed < num_segments; ) {
+        if (manager->PollForClose() != nullptr)
+            closed++;
+    }
+    t.stop();
+
+    std::vector<double> times = t.getTime();
+    printf("mode, %s, segments, %zu, size, %zu, accepted_ms, %f, closed_ms, %f\n", batched ? "batch" : "single",
+        num_segments, segment_size, times[0] / 1e6, (times[0] + times[1]) / 1e6);
+    fflush(stdout);
+}
+
+static void receive(RDMAMemoryManager* manager, size_t num_segments, size_t segment_size) {
+    std::vector<RDMAMemory*> memories;
+    while (memories.size() < num_segments) {
+        manager->PollForTransfers(memories, num_segments - memories.size());
+    }
+    for (RDMAMemory* memory : memories) {
+        char* bytes = (char*)memory->vaddr;
+        LogAssert(bytes[0] == 'x' && bytes[segment_size - 1] == 'x', "segment %p did not arrive", memory->vaddr);
+        manager->close(memory->vaddr, segment_size, 0);
+    }
+}
+
+int main(int argc, char* argv[]) {
+    if (argc < 5) {
+        std::cerr << "./expBatchMigration path_to_config server_id num_segments segment_size" << std::endl;
+        return 1;
+    }
+
+    int id = atoi(argv[2]);
+    size_t num_segments = atol(argv[3]);
+    size_t segment_size = atol(argv[4]);
+    #if PAGING
+    manager = new RDMAMemoryManager(argv[1], id);
+    initialize();
+    RDMAMemoryManager* memory_manager = manager;
+    #else
+    RDMAMemoryManager* memory_manager = new RDMAMemoryManager(argv[1], id);
+    #endif
+
+    bool modes[2] = {false, true};
+    for (int i=0; i<2; i++) {
+        if (id == 0)
+            send(memory_manager, num_segments, segment_size, modes[i]);
+        else
+            receive(memory_manager, num_segments, segment_size);
+    }
+    // let the last close messages go out before the connection is torn down
+    usleep(10000);
+    return 0;
+}
@@ -0,0 +1,15 @@
+#!/bin/bash
+
+if [ $# -lt 1 ];then
+    echo "Arguments missing"
+    exit 1
+fi
+
+# a shard of small containers moved one segment at a time and in batches
+server_id=$1
+segment_size=$((64*1024))
+
+for segments in 1000 10000
+do
+    ./expBatchMigration ../config.txt $server_id $segments $segment_size
+done
@@ -0,0 +1,76 @@
+#include <stdint.h>
+
+#include <cstddef>
+#include <iostream>
+#include <string>
+
+#include <random>
+
+#include "distributed-allocator/mempool.hpp"
+#include "c++-containers/rdma_unordered_map.hpp"
+
+/*
+    the data_transfer workload (a map of 8 byte keys and 128 byte values filling 60% of the container)
+    migrated as a copy, node A reports the time from Transfer until node B closed the container and the
+    effective bandwidth over the bytes below the pool watermark
+    values are all 'a' as in data_transfer or random, which does not code and has to go uncoded
+    built twice by the Makefile, compressed_transfer with COMPRESSED_TRANSFER=1 and compressed_transfer_raw
+*/
+
+int main(int argc, char* argv[]) {
+    if (argc < 5) {
+        std::cerr << "please provide all arguments" << std::endl;
+        std::cerr << "./compressed_transfer path_to_config id container_size(in bytes) repeat|random" << std::endl;
+        return 1;
+    }
+
+    int id = atoi(argv[2]);
+    size_t size = (size_t)atol(argv[3]);
+    bool random_values = std::string(argv[4]) == "random";
+
+    RDMAMemoryManager* memory_manager = new RDMAMemoryManager(argv[1], id);
+    using String = std::basic_string<char, std::char_traits<char>, PoolBasedAllocator<char>>;
+    int num_entries = (size*0.60)/(136);
+
+    RDMAUnorderedMap<int64_t, String> map(memory_manager);
+    map.SetContainerSize(size);
+
+    if (id == 0) {
+        map.instantiate();
+        std::mt19937 generator(7);
+        std::uniform_int_distribution<int> letter('a', 'z');
+        String val = "";
+        for (int64_t key = 0; key < num_entries; key++) {
+            val.clear();
+            while (val.size() != 128) {
+                val.push_back(random_values ? letter(generator) : 'a');
+            }
+            map[key] = val;
+        }
+
+        const MemoryPool* pool = map.GetMemoryPool();
+        size_t used = (char*)pool->unused_past - (char*)pool->addr;
+
+        map.Prepare(1);
+        while(!map.PollForAccept()) {}
+
+        MultiTimer t;
+        t.start();
+        map.Transfer();
+        while(!map.PollForClose()) {}
+        t.stop();
+
+        double ms = t.getTime()[0] / 1e6;
+        printf("coding, %s, values, %s, container_size, %zu, used, %zu, ms, %f, effective_gbps, %f\n",
+            COMPRESSED_TRANSFER ? "run" : "none", random_values ? "random" : "repeat", size, used, ms,
+            (used / 1e9) / (ms / 1e3));
+    } else {
+        while(!map.PollForTransfer()) {}
+        map.remote_instantiate();
+        LogAssert(map.size() == (size_t)num_entries, "%zu of %d keys arrived", map.size(), num_entries);
+        String valr = map[num_entries - 1];
+        LogAssert(valr.size() == 128, "last value did not arrive");
+        map.Close();
+    }
+    return 0;
+}
@@ -0,0 +1,23 @@
+#!/bin/bash
+
+if [ $# -lt 1 ];then
+    echo "Arguments missing"
+    exit 1
+fi
+
+# effective bandwidth of a copied container from 1 MB to 512 MB, coded and uncoded,
+# with the repeated values of data_transfer and with random ones
+server_id=$1
+max_memory=$((1024*1024*512))
+test_memory=$((1024*1024))
+
+while [[ $test_memory -le $max_memory ]]; do
+    for values in repeat random
+    do
+        ./compressed_transfer ../config.txt $server_id $test_memory $values
+        sleep 1
+        ./compressed_transfer_raw ../config.txt $server_id $test_memory $values
+        sleep 1
+    done
+    test_memory=$((test_memory*2))
+done
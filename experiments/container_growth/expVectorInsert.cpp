@@ -0,0 +1,61 @@
+#include <stdint.h>
+
+#include <cstddef>
+#include <iostream>
+#include <string>
+
+#include "distributed-allocator/mempool.hpp"
+#include "c++-containers/rdma_vector.hpp"
+
+/*
+    insert throughput into a RDMAVector that grows far past the first pool segment
+    the pool starts at the default 4 MB and maps more segments behind it as the vector grows,
+    with reserve=1 the vector reserves its final capacity up front so only the pushes are timed
+*/
+
+int main(int argc, char* argv[]) {
+    if (argc < 5) {
+        std::cerr << "./expVectorInsert path_to_config server_id size_in_gb reserve" << std::endl;
+        return 1;
+    }
+
+    int id = atoi(argv[2]);
+    size_t target = (size_t)atol(argv[3]) * 1024 * 1024 * 1024;
+    bool reserve = atoi(argv[4]) != 0;
+    long elements = (long)(target / sizeof(long));
+
+    RDMAMemoryManager* memory_manager = new RDMAMemoryManager(argv[1], id);
+    RDMAVector<long> vec(memory_manager);
+    // a doubling vector holds its old and new buffer at the same time
+    vec.SetMaxContainerSize(4 * target);
+    vec.instantiate();
+    const MemoryPool* pool = vec.GetMemoryPool();
+    if (reserve)
+        vec.reserve(elements);
+
+    long report = elements / 10 > 0 ? elements / 10 : 1;
+    TestTimer t;
+    t.start();
+    TestTimer step;
+    step.start();
+    for (long i=0; i<elements; i++) {
+        vec.push_back(i);
+
+        if ((i + 1) % report == 0) {
+            step.stop();
+            double inserts_per_sec = report / (step.get_duration_usec() / 1e6);
+            printf("inserted, %ld, GB, %f, inserts_per_sec, %f, segments, %d, pool_size, %zu\n",
+                i + 1, (double)(i + 1) * sizeof(long) / (1024.0 * 1024 * 1024),
+                inserts_per_sec, pool->segment_count(), pool->size);
+            fflush(stdout);
+            step.reset();
+            step.start();
+        }
+    }
+    t.stop();
+
+    printf("total inserts, %ld, reserve, %d, inserts_per_sec, %f, MB_per_sec, %f, segments, %d\n",
+        elements, reserve, elements / (t.get_duration_usec() / 1e6),
+        (target / (1024.0 * 1024)) / (t.get_duration_usec() / 1e6), pool->segment_count());
+    return 0;
+}
@@ -0,0 +1,14 @@
+#!/bin/bash
+
+if [ $# -lt 1 ];then
+    echo "Arguments missing"
+    exit 1
+fi
+
+# 10 GB of longs pushed into a single RDMAVector, growing the pool and with the capacity reserved
+server_id=$1
+
+for reserve in 0 1
+do
+    ./expVectorInsert ../config.txt $server_id 10 $reserve
+done
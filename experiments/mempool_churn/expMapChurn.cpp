@@ -0,0 +1,58 @@
+#include <stdint.h>
+
+#include <cstddef>
+#include <iostream>
+#include <string>
+
+#include "distributed-allocator/mempool.hpp"
+#include "c++-containers/rdma_unordered_map.hpp"
+
+/*
+    insert/erase churn on a long lived RDMAUnorderedMap
+    keeps `window` keys live while inserting `ops` keys in total, the pool usage
+    should level off once the free lists start recycling erased nodes
+*/
+
+int main(int argc, char* argv[]) {
+    if (argc < 5) {
+        std::cerr << "./expMapChurn path_to_config server_id ops window" << std::endl;
+        return 1;
+    }
+
+    int id = atoi(argv[2]);
+    long ops = atol(argv[3]);
+    long window = atol(argv[4]);
+
+    RDMAMemoryManager* memory_manager = new RDMAMemoryManager(argv[1], id);
+    RDMAUnorderedMap<long, long> map(memory_manager);
+    map.instantiate();
+    const MemoryPool* pool = map.GetMemoryPool();
+
+    long report = ops / 10 > 0 ? ops / 10 : 1;
+    TestTimer t;
+    t.start();
+    TestTimer step;
+    step.start();
+    for (long i=0; i<ops; i++) {
+        map[i] = i;
+        if (i >= window)
+            map.erase(i - window);
+
+        if ((i + 1) % report == 0) {
+            step.stop();
+            // every iteration is one insert and one erase
+            double ops_per_sec = (2.0 * report) / (step.get_duration_usec() / 1e6);
+            printf("ops, %ld, window, %ld, ops_per_sec, %f, in_use, %zu, watermark, %zu\n",
+                i + 1, window, ops_per_sec, pool->in_use(),
+                (size_t)((char*)pool->unused_past - (char*)pool->pool_addr));
+            fflush(stdout);
+            step.reset();
+            step.start();
+        }
+    }
+    t.stop();
+
+    printf("total ops, %ld, window, %ld, ops_per_sec, %f\n",
+        2 * ops, window, (2.0 * ops) / (t.get_duration_usec() / 1e6));
+    return 0;
+}
@@ -0,0 +1,15 @@
+#!/bin/bash
+
+if [ $# -lt 1 ];then
+    echo "Arguments missing"
+    exit 1
+fi
+
+# insert/erase churn on a single node, the window is the number of live keys
+server_id=$1
+ops=$((10*1000*1000))
+
+for window in 1000 10000 50000
+do
+    ./expMapChurn ../config.txt $server_id $ops $window
+done
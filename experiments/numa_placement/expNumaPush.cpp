@@ -0,0 +1,68 @@
+#include <stdint.h>
+#include <unistd.h>
+
+#include <cstddef>
+#include <iostream>
+#include <string>
+
+#include "distributed-allocator/RDMAMemory.hpp"
+
+/*
+    writes a segment from server 0 to server 1 with Push, the segment is placed on the given
+    NUMA node of server 0 (-1 leaves it on the node of the RDMA device). The sender reports
+    the node of the device and the bandwidth of the writes, run once per node by run_numa.sh
+    to see what memory on the far socket costs.
+*/
+
+static const int ROUNDS = 10;
+
+int main(int argc, char* argv[]) {
+    if (argc < 5) {
+        std::cerr << "./expNumaPush path_to_config server_id numa_node segment_size" << std::endl;
+        return 1;
+    }
+
+    int id = atoi(argv[2]);
+    int node = atoi(argv[3]);
+    size_t segment_size = atol(argv[4]);
+    RDMAMemoryManager* memory_manager = new RDMAMemoryManager(argv[1], id);
+
+    if (id == 0) {
+        #if FAULT_TOLERANT
+            void* address = memory_manager->allocate(segment_size, 0, MigrationPolicy::Copy(), node, 0);
+        #else
+            void* address = memory_manager->allocate(segment_size, MigrationPolicy::Copy(), node, 0);
+        #endif
+        if (address == nullptr)
+            return 1;
+        memset(address, 'x', segment_size);
+        memory_manager->Prepare(address, segment_size, 1);
+        while(memory_manager->PollForAccept() == nullptr) {}
+
+        MultiTimer t;
+        t.start();
+        for (int i=0; i<ROUNDS; i++) {
+            if (memory_manager->Push(address, segment_size, 1) != 0)
+                return 1;
+        }
+        t.stop();
+        // everything is on the destination already, nothing is left to pull
+        memory_manager->Transfer(address, segment_size, 1, 0);
+        while(memory_manager->PollForClose() == nullptr) {}
+
+        double ms = t.getTime()[0] / 1e6;
+        printf("node, %d, nic_node, %d, size, %zu, ms, %f, gbps, %f\n", node, memory_manager->nic_node,
+            segment_size, ms, (ROUNDS * segment_size / 1e9) / (ms / 1e3));
+        fflush(stdout);
+        return 0;
+    }
+
+    RDMAMemory* memory = nullptr;
+    while((memory = memory_manager->PollForTransfer()) == nullptr) {}
+    char* bytes = (char*)memory->vaddr;
+    LogAssert(bytes[0] == 'x' && bytes[segment_size - 1] == 'x', "segment %p did not arrive", memory->vaddr);
+    memory_manager->close(memory->vaddr, segment_size, 0);
+    // let the close go out before the connection is torn down
+    usleep(10000);
+    return 0;
+}
@@ -0,0 +1,15 @@
+#!/bin/bash
+
+if [ $# -lt 1 ];then
+    echo "Arguments missing"
+    exit 1
+fi
+
+# a 1 GB segment written to the other server from memory on each node, -1 is the device's node
+server_id=$1
+segment_size=$((1024*1024*1024))
+
+for node in -1 0 1
+do
+    ./expNumaPush ../config.txt $server_id $node $segment_size
+done
@@ -0,0 +1,92 @@
+#include <stdint.h>
+
+#include <algorithm>
+#include <cstddef>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "RDMAMemory.hpp"
+#include "paging.hpp"
+
+/*
+    demand fault latency while a background sweep pulls the rest of a 1 GB segment
+    mode none touches the pages with no sweep running, mode background starts
+    PullAllPagesWithoutCloseAsync first and then touches random pages ahead of it
+    built twice by the Makefile, expBackgroundFaults with the priority scheduler and
+    expBackgroundFaultsFifo with PRIORITY_PREFETCHING=0 (fixed max_async_pending window)
+    PAGING has to be set from the build (-DPAGING=1)
+*/
+
+int main(int argc, char* argv[]) {
+    if (argc < 5) {
+        std::cerr << "./expBackgroundFaults path_to_config server_id faults none|background" << std::endl;
+        return 1;
+    }
+#if !PAGING
+    std::cerr << "build with -DPAGING=1 to run this experiment" << std::endl;
+    return 1;
+#else
+    int id = atoi(argv[2]);
+    size_t faults = atol(argv[3]);
+    bool background = std::string(argv[4]) == "background";
+    size_t segment_size = (size_t)1024 * 1024 * 1024;
+    size_t page_size = 4096;
+    RDMAMemoryManager* memory_manager = new RDMAMemoryManager(argv[1], id);
+    manager = memory_manager;
+    #if !USERFAULTFD
+        initialize();
+    #endif
+
+    if (id == 0) {
+        void* address = manager->allocate(segment_size);
+        memset(address, 'x', segment_size);
+        manager->Prepare(address, segment_size, 1);
+        while(manager->PollForAccept() == nullptr) {}
+        manager->Transfer(address, segment_size, 1);
+        while(manager->PollForClose() == nullptr) {}
+        return 0;
+    }
+
+    RDMAMemory* memory = nullptr;
+    while((memory = manager->PollForTransfer()) == nullptr) {}
+
+    // random pages from the back half, the sweep walks up from page 0 so they are still remote
+    size_t num_pages = segment_size / page_size;
+    std::vector<size_t> order(num_pages / 2);
+    for (size_t i=0; i<order.size(); i++) {
+        order[i] = num_pages / 2 + i;
+    }
+    srand(42);
+    std::random_shuffle(order.begin(), order.end());
+    faults = std::min(faults, order.size());
+
+    std::thread sweep;
+    if (background) {
+        sweep = std::thread(&RDMAMemoryManager::PullAllPagesWithoutCloseAsync, manager, memory);
+    }
+
+    MultiTimer t;
+    for (size_t i=0; i<faults; i++) {
+        volatile char* addr = (volatile char*)memory->vaddr + page_size * order[i];
+        t.start();
+        char c = *addr;
+        t.stop();
+        LogAssert(c == 'x', "page %zu did not arrive", order[i]);
+    }
+
+    if (background) {
+        sweep.join();
+    }
+    manager->close(memory->vaddr, segment_size, 0);
+
+    std::vector<double> times = t.getTime();
+    std::sort(times.begin(), times.end());
+    printf("scheduler, %s, mode, %s, faults, %zu, p50_ns, %f, p99_ns, %f, depth, %d, slow_faults, %lu\n",
+        PRIORITY_PREFETCHING ? "priority" : "fifo", background ? "background" : "none", times.size(),
+        times[times.size() / 2], times[(times.size() * 99) / 100],
+        manager->scheduler.getDepth(), (unsigned long)manager->scheduler.getSlowFaults());
+    return 0;
+#endif
+}
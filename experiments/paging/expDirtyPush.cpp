@@ -0,0 +1,89 @@
+#include <stdint.h>
+
+#include <algorithm>
+#include <cstddef>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "RDMAMemory.hpp"
+#include "paging.hpp"
+
+/*
+    write back of a migrated segment, PushDirty against pushing the whole segment
+    the receiver brings in all 256 MB, writes dirty_percent of the pages, pushes them back with
+    PushDirty and then writes the same pages again and pushes everything with Push
+    the sender counts how many of its pages came back modified once the receiver closes
+    built with DIRTY_TRACKING=1 by the Makefile, PAGING has to be set from the build (-DPAGING=1)
+*/
+
+int main(int argc, char* argv[]) {
+    if (argc < 4) {
+        std::cerr << "./expDirtyPush path_to_config server_id dirty_percent" << std::endl;
+        return 1;
+    }
+#if !PAGING || !DIRTY_TRACKING
+    std::cerr << "build with -DPAGING=1 -DDIRTY_TRACKING=1 to run this experiment" << std::endl;
+    return 1;
+#else
+    int id = atoi(argv[2]);
+    int dirty_percent = atoi(argv[3]);
+    size_t segment_size = (size_t)256 * 1024 * 1024;
+    size_t page_size = 4096;
+    size_t num_pages = segment_size / page_size;
+    RDMAMemoryManager* memory_manager = new RDMAMemoryManager(argv[1], id);
+    manager = memory_manager;
+    initialize();
+
+    if (id == 0) {
+        char* address = (char*)manager->allocate(segment_size);
+        memset(address, 'x', segment_size);
+        manager->Prepare(address, segment_size, 1);
+        while(manager->PollForAccept() == nullptr) {}
+        manager->Transfer(address, segment_size, 1);
+        while(manager->PollForClose() == nullptr) {}
+
+        size_t modified = 0;
+        for (size_t page = 0; page < num_pages; page++) {
+            if (address[page * page_size] != 'x')
+                modified++;
+        }
+        printf("origin, modified_pages, %zu\n", modified);
+        return 0;
+    }
+
+    RDMAMemory* memory = nullptr;
+    while((memory = manager->PollForTransfer()) == nullptr) {}
+    manager->PullAllPagesWithoutClose(memory);
+
+    std::vector<size_t> order(num_pages);
+    for (size_t i=0; i<order.size(); i++) {
+        order[i] = i;
+    }
+    srand(42);
+    std::random_shuffle(order.begin(), order.end());
+    size_t dirty = num_pages * dirty_percent / 100;
+
+    for (size_t i=0; i<dirty; i++) {
+        ((volatile char*)memory->vaddr)[order[i] * page_size] = 'y';
+    }
+    MultiTimer t;
+    t.start();
+    int pushed = manager->PushDirty(memory->vaddr);
+    t.stop();
+
+    for (size_t i=0; i<dirty; i++) {
+        ((volatile char*)memory->vaddr)[order[i] * page_size] = 'z';
+    }
+    t.start();
+    manager->Push(memory->vaddr, segment_size, memory->pair);
+    t.stop();
+
+    manager->close(memory->vaddr, segment_size, 0);
+
+    std::vector<double> times = t.getTime();
+    printf("dirty_percent, %d, pushed_pages, %d, push_dirty_ms, %f, push_all_ms, %f\n",
+        dirty_percent, pushed, times[0] / 1e6, times[1] / 1e6);
+    return 0;
+#endif
+}
@@ -0,0 +1,77 @@
+#include <stdint.h>
+
+#include <algorithm>
+#include <cstddef>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "RDMAMemory.hpp"
+#include "paging.hpp"
+
+/*
+    per fault latency of demand paging a migrated segment, 4 KB pages touched in random order
+    built twice by the Makefile, expFaultLatency uses the sigsegv + mprotect pager and
+    expFaultLatencyUffd the userfaultfd handler thread, PAGING has to be set from the build (-DPAGING=1)
+*/
+
+int main(int argc, char* argv[]) {
+    if (argc < 4) {
+        std::cerr << "./expFaultLatency path_to_config server_id segment_size" << std::endl;
+        return 1;
+    }
+#if !PAGING
+    std::cerr << "build with -DPAGING=1 to run this experiment" << std::endl;
+    return 1;
+#else
+    int id = atoi(argv[2]);
+    size_t segment_size = atol(argv[3]);
+    size_t page_size = 4096;
+    RDMAMemoryManager* memory_manager = new RDMAMemoryManager(argv[1], id);
+    manager = memory_manager;
+    #if !USERFAULTFD
+        initialize();
+    #endif
+
+    if (id == 0) {
+        void* address = manager->allocate(segment_size);
+        memset(address, 'x', segment_size);
+        manager->Prepare(address, segment_size, 1);
+        while(manager->PollForAccept() == nullptr) {}
+        manager->Transfer(address, segment_size, 1);
+        while(manager->PollForClose() == nullptr) {}
+        return 0;
+    }
+
+    RDMAMemory* memory = nullptr;
+    while((memory = manager->PollForTransfer()) == nullptr) {}
+
+    std::vector<size_t> order(segment_size / page_size);
+    for (size_t i=0; i<order.size(); i++) {
+        order[i] = i;
+    }
+    srand(42);
+    std::random_shuffle(order.begin(), order.end());
+
+    MultiTimer t;
+    for (size_t i=0; i<order.size(); i++) {
+        volatile char* addr = (volatile char*)memory->vaddr + page_size * order[i];
+        t.start();
+        char c = *addr;
+        t.stop();
+        LogAssert(c == 'x', "page %zu did not arrive", order[i]);
+    }
+    manager->close(memory->vaddr, segment_size, 0);
+
+    std::vector<double> times = t.getTime();
+    std::sort(times.begin(), times.end());
+    double sum = 0;
+    for (double time : times) {
+        sum += time;
+    }
+    printf("pager, %s, faults, %zu, mean_ns, %f, p50_ns, %f, p99_ns, %f\n",
+        USERFAULTFD ? "userfaultfd" : "sigsegv", times.size(), sum / times.size(),
+        times[times.size() / 2], times[(times.size() * 99) / 100]);
+    return 0;
+#endif
+}
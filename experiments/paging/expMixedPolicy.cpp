@@ -0,0 +1,67 @@
+#include <stdint.h>
+
+#include <cstddef>
+#include <iostream>
+#include <string>
+
+#include "RDMAMemory.hpp"
+#include "paging.hpp"
+
+/*
+    migrates one segment copied and one paged from the same process, the receiver reads every page
+    once and reports how long that took, the sender reports the time from Transfer to close
+    the Makefile builds it with PAGING=1, the policy picks the mode per segment
+*/
+
+int main(int argc, char* argv[]) {
+    if (argc < 4) {
+        std::cerr << "./expMixedPolicy path_to_config server_id segment_size" << std::endl;
+        return 1;
+    }
+#if !PAGING
+    std::cerr << "build with PAGING=1 to run this experiment" << std::endl;
+    return 1;
+#else
+    int id = atoi(argv[2]);
+    size_t segment_size = atol(argv[3]);
+    size_t page_size = 4096;
+    RDMAMemoryManager* memory_manager = new RDMAMemoryManager(argv[1], id);
+    manager = memory_manager;
+    initialize();
+
+    MigrationPolicy policies[2] = {MigrationPolicy::Copy(), MigrationPolicy::Paged()};
+    for (int i=0; i<2; i++) {
+        const char* mode = policies[i].paging ? "paged" : "copy";
+        if (id == 0) {
+            void* address = memory_manager->allocate(segment_size, policies[i]);
+            memset(address, 'x', segment_size);
+            memory_manager->Prepare(address, segment_size, 1);
+            while(memory_manager->PollForAccept() == nullptr) {}
+
+            MultiTimer t;
+            t.start();
+            memory_manager->Transfer(address, segment_size, 1);
+            while(memory_manager->PollForClose() == nullptr) {}
+            t.stop();
+            printf("mode, %s, size, %zu, migration_ms, %f\n", mode, segment_size, t.getTime()[0] / 1e6);
+            fflush(stdout);
+            continue;
+        }
+
+        RDMAMemory* memory = nullptr;
+        while((memory = memory_manager->PollForTransfer()) == nullptr) {}
+        LogAssert(memory->policy == policies[i], "segment arrived with the wrong policy");
+        MultiTimer t;
+        t.start();
+        for (size_t offset = 0; offset < segment_size; offset += page_size) {
+            LogAssert(*((volatile char*)memory->vaddr + offset) == 'x', "page at %zu did not arrive", offset);
+        }
+        t.stop();
+        printf("mode, %s, size, %zu, first_pass_ms, %f, demand_faults, %lu\n", mode, segment_size,
+            t.getTime()[0] / 1e6, (unsigned long)memory->demand_faults.load());
+        fflush(stdout);
+        memory_manager->close(memory->vaddr, segment_size, 0);
+    }
+    return 0;
+#endif
+}
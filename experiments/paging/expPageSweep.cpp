@@ -0,0 +1,65 @@
+#include <stdint.h>
+
+#include <cstddef>
+#include <iostream>
+#include <random>
+#include <string>
+
+#include "RDMAMemory.hpp"
+#include "paging.hpp"
+
+/*
+    cost of the page state bitmap on its own, no connection is needed
+    builds the states of a segment_gb segment of 4 KB pages, marks local_percent of them Local
+    in runs of 64 pages and then counts the remote pages twice, once probing every page with
+    getPageState and once hopping with find_next_remote the way the prefetch sweeps do
+    the old layout was one std::atomic<PageState> per page
+*/
+
+int main(int argc, char* argv[]) {
+    if (argc < 3) {
+        std::cerr << "./expPageSweep segment_gb local_percent" << std::endl;
+        return 1;
+    }
+
+    size_t segment_size = (size_t)atol(argv[1]) * 1024 * 1024 * 1024;
+    int local_percent = atoi(argv[2]);
+    size_t page_size = 4096;
+    int run = 64;
+
+    Pages pages(ALLOCATABLE_RANGE_START, segment_size, page_size);
+    std::mt19937 gen(42);
+    for (int id = 0; id < pages.num_pages; id += run) {
+        if ((int)(gen() % 100) >= local_percent)
+            continue;
+        for (int i = id; i < id + run && i < pages.num_pages; i++) {
+            pages.setPageState(i, PageState::Local);
+        }
+    }
+
+    MultiTimer t;
+    t.start();
+    int probed = 0;
+    for (int id = 0; id < pages.num_pages; id++) {
+        if (pages.getPageState(id) == PageState::Remote)
+            probed++;
+    }
+    t.stop();
+
+    t.start();
+    int found = 0;
+    for (int id = pages.find_next_remote(0); id < pages.num_pages; id = pages.find_next_remote(id + 1)) {
+        found++;
+    }
+    t.stop();
+
+    LogAssert(probed == found, "scans disagree, %d against %d", probed, found);
+
+    std::vector<double> times = t.getTime();
+    double gb = (double)segment_size / (1024 * 1024 * 1024);
+    printf("segment_gb, %f, state_bytes_per_gb, %f, old_bytes_per_gb, %f, local_percent, %d, remote, %d, "
+        "probe_ms, %f, find_next_ms, %f, sweep_pages_per_sec, %f\n",
+        gb, pages.stateBytes() / gb, (double)pages.num_pages * sizeof(std::atomic<PageState>) / gb,
+        local_percent, found, times[0] / 1e6, times[1] / 1e6, pages.num_pages / (times[1] / 1e9));
+    return 0;
+}
@@ -0,0 +1,68 @@
+#include <stdint.h>
+
+#include <cstddef>
+#include <iostream>
+#include <string>
+
+#include "RDMAMemory.hpp"
+#include "paging.hpp"
+
+/*
+    bulk pull of a 4 GB paged segment with PullAllPagesParallel and a given number of workers
+    the receiver reports the time of the sweep and the pull bandwidth, then spot checks the pages
+    run with 1 to 8 workers by run_parallel.sh, the Makefile builds it with PAGING=1
+    expParallelPullChecksums is the same source with TRANSFER_CHECKSUMS, the sender also reports
+    how long Transfer took, which is where the source checksums the segment
+*/
+
+int main(int argc, char* argv[]) {
+    if (argc < 4) {
+        std::cerr << "./expParallelPull path_to_config server_id workers" << std::endl;
+        return 1;
+    }
+#if !PAGING || USERFAULTFD
+    std::cerr << "build with PAGING (without USERFAULTFD) to run this experiment" << std::endl;
+    return 1;
+#else
+    int id = atoi(argv[2]);
+    int workers = atoi(argv[3]);
+    size_t segment_size = (size_t)4 * 1024 * 1024 * 1024;
+    size_t page_size = 4096;
+    RDMAMemoryManager* memory_manager = new RDMAMemoryManager(argv[1], id);
+    manager = memory_manager;
+    initialize();
+
+    if (id == 0) {
+        void* address = manager->allocate(segment_size, MigrationPolicy::Paged());
+        memset(address, 'x', segment_size);
+        manager->Prepare(address, segment_size, 1);
+        while(manager->PollForAccept() == nullptr) {}
+        MultiTimer t;
+        t.start();
+        manager->Transfer(address, segment_size, 1);
+        t.stop();
+        while(manager->PollForClose() == nullptr) {}
+        printf("checksums, %d, transfer_ms, %f\n", TRANSFER_CHECKSUMS, t.getTime()[0] / 1e6);
+        return 0;
+    }
+
+    RDMAMemory* memory = nullptr;
+    while((memory = manager->PollForTransfer()) == nullptr) {}
+
+    MultiTimer t;
+    t.start();
+    manager->PullAllPagesParallel(memory, workers);
+    t.stop();
+
+    for (size_t page = 0; page < segment_size / page_size; page += 97) {
+        volatile char* addr = (volatile char*)memory->vaddr + page_size * page;
+        LogAssert(*addr == 'x', "page %zu did not arrive", page);
+    }
+    manager->close(memory->vaddr, segment_size, 0);
+
+    double ms = t.getTime()[0] / 1e6;
+    printf("checksums, %d, workers, %d, ms, %f, gbps, %f, mismatches, %lu\n", TRANSFER_CHECKSUMS, workers, ms,
+        (segment_size / 1e9) / (ms / 1e3), (unsigned long)memory->checksums.getMismatches());
+    return 0;
+#endif
+}
@@ -0,0 +1,105 @@
+#include <stdint.h>
+
+#include <atomic>
+#include <cstddef>
+#include <iostream>
+#include <random>
+#include <string>
+#include <thread>
+
+#include "RDMAMemory.hpp"
+#include "paging.hpp"
+
+/*
+    pre-copy migration of a 256 MB segment that a writer thread keeps dirtying
+    the writer stamps random pages at writes_per_ms, PreCopy runs rounds until the dirty set fits
+    in max_downtime_us, then the writer stops and Transfer sends the rest
+    downtime is the time from stopping the writer until Transfer returns, the receiver checks
+    that it did not have to read anything and that the last stamp of every page arrived
+    built with DIRTY_TRACKING=1 by the Makefile, PAGING has to be set from the build (-DPAGING=1)
+*/
+
+static const size_t segment_size = (size_t)256 * 1024 * 1024;
+static const size_t page_size = 4096;
+
+int main(int argc, char* argv[]) {
+    if (argc < 5) {
+        std::cerr << "./expPreCopy path_to_config server_id writes_per_ms max_downtime_us" << std::endl;
+        return 1;
+    }
+#if !PAGING || !DIRTY_TRACKING
+    std::cerr << "build with -DPAGING=1 -DDIRTY_TRACKING=1 to run this experiment" << std::endl;
+    return 1;
+#else
+    int id = atoi(argv[2]);
+    int writes_per_ms = atoi(argv[3]);
+    uint64_t max_downtime_us = atol(argv[4]);
+    size_t num_pages = segment_size / page_size;
+    RDMAMemoryManager* memory_manager = new RDMAMemoryManager(argv[1], id);
+    manager = memory_manager;
+    initialize();
+
+    if (id == 0) {
+        char* address = (char*)manager->allocate(segment_size);
+        // every page holds the index of the page in its first word, the writer bumps the second
+        for (size_t page = 0; page < num_pages; page++) {
+            ((uint64_t*)(address + page * page_size))[0] = page;
+            ((uint64_t*)(address + page * page_size))[1] = 0;
+        }
+        manager->Prepare(address, segment_size, 1);
+        while(manager->PollForAccept() == nullptr) {}
+
+        std::atomic<bool> writing(true);
+        std::thread writer([&]() {
+            std::mt19937 gen(42);
+            std::uniform_int_distribution<size_t> pick(0, num_pages - 1);
+            uint64_t stamp = 1;
+            auto next = std::chrono::steady_clock::now();
+            while (writing.load()) {
+                for (int i=0; i<writes_per_ms; i++) {
+                    ((volatile uint64_t*)(address + pick(gen) * page_size))[1] = stamp++;
+                }
+                next += std::chrono::milliseconds(1);
+                std::this_thread::sleep_until(next);
+            }
+        });
+
+        MultiTimer t;
+        t.start();
+        int rounds = manager->PreCopy(address, segment_size, 1, max_downtime_us);
+        t.stop();
+        writing.store(false);
+        writer.join();
+
+        uint64_t before = manager->pushed_bytes.load();
+        t.start();
+        manager->Transfer(address, segment_size, 1);
+        t.stop();
+        uint64_t last_round = manager->pushed_bytes.load() - before;
+
+        // the receiver compares against these once it has the segment
+        uint64_t checksum = 0;
+        for (size_t page = 0; page < num_pages; page++) {
+            checksum += ((uint64_t*)(address + page * page_size))[1];
+        }
+        while(manager->PollForClose() == nullptr) {}
+
+        printf("writes_per_ms, %d, bound_us, %lu, rounds, %d, precopy_ms, %f, downtime_us, %f, last_round_bytes, %lu, total_pushed, %lu, checksum, %lu\n",
+            writes_per_ms, (unsigned long)max_downtime_us, rounds, t.getTime()[0] / 1e6, t.getTime()[1] / 1e3,
+            (unsigned long)last_round, (unsigned long)manager->pushed_bytes.load(), (unsigned long)checksum);
+        return 0;
+    }
+
+    RDMAMemory* memory = nullptr;
+    while((memory = manager->PollForTransfer()) == nullptr) {}
+    char* address = (char*)memory->vaddr;
+    uint64_t checksum = 0;
+    for (size_t page = 0; page < num_pages; page++) {
+        LogAssert(((uint64_t*)(address + page * page_size))[0] == page, "page %zu did not arrive", page);
+        checksum += ((uint64_t*)(address + page * page_size))[1];
+    }
+    printf("receiver, pulled_bytes, %lu, checksum, %lu\n", (unsigned long)manager->pulled_bytes.load(), (unsigned long)checksum);
+    manager->close(memory->vaddr, segment_size, 0);
+    return 0;
+#endif
+}
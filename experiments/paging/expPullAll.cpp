@@ -0,0 +1,73 @@
+#include <stdint.h>
+
+#include <cstddef>
+#include <iostream>
+#include <string>
+
+#include "RDMAMemory.hpp"
+#include "paging.hpp"
+
+/*
+    bulk pull of a 1 GB paged segment, the body of PullAllPages (sync) or the async sweep
+    a few scattered pages are demand faulted first so the segment starts out split into many VMAs
+    reports the time, the number of mprotect calls the sweep made and the VMAs left afterwards
+    built twice by the Makefile, expPullAll resolves pages in runs and expPullAllPerPage
+    with BATCHED_RESOLUTION=0, PAGING has to be set from the build (-DPAGING=1)
+*/
+
+int main(int argc, char* argv[]) {
+    if (argc < 4) {
+        std::cerr << "./expPullAll path_to_config server_id sync|async" << std::endl;
+        return 1;
+    }
+#if !PAGING || USERFAULTFD
+    std::cerr << "build with -DPAGING=1 (without USERFAULTFD) to run this experiment" << std::endl;
+    return 1;
+#else
+    int id = atoi(argv[2]);
+    bool async = std::string(argv[3]) == "async";
+    size_t segment_size = (size_t)1024 * 1024 * 1024;
+    size_t page_size = 4096;
+    RDMAMemoryManager* memory_manager = new RDMAMemoryManager(argv[1], id);
+    manager = memory_manager;
+    initialize();
+
+    if (id == 0) {
+        void* address = manager->allocate(segment_size);
+        memset(address, 'x', segment_size);
+        manager->Prepare(address, segment_size, 1);
+        while(manager->PollForAccept() == nullptr) {}
+        manager->Transfer(address, segment_size, 1);
+        while(manager->PollForClose() == nullptr) {}
+        return 0;
+    }
+
+    RDMAMemory* memory = nullptr;
+    while((memory = manager->PollForTransfer()) == nullptr) {}
+
+    for (size_t page = 0; page < segment_size / page_size; page += 97) {
+        volatile char* addr = (volatile char*)memory->vaddr + page_size * page;
+        LogAssert(*addr == 'x', "page %zu did not arrive", page);
+    }
+    int touched_vmas = memory->pages.mappingCount();
+
+    MultiTimer t;
+    t.start();
+    if (async) {
+        manager->PullAllPagesWithoutCloseAsync(memory);
+        while (memory->pages.local_pages.load() < memory->pages.num_pages) {}
+    } else {
+        manager->PullAllPagesWithoutClose(memory);
+    }
+    t.stop();
+    int swept_vmas = memory->pages.mappingCount();
+    uint64_t protect_calls = memory->resolved.getProtectCalls();
+
+    manager->close(memory->vaddr, segment_size, 0);
+
+    printf("resolution, %s, sweep, %s, ms, %f, mprotect_calls, %lu, vmas_before, %d, vmas_after, %d\n",
+        BATCHED_RESOLUTION ? "runs" : "per_page", async ? "async" : "sync", t.getTime()[0] / 1e6,
+        (unsigned long)protect_calls, touched_vmas, swept_vmas);
+    return 0;
+#endif
+}
@@ -0,0 +1,98 @@
+#include <stdint.h>
+
+#include <algorithm>
+#include <cstddef>
+#include <iostream>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "RDMAMemory.hpp"
+#include "paging.hpp"
+
+/*
+    num_threads threads touch every page of one migrated segment, each in its own random order,
+    so most pages are faulted by several threads at once. Losers of the Remote -> InFlight race
+    sleep on the page until the winner has pulled it. Reports the time until every thread has
+    seen every page and the per access latency over all threads.
+    PAGING has to be set from the build (-DPAGING=1)
+*/
+
+int main(int argc, char* argv[]) {
+    if (argc < 5) {
+        std::cerr << "./expSharedFaults path_to_config server_id segment_size num_threads" << std::endl;
+        return 1;
+    }
+#if !PAGING
+    std::cerr << "build with -DPAGING=1 to run this experiment" << std::endl;
+    return 1;
+#else
+    int id = atoi(argv[2]);
+    size_t segment_size = atol(argv[3]);
+    int num_threads = atoi(argv[4]);
+    size_t page_size = 4096;
+    RDMAMemoryManager* memory_manager = new RDMAMemoryManager(argv[1], id);
+    manager = memory_manager;
+    #if !USERFAULTFD
+        initialize();
+    #endif
+
+    if (id == 0) {
+        void* address = manager->allocate(segment_size);
+        memset(address, 'x', segment_size);
+        manager->Prepare(address, segment_size, 1);
+        while(manager->PollForAccept() == nullptr) {}
+        manager->Transfer(address, segment_size, 1);
+        while(manager->PollForClose() == nullptr) {}
+        return 0;
+    }
+
+    RDMAMemory* memory = nullptr;
+    while((memory = manager->PollForTransfer()) == nullptr) {}
+    size_t num_pages = segment_size / page_size;
+
+    std::vector<std::vector<double>> latencies(num_threads);
+    std::vector<std::thread> threads;
+    TestTimer total;
+    total.start();
+    for (int n=0; n<num_threads; n++) {
+        threads.push_back(std::thread([&, n]() {
+            std::vector<size_t> order(num_pages);
+            for (size_t i=0; i<num_pages; i++) {
+                order[i] = i;
+            }
+            std::shuffle(order.begin(), order.end(), std::mt19937(n));
+
+            MultiTimer t;
+            for (size_t i=0; i<num_pages; i++) {
+                volatile char* addr = (volatile char*)memory->vaddr + page_size * order[i];
+                t.start();
+                char c = *addr;
+                t.stop();
+                LogAssert(c == 'x', "page %zu did not arrive", order[i]);
+            }
+            latencies[n] = t.getTime();
+        }));
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    total.stop();
+    manager->close(memory->vaddr, segment_size, 0);
+
+    std::vector<double> all;
+    for (auto& times : latencies) {
+        all.insert(all.end(), times.begin(), times.end());
+    }
+    std::sort(all.begin(), all.end());
+    double sum = 0;
+    for (double time : all) {
+        sum += time;
+    }
+    printf("threads, %d, pages, %zu, total_usec, %f, mean_ns, %f, p50_ns, %f, p99_ns, %f\n",
+        num_threads, num_pages, total.get_duration_usec(), sum / all.size(),
+        all[all.size() / 2], all[(all.size() * 99) / 100]);
+    return 0;
+#endif
+}
@@ -0,0 +1,66 @@
+#include <stdint.h>
+
+#include <cstddef>
+#include <iostream>
+#include <string>
+
+#include "RDMAMemory.hpp"
+#include "paging.hpp"
+
+/*
+    migrates a 1 GB segment of which only one 4 KB page out of every stride was ever written
+    the receiver brings the whole segment over (on_transfer without PAGING, PullAllPages with it)
+    and reports the bytes it read, the sender reports the time from Transfer to close
+    built twice by the Makefile, expZeroPagesFull with ZERO_PAGE_ELISION=0 reads every page
+*/
+
+int main(int argc, char* argv[]) {
+    if (argc < 4) {
+        std::cerr << "./expZeroPages path_to_config server_id stride" << std::endl;
+        return 1;
+    }
+    int id = atoi(argv[2]);
+    size_t stride = atol(argv[3]);
+    size_t segment_size = (size_t)1024 * 1024 * 1024;
+    size_t page_size = 4096;
+    RDMAMemoryManager* memory_manager = new RDMAMemoryManager(argv[1], id);
+    #if PAGING
+    manager = memory_manager;
+    initialize();
+    #endif
+
+    if (id == 0) {
+        void* address = memory_manager->allocate(segment_size);
+        for (size_t offset = 0; offset < segment_size; offset += page_size * stride) {
+            *((char*)address + offset) = 'x';
+        }
+        memory_manager->Prepare(address, segment_size, 1);
+        while(memory_manager->PollForAccept() == nullptr) {}
+
+        MultiTimer t;
+        t.start();
+        memory_manager->Transfer(address, segment_size, 1);
+        while(memory_manager->PollForClose() == nullptr) {}
+        t.stop();
+        printf("elision, %s, stride, %zu, migration_ms, %f\n",
+            ZERO_PAGE_ELISION ? "on" : "off", stride, t.getTime()[0] / 1e6);
+        return 0;
+    }
+
+    RDMAMemory* memory = nullptr;
+    while((memory = memory_manager->PollForTransfer()) == nullptr) {}
+    #if PAGING
+    memory_manager->PullAllPagesWithoutClose(memory);
+    #endif
+    for (size_t offset = 0; offset < segment_size; offset += page_size * stride) {
+        LogAssert(*((char*)memory->vaddr + offset) == 'x', "page at %zu did not arrive", offset);
+    }
+    LogAssert(*((char*)memory->vaddr + page_size / 2) == 0, "untouched bytes are not zero");
+    uint64_t pulled = memory_manager->pulled_bytes.load();
+    memory_manager->close(memory->vaddr, segment_size, 0);
+
+    printf("elision, %s, stride, %zu, touched_bytes, %zu, pulled_bytes, %lu\n",
+        ZERO_PAGE_ELISION ? "on" : "off", stride, (segment_size / (page_size * stride)) * page_size,
+        (unsigned long)pulled);
+    return 0;
+}
@@ -0,0 +1,15 @@
+#!/bin/bash
+
+if [ $# -lt 1 ];then
+    echo "Arguments missing"
+    exit 1
+fi
+
+# p50/p99 demand fault latency with and without a 1 GB background sweep,
+# priority scheduler against the fixed max_async_pending window
+server_id=$1
+faults=20000
+
+./expBackgroundFaults ../config.txt $server_id $faults none
+./expBackgroundFaults ../config.txt $server_id $faults background
+./expBackgroundFaultsFifo ../config.txt $server_id $faults background
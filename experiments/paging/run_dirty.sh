@@ -0,0 +1,14 @@
+#!/bin/bash
+
+if [ $# -lt 1 ];then
+    echo "Arguments missing"
+    exit 1
+fi
+
+# PushDirty against a full Push of a 256 MB segment as more of it gets written
+server_id=$1
+
+for dirty_percent in 1 5 25 50 100
+do
+    ./expDirtyPush ../config.txt $server_id $dirty_percent
+done
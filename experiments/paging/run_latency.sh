@@ -0,0 +1,13 @@
+#!/bin/bash
+
+if [ $# -lt 1 ];then
+    echo "Arguments missing"
+    exit 1
+fi
+
+# per fault latency, sigsegv pager against userfaultfd pager, 64 MB segment
+server_id=$1
+segment_size=$((64*1024*1024))
+
+./expFaultLatency ../config.txt $server_id $segment_size
+./expFaultLatencyUffd ../config.txt $server_id $segment_size
@@ -0,0 +1,15 @@
+#!/bin/bash
+
+if [ $# -lt 1 ];then
+    echo "Arguments missing"
+    exit 1
+fi
+
+# PullAllPagesParallel on a 4 GB segment with 1 to 8 workers, without and with page checksums
+server_id=$1
+
+for workers in 1 2 3 4 5 6 7 8
+do
+    ./expParallelPull ../config.txt $server_id $workers
+    ./expParallelPullChecksums ../config.txt $server_id $workers
+done
@@ -0,0 +1,14 @@
+#!/bin/bash
+
+if [ $# -lt 1 ];then
+    echo "Arguments missing"
+    exit 1
+fi
+
+# copied and paged segments from one binary
+server_id=$1
+
+for size in $((16*1024*1024)) $((256*1024*1024)) $((1024*1024*1024))
+do
+    ./expMixedPolicy ../config.txt $server_id $size
+done
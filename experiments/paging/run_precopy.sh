@@ -0,0 +1,15 @@
+#!/bin/bash
+
+if [ $# -lt 1 ];then
+    echo "Arguments missing"
+    exit 1
+fi
+
+# pre-copy downtime of a 256 MB segment against the rate its pages are written at
+server_id=$1
+max_downtime_us=1000
+
+for writes_per_ms in 0 10 100 1000 10000
+do
+    ./expPreCopy ../config.txt $server_id $writes_per_ms $max_downtime_us
+done
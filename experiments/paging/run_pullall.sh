@@ -0,0 +1,15 @@
+#!/bin/bash
+
+if [ $# -lt 1 ];then
+    echo "Arguments missing"
+    exit 1
+fi
+
+# PullAllPages on a 1 GB segment, mprotect per run against mprotect per page
+server_id=$1
+
+for sweep in sync async
+do
+    ./expPullAll ../config.txt $server_id $sweep
+    ./expPullAllPerPage ../config.txt $server_id $sweep
+done
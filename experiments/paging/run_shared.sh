@@ -0,0 +1,15 @@
+#!/bin/bash
+
+if [ $# -lt 1 ];then
+    echo "Arguments missing"
+    exit 1
+fi
+
+# 1 to 16 threads faulting the same 64 MB segment
+server_id=$1
+segment_size=$((64*1024*1024))
+
+for threads in 1 2 4 8 16
+do
+    ./expSharedFaults ../config.txt $server_id $segment_size $threads
+done
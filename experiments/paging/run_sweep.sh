@@ -0,0 +1,9 @@
+#!/bin/bash
+
+# page state memory and sweep speed for a 64 GB segment, from all remote to almost all local
+segment_gb=64
+
+for local_percent in 0 50 90 99 100
+do
+    ./expPageSweep $segment_gb $local_percent
+done
@@ -0,0 +1,15 @@
+#!/bin/bash
+
+if [ $# -lt 1 ];then
+    echo "Arguments missing"
+    exit 1
+fi
+
+# bytes read for a 1 GB segment touched on one page out of every stride, with and without elision
+server_id=$1
+
+for stride in 1 16 256 4096
+do
+    ./expZeroPages ../config.txt $server_id $stride
+    ./expZeroPagesFull ../config.txt $server_id $stride
+done
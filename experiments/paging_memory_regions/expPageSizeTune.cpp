@@ -0,0 +1,83 @@
+#include <stdint.h>
+#include <unistd.h>
+
+#include <cstddef>
+#include <iostream>
+#include <string>
+
+#include "RDMAMemory.hpp"
+#include "paging.hpp"
+
+/*
+    bounces one 256 MB segment between two servers with an auto tuned page size
+    the receiver of every round touches one 4 KB block out of every stride, then pulls the rest
+    and sends the segment back, the page size it saw and how densely it faulted are printed,
+    stride 1 should climb to 2 MB pages and a large stride should fall back towards 4 KB
+    PAGING has to be set from the build (-DPAGING=1)
+*/
+
+int main(int argc, char* argv[]) {
+    if (argc < 6) {
+        std::cerr << "./expPageSizeTune path_to_config server_id initial_page_size stride rounds" << std::endl;
+        return 1;
+    }
+#if !PAGING
+    std::cerr << "build with -DPAGING=1 to run this experiment" << std::endl;
+    return 1;
+#else
+    int id = atoi(argv[2]);
+    size_t initial_page_size = atol(argv[3]);
+    size_t stride = atol(argv[4]);
+    int rounds = atoi(argv[5]);
+    size_t segment_size = (size_t)256 * 1024 * 1024;
+    int other = 1 - id;
+
+    RDMAMemoryManager* memory_manager = new RDMAMemoryManager(argv[1], id);
+    manager = memory_manager;
+    initialize();
+
+    void* address = nullptr;
+    if (id == 0) {
+        address = manager->allocate(segment_size);
+        memset(address, 'x', segment_size);
+        if (manager->SetPageSize(address, initial_page_size) != 0)
+            return 1;
+        manager->SetPageSize(address, RDMAMemory::AUTO_PAGE_SIZE);
+    }
+
+    for (int round = 0; round < rounds; round++) {
+        if (round % 2 == id) {
+            manager->Prepare(address, segment_size, other);
+            while(manager->PollForAccept() == nullptr) {}
+            manager->Transfer(address, segment_size, other);
+            while(manager->PollForClose() == nullptr) {}
+            // the segment comes back through accept, which maps it again
+            manager->deallocate(address);
+            continue;
+        }
+
+        RDMAMemory* memory = nullptr;
+        while((memory = manager->PollForTransfer()) == nullptr) {}
+        address = memory->vaddr;
+
+        MultiTimer t;
+        t.start();
+        for (size_t offset = 0; offset < segment_size; offset += 4096 * stride) {
+            LogAssert(*((volatile char*)address + offset) == 'x', "block at %zu did not arrive", offset);
+        }
+        t.stop();
+
+        double density = (double)memory->demand_faults.load() / memory->pages.num_pages;
+        printf("round, %d, stride, %zu, page_size, %zu, faults, %lu, density, %f, ms, %f\n",
+            round, stride, memory->pages.getPageSize(), (unsigned long)memory->demand_faults.load(),
+            density, t.getTime()[0] / 1e6);
+        fflush(stdout);
+
+        manager->PullAllPagesWithoutClose(memory);
+        manager->close(address, segment_size, other);
+        // give the previous holder time to unmap its copy before the segment goes back
+        usleep(10000);
+    }
+    return 0;
+#endif
+}
@@ -29,8 +29,7 @@ int main(int argc, char* argv[]) {
 
     if (id == 0) {
         void* address = manager->allocate(container_size);
-        manager->SetPageSize(address, page_size);
-        manager->Prepare(address, container_size, 1);
+        manager->Prepare(address, container_size, 1, page_size);
         RDMAMemory* memory = nullptr;
         while((memory = manager->PollForAccept()) == nullptr) {}
         manager->Transfer(address, container_size, 1);
@@ -41,8 +40,8 @@ int main(int argc, char* argv[]) {
         RDMAMemory* memory = nullptr;
         while((memory = manager->PollForTransfer()) == nullptr) {}
 
+        // the page size came with the transfer
         void* addr = memory->vaddr;
-        manager->SetPageSize(addr, page_size);
         void* end_addr = (void*)((char*)memory->vaddr + container_size);
         LogInfo("addr is %p\n", addr);
         while((uintptr_t)addr < (uintptr_t)end_addr) {
@@ -51,6 +50,11 @@ int main(int argc, char* argv[]) {
             t.stop();
             addr = (void*) ((char*)addr + page_size);
         }
+#if STRIDE_PREFETCHING
+        LogInfo("prefetcher faults %lu, readahead issued %lu, pattern hits %lu",
+            (unsigned long)memory->prefetcher.faults.load(), (unsigned long)memory->prefetcher.issued.load(),
+            (unsigned long)memory->prefetcher.hits.load());
+#endif
         manager->close(memory->vaddr, container_size, 0);
     }
 
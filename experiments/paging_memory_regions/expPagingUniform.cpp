@@ -28,8 +28,7 @@ int main(int argc, char* argv[]) {
 
     if (id == 0) {
         void* address = manager->allocate(container_size);
-        manager->SetPageSize(address, page_size);
-        manager->Prepare(address, container_size, 1);
+        manager->Prepare(address, container_size, 1, page_size);
         RDMAMemory* memory = nullptr;
         while((memory = manager->PollForAccept()) == nullptr) {}
         manager->Transfer(address, container_size, 1);
@@ -39,7 +38,7 @@ int main(int argc, char* argv[]) {
 
         RDMAMemory* memory = nullptr;
         while((memory = manager->PollForTransfer()) == nullptr) {}
-        manager->SetPageSize(memory->vaddr, page_size);
+        // the page size came with the transfer
         
 
         void* addr = memory->vaddr;
@@ -72,6 +71,11 @@ int main(int argc, char* argv[]) {
         // double time_taken = t.get_duration_usec();        
         // printf("time taken %f to pull page of size %lu\n", timer.get_duration_usec(), 4096);
 
+#if STRIDE_PREFETCHING
+        LogInfo("prefetcher faults %lu, readahead issued %lu, pattern hits %lu",
+            (unsigned long)memory->prefetcher.faults.load(), (unsigned long)memory->prefetcher.issued.load(),
+            (unsigned long)memory->prefetcher.hits.load());
+#endif
         manager->close(memory->vaddr, container_size, 0);
     }
 
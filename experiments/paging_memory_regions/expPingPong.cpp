@@ -1,78 +1,119 @@
 #include <stdint.h>
+#include <unistd.h>
 
+#include <algorithm>
 #include <cstddef>
 #include <iostream>
 #include <string>
 #include <random>
+#include <vector>
 
 #include "mempool.hpp"
 #include "rdma_vector.hpp"
 #include "rdma_unordered_map.hpp"
 #include "paging.hpp"
 
+/*
+    bounces one segment between two servers, every holder reads the same hot set of pages right
+    after the handoff, writes a share of the pages, then pulls the rest of the segment and sends it back
+    prints the time of that first pass and the demand faults it took, the fault storm after a handoff,
+    and the bytes the holder read for the round
+    the per segment latency histograms go to pingpong_stats_<server_id>.json
+    built twice by the Makefile, expPingPongHot with HOT_PAGE_PUSH=1 writes the hot set into
+    the next holder with every transfer, expPingPongDelta with DELTA_MIGRATION keeps the segment on
+    the node it left and only reads the pages written since when it comes back
+    PAGING has to be set from the build (-DPAGING=1)
+*/
+
 int main(int argc, char* argv[]) {
     if (argc < 5) {
-        std::cerr << "./expPingPong path_to_config server_id container_size page_size" << std::endl;
+        std::cerr << "./expPingPong path_to_config server_id container_size page_size [hot_percent rounds write_percent]" << std::endl;
         return 1;
     }
-
+#if !PAGING
+    std::cerr << "build with -DPAGING=1 to run this experiment" << std::endl;
+    return 1;
+#else
     int id = atoi(argv[2]);
-    size_t container_size = atoi(argv[3]);
-    size_t page_size = atoi(argv[4]);
+    size_t container_size = atol(argv[3]);
+    size_t page_size = atol(argv[4]);
+    int hot_percent = argc > 5 ? atoi(argv[5]) : 10;
+    int rounds = argc > 6 ? atoi(argv[6]) : 10;
+    int write_percent = argc > 7 ? atoi(argv[7]) : 0;
+    int other = 1 - id;
 
     RDMAMemoryManager* memory_manager = new RDMAMemoryManager(argv[1], id);
     manager = memory_manager;
     initialize();
-    
-    // int exp_duration = 1;
-    int exp_iterations = 10000;
-    RDMAMemory* memory = nullptr;
+    // kill -USR1 dumps the fault histograms while the bounce is running, a last dump follows at the end
+    std::string stats = "pingpong_stats_" + std::to_string(id) + ".json";
+    memory_manager->DumpStatsOnSignal(stats);
+
+    // the same hot pages on both servers, visited in a random order
+    size_t num_pages = container_size / page_size;
+    std::vector<size_t> hot_pages(num_pages);
+    for (size_t i=0; i<num_pages; i++) {
+        hot_pages[i] = i;
+    }
+    std::mt19937 gen(7);
+    std::shuffle(hot_pages.begin(), hot_pages.end(), gen);
+    // every holder writes the same pages, a separate draw from the hot set
+    std::vector<size_t> written_pages(num_pages);
+    for (size_t i=0; i<num_pages; i++) {
+        written_pages[i] = i;
+    }
+    std::shuffle(written_pages.begin(), written_pages.end(), gen);
+    written_pages.resize(num_pages * write_percent / 100);
+    hot_pages.resize(num_pages * hot_percent / 100);
+
     void* address = nullptr;
-    MultiTimer t = MultiTimer();    
-    t.start();
-    for (int i=0; i< exp_iterations; i++) {
-        if (id == 0) {
-            // printf("server 0\n");
-            address = manager->allocate(container_size);
-            memory = nullptr;
+    if (id == 0) {
+        address = manager->allocate(container_size);
+        memset(address, 'x', container_size);
+    }
 
-            manager->Prepare(address, container_size, 1);
-            memory = nullptr;
-            while((memory = manager->PollForAccept()) == nullptr) {}
-            manager->Transfer(address, container_size, 1);
-            
-            // printf("TRANSFERRED\n");
+    for (int round = 0; round < rounds; round++) {
+        if (round % 2 == id) {
+            if (round == 0)
+                manager->Prepare(address, container_size, other, page_size);
+            else
+                manager->Prepare(address, container_size, other);
+            while(manager->PollForAccept() == nullptr) {}
+            manager->Transfer(address, container_size, other);
+            while(manager->PollForClose() == nullptr) {}
+            // the segment comes back through accept, which maps it again
+            manager->deallocate(address);
+            continue;
+        }
 
-            // memory = nullptr;
-            // while((memory = manager->PollForTransfer()) == nullptr) {}
-            // printf("RECEIVED\n");
-        } else {
-            // printf("server 1\n");
-            
-            while((memory = manager->PollForTransfer()) == nullptr) {}
-            
+        RDMAMemory* memory = nullptr;
+        while((memory = manager->PollForTransfer()) == nullptr) {}
+        address = memory->vaddr;
+        uint64_t pulled = memory_manager->pulled_bytes.load();
 
-            // printf("RECEIVED\n");
-            // manager->Prepare(address, container_size, 0);
-            // memory = nullptr;
-            // while((memory = manager->PollForAccept()) == nullptr) {}
-            // manager->Transfer(address, container_size, 0);
-            // printf("TRANSFERRED\n");
+        MultiTimer t;
+        t.start();
+        for (size_t page : hot_pages) {
+            LogAssert(*((volatile char*)address + page * page_size) == 'x', "page %zu did not arrive", page);
+        }
+        t.stop();
+        uint64_t faults = memory->demand_faults.load();
 
+        for (size_t page : written_pages) {
+            *((volatile char*)address + page * page_size) = 'x';
         }
-    }
-    t.stop();
-    printf("EXPERIMENT COMPLETE");
-    std::vector<double> vec2 = t.getTime();
-    double x = 0;
-    for(unsigned int i=0; i<vec2.size(); i++) {
-        x += vec2.at(i);
-        printf("Time Taken: %f\n", vec2.at(i));
-    }
+        manager->PullAllPagesWithoutClose(memory);
+        printf("round, %d, hot_push, %s, delta, %s, hot_pages, %zu, faults, %lu, first_pass_us, %f, written_pages, %zu, pulled_mb, %f\n",
+            round, HOT_PAGE_PUSH ? "on" : "off", DELTA_MIGRATION ? "on" : "off", hot_pages.size(),
+            (unsigned long)faults, t.getTime()[0] / 1e3, written_pages.size(),
+            (memory_manager->pulled_bytes.load() - pulled) / 1e6);
+        fflush(stdout);
 
-    printf("average time taken: %f", double(x/exp_iterations));
-    fflush(stdout);
-    
+        manager->close(address, container_size, other);
+        // give the previous holder time to unmap its copy before the segment goes back
+        usleep(10000);
+    }
+    memory_manager->DumpStats(stats);
     return 0;
+#endif
 }
-
@@ -0,0 +1,25 @@
+#!/bin/bash
+
+if [ $# -lt 1 ];then
+    echo "Arguments missing"
+    exit 1
+fi
+
+# faults right after each handoff of a 64 MB segment, with and without pushing the hot set
+server_id=$1
+container_size=$((64*1024*1024))
+page_size=4096
+rounds=10
+
+for hot_percent in 1 10 50
+do
+    ./expPingPong ../config.txt $server_id $container_size $page_size $hot_percent $rounds
+    ./expPingPongHot ../config.txt $server_id $container_size $page_size $hot_percent $rounds
+done
+
+# bytes read per handoff when a share of the pages is written, whole segment against the delta
+for write_percent in 1 10 50
+do
+    ./expPingPong ../config.txt $server_id $container_size $page_size 10 $rounds $write_percent
+    ./expPingPongDelta ../config.txt $server_id $container_size $page_size 10 $rounds $write_percent
+done
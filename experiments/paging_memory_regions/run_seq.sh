@@ -6,13 +6,19 @@ if [ $# -lt 1 ];then
 fi
 
 server_id=$1
-max_memory=$((16*1024*1024))
+# ./run_seq.sh server_id stride runs the build with the stride prefetcher
+binary=./expPagingSingle
+if [ "$2" == "stride" ];then
+    binary=./expPagingSingleStride
+fi
+# page sizes go up to 2 MB
+max_memory=$((2*1024*1024))
 total_memory=$((67108864))
 iter=100
 test_memory=4096
 
 while [ "$test_memory" -le "$max_memory" ]
 do
-    ./expPagingSingle ../config.txt $server_id $total_memory $test_memory $iter
+    $binary ../config.txt $server_id $total_memory $test_memory $iter
     test_memory=$((test_memory*2))
 done
\ No newline at end of file
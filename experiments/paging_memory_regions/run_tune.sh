@@ -0,0 +1,15 @@
+#!/bin/bash
+
+if [ $# -lt 1 ];then
+    echo "Arguments missing"
+    exit 1
+fi
+
+server_id=$1
+initial_page_size=65536
+rounds=8
+
+for stride in 1 16 256
+do
+    ./expPageSizeTune ../config.txt $server_id $initial_page_size $stride $rounds
+done
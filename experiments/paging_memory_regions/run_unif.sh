@@ -6,12 +6,18 @@ if [ $# -lt 1 ];then
 fi
 
 server_id=$1
-max_memory=$((16*1024*1024))
+# ./run_unif.sh server_id stride runs the build with the stride prefetcher
+binary=./expPagingUniform
+if [ "$2" == "stride" ];then
+    binary=./expPagingUniformStride
+fi
+# page sizes go up to 2 MB
+max_memory=$((2*1024*1024))
 total_memory=$((67108864))
 test_memory=4096
 
 while [ "$test_memory" -le "$max_memory" ]
 do
-    ./expPagingUniform ../config.txt $server_id $total_memory $test_memory
+    $binary ../config.txt $server_id $total_memory $test_memory
     test_memory=$((test_memory*2))
 done
\ No newline at end of file
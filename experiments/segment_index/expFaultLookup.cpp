@@ -0,0 +1,116 @@
+#include <stdint.h>
+#include <signal.h>
+#include <sys/mman.h>
+
+#include <cstddef>
+#include <iostream>
+#include <string>
+#include <random>
+#include <math.h>
+
+#include "distributed-allocator/RDMAMemory.hpp"
+
+/*
+    Measures the cost of a page fault as seen by the paging handler against the number of
+    segments the manager is tracking. The handler resolves the fault the same way sigsegv_advance
+    does minus the RDMA read: find the segment, then mprotect the page back.
+    linear is the old scan over the memory map, index is the SegmentIndex lookup.
+*/
+
+static const size_t segment_size = 2 * 4096;
+
+static SegmentIndex* index_ = nullptr;
+static std::unordered_map<void*, RDMAMemory*>* memory_map_ = nullptr;
+static volatile bool use_index = true;
+static struct sigaction fault_act;
+
+static RDMAMemory* linear_lookup(void* address) {
+    for (auto it = memory_map_->begin(); it != memory_map_->end(); it++) {
+        RDMAMemory* memory = it->second;
+        if(address >= memory->vaddr && address < (void*)((char*)memory->vaddr + memory->size))
+            return memory;
+    }
+    return nullptr;
+}
+
+static void fault_handler(int signum, siginfo_t *info_, void* ptr) {
+    void* addr = info_->si_addr;
+    RDMAMemory* memory = use_index ? index_->find(addr) : linear_lookup(addr);
+    if(memory == nullptr) {
+        LogError("fault outside of tracked segments");
+        exit(1);
+    }
+    addr = memory->pages.getPageAddress(addr);
+    if(mprotect(addr, memory->pages.getPageSize(), PROT_READ | PROT_WRITE)) {
+        perror("couldnt mprotect in fault handler");
+        exit(errno);
+    }
+}
+
+static double run(std::vector<RDMAMemory*>& segments, int faults, bool index) {
+    use_index = index;
+    std::mt19937 gen(42);
+    std::uniform_int_distribution<size_t> pick(0, segments.size() - 1);
+    MultiTimer t;
+    for (int i=0; i<faults; i++) {
+        RDMAMemory* memory = segments.at(pick(gen));
+        if(mprotect(memory->vaddr, memory->size, PROT_NONE)) {
+            perror("mprotect");
+            exit(errno);
+        }
+        t.start();
+        *((volatile char*)memory->vaddr) = 'a';
+        t.stop();
+    }
+
+    std::vector<double> times = t.getTime();
+    double sum = 0;
+    for(unsigned int i=0; i<times.size(); i++) {
+        sum += times.at(i);
+    }
+    return sum/times.size();
+}
+
+int main(int argc, char* argv[]) {
+    if (argc < 3) {
+        std::cerr << "./expFaultLookup max_segments faults_per_step" << std::endl;
+        return 1;
+    }
+
+    size_t max_segments = atol(argv[1]);
+    int faults = atoi(argv[2]);
+
+    memset(&fault_act, 0, sizeof(fault_act));
+    fault_act.sa_sigaction = fault_handler;
+    fault_act.sa_flags = SA_SIGINFO;
+    sigaction(SIGSEGV, &fault_act, NULL);
+
+    index_ = new SegmentIndex();
+    memory_map_ = new std::unordered_map<void*, RDMAMemory*>();
+    std::vector<RDMAMemory*> segments;
+
+    // leave a one page hole between segments so lookups cannot get lucky on adjacency
+    uintptr_t next = ALLOCATABLE_RANGE_START;
+    for (size_t n = 1; n <= max_segments; n *= 2) {
+        while (segments.size() < n) {
+            void* res = mmap((void*)next, segment_size, PROT_READ | PROT_WRITE,
+                MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+            if (res == MAP_FAILED || (uintptr_t)res != next) {
+                LogError("could not map segment at %p", (void*)next);
+                return 1;
+            }
+            RDMAMemory* memory = new RDMAMemory(0, res, segment_size);
+            segments.push_back(memory);
+            (*memory_map_)[res] = memory;
+            index_->insert(res, segment_size, memory);
+            next += segment_size + 4096;
+        }
+
+        double linear = run(segments, faults, false);
+        double indexed = run(segments, faults, true);
+        printf("segments, %zu, linear, %f, index, %f\n", n, linear, indexed);
+        fflush(stdout);
+    }
+
+    return 0;
+}
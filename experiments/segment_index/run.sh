@@ -0,0 +1,7 @@
+#!/bin/bash
+
+# fault latency against the number of live segments, runs locally (no RDMA peer needed)
+max_segments=$((16*1024))
+faults=10000
+
+./expFaultLookup $max_segments $faults
@@ -0,0 +1,100 @@
+#include <stdint.h>
+
+#include <cstddef>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "distributed-allocator/mempool.hpp"
+#include "distributed-allocator/magazine.hpp"
+#include "c++-containers/rdma_unordered_map.hpp"
+
+/*
+    scaling of concurrent allocation from one container pool, 1 to max_threads threads
+    - magazine: every thread allocates and frees map node sized blocks through its thread cache
+    - locked: the same through the pool lock only, the baseline the caches replace
+    - map: every thread inserts its own key range into one RDMAUnorderedMap, the map itself
+      is not thread safe so the inserts are serialized, the node allocations go through the caches
+*/
+
+static const size_t node_size = 32;
+
+static void churn(MemoryPool* pool, long ops, bool magazine) {
+    std::vector<void*> live;
+    for (long i=0; i<ops; i++) {
+        if (live.size() < 1024) {
+            void* p = magazine ? MagazineCache::allocate(pool, node_size) : pool->allocate(node_size);
+            *((volatile char*)p) = 'a';
+            live.push_back(p);
+        } else {
+            void* p = live[i % live.size()];
+            live[i % live.size()] = live.back();
+            live.pop_back();
+            if (magazine)
+                MagazineCache::deallocate(pool, p, node_size);
+            else
+                pool->deallocate(p, node_size);
+        }
+    }
+    for (void* p : live) {
+        if (magazine)
+            MagazineCache::deallocate(pool, p, node_size);
+        else
+            pool->deallocate(p, node_size);
+    }
+    if (magazine)
+        MagazineCache::flush(pool);
+}
+
+int main(int argc, char* argv[]) {
+    if (argc < 6) {
+        std::cerr << "./expParallelInsert path_to_config server_id mode(magazine|locked|map) max_threads ops_per_thread" << std::endl;
+        return 1;
+    }
+
+    int id = atoi(argv[2]);
+    std::string mode = argv[3];
+    int max_threads = atoi(argv[4]);
+    long ops = atol(argv[5]);
+
+    RDMAMemoryManager* memory_manager = new RDMAMemoryManager(argv[1], id);
+
+    for (int num_threads = 1; num_threads <= max_threads; num_threads *= 2) {
+        RDMAUnorderedMap<long, long> map(memory_manager);
+        map.SetContainerSize((size_t)1024 * 1024 * 256);
+        map.instantiate();
+        MemoryPool* pool = const_cast<MemoryPool*>(map.GetMemoryPool());
+        std::mutex map_mutex;
+
+        TestTimer t;
+        t.start();
+        std::vector<std::thread> threads;
+        for (int n=0; n<num_threads; n++) {
+            threads.push_back(std::thread([&, n]() {
+                if (mode == "map") {
+                    for (long i=0; i<ops; i++) {
+                        long key = n * ops + i;
+                        std::lock_guard<std::mutex> guard(map_mutex);
+                        map[key] = key;
+                    }
+                    map.FlushThreadCache();
+                } else {
+                    churn(pool, ops, mode == "magazine");
+                }
+            }));
+        }
+        for (auto& thread : threads) {
+            thread.join();
+        }
+        t.stop();
+
+        double ops_per_sec = (double)num_threads * ops / (t.get_duration_usec() / 1e6);
+        printf("mode, %s, threads, %d, ops_per_sec, %f, in_use, %zu\n",
+            mode.c_str(), num_threads, ops_per_sec, pool->in_use());
+        fflush(stdout);
+    }
+
+    return 0;
+}
@@ -0,0 +1,15 @@
+#!/bin/bash
+
+if [ $# -lt 1 ];then
+    echo "Arguments missing"
+    exit 1
+fi
+
+# 1 to 16 threads allocating from the same container pool
+server_id=$1
+ops=$((1000*1000))
+
+for mode in locked magazine map
+do
+    ./expParallelInsert ../config.txt $server_id $mode 16 $ops
+done
@@ -29,8 +29,10 @@ For more information, see http://en.cppreference.com/w/cpp/concept/Allocator
 
 #include <iostream>
 #include <limits>
+#include <new>
 
 #include "distributed-allocator/mempool.hpp"
+#include "distributed-allocator/magazine.hpp"
 
 // This allocator was started with boilerplate code from:
 // https://howardhinnant.github.io/allocator_boilerplate.html
@@ -152,12 +154,14 @@ public:
 
     pointer allocate(size_type num) {
         if (mempool == NULL) { return this->temp_allocate(num); }
-        return static_cast<pointer>(
-            (*mempool)->allocate(num * sizeof(value_type)));
+        // small blocks come from this thread's magazines, so containers can be filled concurrently
+        void* result = MagazineCache::allocate(*mempool, num * sizeof(value_type));
+        if (result == NULL) { throw std::bad_alloc(); }
+        return static_cast<pointer>(result);
     }
     void deallocate(pointer addr, size_type num) noexcept {
         if (mempool == NULL) { return this->temp_deallocate(addr, num); }
-        return (*mempool)->deallocate(addr, num * sizeof(value_type));
+        return MagazineCache::deallocate(*mempool, addr, num * sizeof(value_type));
     }
 
     // See commment at mempool field for details.
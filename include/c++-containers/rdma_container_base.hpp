@@ -29,6 +29,11 @@ public:
     /*
         Interface for sending the container to remote host with ID
     */
+    /*
+        Threads other than the caller that allocated from this container
+        must call FlushThreadCache before Prepare
+    */
+    void FlushThreadCache();
     bool Prepare(int destination);
     bool PollForAccept();
     bool Transfer(); 
@@ -56,15 +61,23 @@ public:
      * params:
      * int rate_limiter: number of pending async ops allowed, a higher number will increase 
      *                      latency of demand pulling as we only open one connection 
+     * Both return false once a page cannot be read intact, its segment is Invalid then
+    */
+    bool PullSync();
+    bool PullAsync(int rate_limiter);
+
+    /**
+     * With DIRTY_TRACKING, writes back only the pages modified since the container arrived
+     * (or since the last PushDirty) to the server it came from, returns the number of pages
     */
-    void PullSync();
-    void PullAsync(int rate_limiter);
+    int PushDirty();
 
     /**
      * If unsure whether all pages required have been imported (not to be used with containers, adding for completeness)
-     * Pulls the entire underlying memory segment and closes the connection on completion
+     * Pulls the entire underlying memory segment and closes the connection on completion,
+     * false if a segment could not be read intact, that one is left Invalid and open
     */
-    void PullAndClose();
+    bool PullAndClose();
 
     /*
         Releases all the associated resources
@@ -76,7 +89,18 @@ public:
         configurations
     */
     void SetContainerSize(size_t size);
+    // page size of every segment, sent along with the next Transfer (RDMAMemory::AUTO_PAGE_SIZE tunes it)
     void SetPageSize(size_t size);
+    /*
+        Address space reserved for the pool to grow into, the pool starts with
+        the container size and maps more segments behind it on demand
+    */
+    void SetMaxContainerSize(size_t size);
+
+    /*
+        allocator state of the container, for reporting pool usage
+    */
+    const MemoryPool* GetMemoryPool() const;
 
 protected:
     /*
@@ -106,6 +130,15 @@ protected:
         TODO, add a configurable param from config
     */ 
     size_t DEFAULT_POOL_SIZE = (size_t)1024 * 1024 * 4;
+    size_t MAX_POOL_SIZE = (size_t)1024 * 1024 * 1024 * 64;
+
+    /*
+        Segments of the pool chain that still have an accept or close outstanding,
+        and the range the chain covered when the migration started
+    */
+    int pending_segments = 0;
+    uintptr_t chain_start = 0;
+    uintptr_t chain_end = 0;
     /*
         Set up the allocator for this container class
         This method requests rdma able memory segment from the manager and 
@@ -118,6 +151,17 @@ protected:
     */
     void set_up_allocator();
 
+    /*
+        Points the pool's grow hook at this container, called whenever the pool
+        is (re)attached in this process, e.g. in remote_instantiate
+    */
+    void bind_pool();
+    static void* grow_pool(void* context, void* address, size_t size);
+
+    // releases one segment of the chain back to the manager
+    void deallocate_segment(void* address);
+    bool in_chain(void* address);
+
     virtual void* get_container_address() = 0;
     virtual void set_container_address(void* container_addr) = 0;
 
@@ -76,6 +76,8 @@ public:
         MemoryPool** pool_ = (MemoryPool**)memory;
         *pool_ = (MemoryPool*) ((char*)memory + sizeof(MemoryPool**));
         this->mempool = *pool_;
+        // the grow hook in the pool still points into the sending process
+        this->bind_pool();
 
         this->alloc = PoolBasedAllocator<T>(&(*pool_));
         void** container_address_ = (void**)((char*)memory + sizeof(MemoryPool**) + sizeof(MemoryPool));
@@ -90,6 +92,8 @@ public:
         MemoryPool** pool_ = (MemoryPool**)memory;
         *pool_ = (MemoryPool*) ((char*)memory + sizeof(MemoryPool**));
         this->mempool = *pool_;
+        // the grow hook in the pool still points into the sending process
+        this->bind_pool();
 
         this->alloc = PoolBasedAllocator<T>(&(*pool_));
         void** container_address_ = (void**)((char*)memory + sizeof(MemoryPool**) + sizeof(MemoryPool));
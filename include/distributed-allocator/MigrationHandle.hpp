@@ -0,0 +1,82 @@
+#ifndef __MIGRATION_HANDLE_HPP__
+#define __MIGRATION_HANDLE_HPP__
+
+/**
+ * The sending side of one segment migration, returned by RDMAMemoryManager::PrepareAsync.
+ * It moves Preparing -> Accepted -> Transferred -> Closed, or ends in Declined if the destination
+ * turns the segment down. Accepted, Declined and Closed come from the poller thread as the messages
+ * arrive, Transferred from the thread that calls Transfer.
+ *
+ * A segment with a handle is reported through its handle only, it never shows up in PollForAccept
+ * or PollForClose. Instead of spinning on those the application blocks in wait() or chains work with
+ * then(), e.g. then(Accepted, transfer) and wait(Closed).
+*/
+
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+#include "utils/miscutils.hpp"
+
+class RDMAMemory;
+
+class MigrationHandle {
+public:
+    enum class State {
+        Preparing,
+        Accepted,
+        Transferred,
+        Closed,
+        Declined,
+    };
+
+    typedef std::function<void(MigrationHandle&)> Continuation;
+
+    MigrationHandle(RDMAMemory* memory, int destination);
+
+    MigrationHandle(const MigrationHandle&) = delete;
+    MigrationHandle& operator=(const MigrationHandle&) = delete;
+
+    State state();
+
+    /**
+     * Blocks until the migration reaches state, timeout_us < 0 waits for good.
+     * Returns true once state is reached, false on timeout or if the migration ended without it
+     * (a declined segment is never Accepted, a closed one never Declined).
+    */
+    bool wait(State state, int64_t timeout_us = -1);
+
+    /**
+     * Runs fn once the migration reaches state, on the thread that moves it there (the poller thread
+     * for Accepted, Declined and Closed), or right away on the caller if it is there already.
+     * fn is dropped if the migration ends without reaching state. fn must not block on the poller,
+     * e.g. wait() for a later state from inside a continuation never returns.
+    */
+    void then(State state, Continuation fn);
+
+    // moves the migration to state and runs the continuations that were waiting for it, for the manager.
+    // A state the migration is already at or past is ignored, the poller may see the CLOSE before
+    // the sending thread reports Transferred
+    void advance(State state);
+
+    RDMAMemory* const memory;
+    const int destination;
+
+private:
+    // whether current is state or past it
+    static bool reached(State current, State state);
+    // no further state follows
+    static bool finished(State current);
+
+    std::mutex mutex;
+    std::condition_variable changed;
+    State current;
+    std::vector<std::pair<State, Continuation>> pending;
+};
+
+#include "distributed-allocator/MigrationHandle.tpp"
+
+#endif // __MIGRATION_HANDLE_HPP__
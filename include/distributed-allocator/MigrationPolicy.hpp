@@ -0,0 +1,58 @@
+#ifndef __MIGRATION_POLICY_HPP__
+#define __MIGRATION_POLICY_HPP__
+
+/**
+ * How a segment is brought over when it migrates. Every RDMAMemory carries one, it is picked at
+ * allocate, SetPolicy or Prepare and travels with the transfer, so one process can hold paged and
+ * copied segments side by side. The receiver keeps it for the next hop.
+ *
+ * The defaults come from the PAGING, PREFETCHING, ASYNC_PREFETCHING, STRIDE_PREFETCHING,
+ * COMPRESSED_TRANSFER, DELTA_MIGRATION and TRANSFER_CHECKSUMS build settings. The transfer message
+ * carries the generations and the checksum table only for segments whose policy asks for them.
+ * Paging needs the pager built in (PAGING=1), without it a paged segment is copied.
+ * A copied segment never has a protected page, so it never enters the fault handler.
+ *
+ * The settings that stay build wide are the ones that pick the process wide machinery rather than
+ * what happens to one segment: PAGING builds the pager in at all, USERFAULTFD picks the one fault
+ * mechanism the process installs (the sigsegv handler or the userfaultfd thread), DIRTY_TRACKING
+ * changes how that pager maps every local page, and PRIORITY_PREFETCHING and BATCHED_RESOLUTION
+ * tune the scheduler and the resolution of background reads that all segments share. None of them
+ * changes what goes into a transfer message, so peers built with different values still work together.
+*/
+
+#include <cstdint>
+
+#include "utils/miscutils.hpp"
+
+struct MigrationPolicy {
+    // fault pages in on demand, otherwise the transfer reads the segment before it is handed out
+    bool paging;
+    // with paging, a thread reads the rest of the segment right after the transfer
+    bool prefetch;
+    // that thread posts async reads instead of reading one page at a time
+    bool async_prefetch;
+    // with paging, demand faults feed the segment's stride detector, which reads ahead along the pattern
+    bool stride_prefetch;
+    // without paging, the segment is run coded before the transfer when a sample says it pays (RunCodec)
+    bool coded;
+    // deallocate keeps the segment when it moves on, it comes back as the pages written since
+    // (those come from DIRTY_TRACKING, a sender without it transfers the whole segment)
+    bool delta;
+    // the transfer carries a CRC32C of every page and the destination checks each page it reads
+    bool checksums;
+
+    static MigrationPolicy Default();
+    static MigrationPolicy Copy(bool coded = COMPRESSED_TRANSFER != 0);
+    static MigrationPolicy Paged(bool prefetch = false, bool async_prefetch = false, bool stride_prefetch = false);
+
+    // the policy as it goes into a transfer message
+    uint32_t encode() const;
+    static MigrationPolicy decode(uint32_t bits);
+
+    bool operator==(const MigrationPolicy& other) const;
+    bool operator!=(const MigrationPolicy& other) const;
+};
+
+#include "distributed-allocator/MigrationPolicy.tpp"
+
+#endif // __MIGRATION_POLICY_HPP__
@@ -2,13 +2,31 @@
 #define __RDMAMemory
 
 #include <cstdint>
+#include <deque>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <signal.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <ucontext.h>
 #include <vector>
 
 #include "utils/miscutils.hpp"
+#include "utils/numa.hpp"
+#include "distributed-allocator/MigrationHandle.hpp"
+#include "distributed-allocator/MigrationPolicy.hpp"
 #include "distributed-allocator/RDMAMemNode.hpp"
+#include "distributed-allocator/RunCodec.hpp"
+#include "distributed-allocator/SegmentIndex.hpp"
 #include "paging/paging.hpp"
+#include "paging/accesslog.hpp"
+#include "paging/checksums.hpp"
+#include "paging/faultstats.hpp"
+#include "paging/prefetcher.hpp"
+#include "paging/pulljob.hpp"
+#include "paging/runbatch.hpp"
+#include "paging/scheduler.hpp"
 
 /*
     This is the basic unit of RDMAable memory that can be called by the application 
@@ -24,6 +42,12 @@ public:
         RDMAMemory(int owner, void* addr, size_t size, size_t page_size, int64_t app_id);
     #endif
     ~RDMAMemory();
+    /**
+     * Puts a recycled segment back into the state a fresh one at addr is in, every field the
+     * constructor sets is set again (the application id is kept). Mapped buffers such as staging
+     * are not released here, the manager does that first.
+    */
+    void reset(int owner, void* addr, size_t size);
     enum class State {         
         Dirty,         
         Invalid,         
@@ -36,12 +60,73 @@ public:
     int owner;
     State state;
     int pair;
+    MigrationPolicy policy;
 
     #if FAULT_TOLERANT
         int64_t application_id;
     #endif
 
     Pages pages;
+    FaultPrefetcher prefetcher;
+    PageRunBatch resolved;
+    // pages this node used recently, pushed ahead of the segment with HOT_PAGE_PUSH
+    PageAccessLog accesses;
+    // fault, pull and push latencies seen for this segment on this node
+    SegmentStats stats;
+    // what the pages pulled here have to match, loaded by the transfer (MigrationPolicy::checksums)
+    PageChecksums checksums;
+
+    /**
+     * Passed as a page size, lets every transfer pick the granularity from how densely the
+     * segment was demand faulted since it last arrived. Never a valid page size, so it also
+     * marks a tuned page size in the transfer message.
+    */
+    static const size_t AUTO_PAGE_SIZE = 1;
+    bool auto_page_size;
+    // demand pulls since the segment arrived, against pages.num_pages at that time
+    std::atomic<uint64_t> demand_faults;
+    // the segment arrived here through paging, so demand_faults means something
+    bool faults_measured;
+    // PreCopy has copied the segment to its pair and tracks writes, Transfer only sends what is dirty
+    bool pre_copied;
+    // set by PrepareAsync before the prepare goes out, dropped by the poller once the migration is over
+    std::shared_ptr<MigrationHandle> handle;
+    // the coded copy a COMPRESSED_TRANSFER reads from, mapped on the source until the segment is closed
+    void* staging;
+    size_t staging_size;
+    // the checksums of the last transfer of the segment on the source, mapped until it is closed
+    void* checksum_table;
+    size_t checksum_table_size;
+    // tags the contents the segment had when it last arrived here or left, 0 if unknown (MigrationPolicy::delta)
+    uint64_t generation;
+    // generation of the copy this node kept when the segment left, reused by the accept that brought it back
+    uint64_t retained_generation;
+    // NUMA node the pages of the segment prefer on this node, NumaNode::UNKNOWN for the RDMA device's
+    int numa_node;
+};
+
+// a run of pages [first, first + count) of a segment
+struct PageExtent {
+    uint32_t first;
+    uint32_t count;
+};
+
+// [0, used) of a segment coded by RunCodec into bytes at addr on the source
+struct CodedImage {
+    void* addr;
+    uint64_t bytes;
+};
+
+// generation of the segment as sent, the runs of the transfer are a delta against base unless it is 0
+struct TransferGeneration {
+    uint64_t generation;
+    uint64_t base;
+};
+
+// PageChecksums::entries(used, unit) CRC32Cs of the segment at addr on the source, none if unit is 0
+struct ChecksumTable {
+    void* addr;
+    uint64_t unit;
 };
 
 /*
@@ -50,6 +135,12 @@ public:
 
 void MarkPageLocalCB(void* data);
 
+// set by the signal installed with RDMAMemoryManager::DumpStatsOnSignal, the poller thread does the dump
+static volatile sig_atomic_t stats_requested = 0;
+static void request_stats(int signum) {
+    stats_requested = 1;
+}
+
 /*
     A server will access memory regions from RDMAMemoryFactory
     - it will be initialized with the upper and lower region along with a coordinator
@@ -64,32 +155,125 @@ public:
     
 public:
     RDMAMemory* getRDMAMemory(void* address);
+    /**
+     * reserve keeps that many bytes of address space starting at the returned address
+     * for this segment, later segments can be mapped into it with allocate(v_addr, size)
+     * so that a container pool can grow in place
+    */
     #if FAULT_TOLERANT
-    void* allocate(size_t size, int64_t id);
+    void* allocate(size_t size, int64_t id, size_t reserve = 0);
+    void* allocate(size_t size, int64_t id, const MigrationPolicy& policy, size_t reserve = 0);
+    // same, the pages prefer numa_node, see SetNumaNode
+    void* allocate(size_t size, int64_t id, const MigrationPolicy& policy, int numa_node, size_t reserve);
     int deallocate(int64_t application_id);
+    // releases a segment that has no zookeeper node of its own, e.g. a pool growth segment
+    void deallocate(void* v_addr);
     #else
-    void* allocate(size_t size);
+    void* allocate(size_t size, size_t reserve = 0);
+    void* allocate(size_t size, const MigrationPolicy& policy, size_t reserve = 0);
+    // same, the pages prefer numa_node, see SetNumaNode
+    void* allocate(size_t size, const MigrationPolicy& policy, int numa_node, size_t reserve);
     void deallocate(void* v_addr);
     #endif
     
 
     // sending routines
     int Prepare(void* v_addr, size_t size, int destination);
+    // same, the receiver pages the segment in with page_size (or RDMAMemory::AUTO_PAGE_SIZE)
+    int Prepare(void* v_addr, size_t size, int destination, size_t page_size);
+    // same, the segment moves under policy from now on
+    int Prepare(void* v_addr, size_t size, int destination, const MigrationPolicy& policy);
+    /**
+     * Prepare that reports the rest of the migration through the returned handle instead of
+     * PollForAccept and PollForClose, see MigrationHandle. Transfer still has to be called, e.g. from
+     * handle->then(MigrationHandle::State::Accepted, ...). A prepare that cannot go out leaves the
+     * handle Declined. Returns nullptr if no segment starts at v_addr or it is migrating already.
+    */
+    std::shared_ptr<MigrationHandle> PrepareAsync(void* v_addr, size_t size, int destination);
     RDMAMemory* PollForAccept();
+    // blocking PollForAccept, PollForTransfer and PollForClose, the caller sleeps until there is one
+    RDMAMemory* WaitForAccept();
+    RDMAMemory* WaitForTransfer();
+    RDMAMemory* WaitForClose();
     int Transfer(void* v_addr, size_t size, int destination);
+    /**
+     * used is how much of the segment holds data (the pool watermark), the receiver
+     * only pulls [v_addr, v_addr + used) and leaves the rest as fresh zero pages.
+     * Returns -1 and keeps the segment here if a segment with checksums cannot stage its table.
+    */
+    int Transfer(void* v_addr, size_t size, int destination, size_t used);
+
+    /**
+     * Batched Prepare and Transfer for moving many segments to one destination. All the segments are
+     * registered with the NIC in one pass (back to back segments share a registration) and their
+     * descriptors are packed MAX_BATCH_ENTRIES to a message, each side answers a batch with a batch.
+     * Every segment still comes out of PollForAccept(s), PollForTransfer(s) and PollForClose on its own.
+     * Batched transfers carry no page runs, the receiver brings over all of [v_addr, v_addr + used),
+     * used defaults to the whole segment. A pre-copied segment goes out as a single Transfer.
+     * Return the number of segments sent, -1 if an address is not a segment or a send fails.
+    */
+    int PrepareMany(const std::vector<void*>& addresses, int destination);
+    int TransferMany(const std::vector<void*>& addresses, int destination);
+    int TransferMany(const std::vector<void*>& addresses, int destination, const std::vector<size_t>& used);
+    // dequeues up to max accepted segments into memories, returns how many
+    size_t PollForAccepts(std::vector<RDMAMemory*>& memories, size_t max);
 
     //receiving routines
+    // a copied segment that did not arrive intact comes out with state RDMAMemory::State::Invalid
     RDMAMemory* PollForTransfer();
+    // dequeues up to max transferred segments into memories, returns how many
+    size_t PollForTransfers(std::vector<RDMAMemory*>& memories, size_t max);
     int Pull(void* v_addr, size_t size, int source);
     int Push(void* v_addr, size_t size, int source);
 
+    /**
+     * Writes the Dirty pages of the segment at v_addr back to its pair, contiguous dirty pages
+     * go out as one write, and maps them read only again so the next write is seen.
+     * Pages written while the push is running are Dirty again afterwards and go out next time.
+     * Returns the number of pages written back, -1 on error or without DIRTY_TRACKING.
+    */
+    int PushDirty(void* v_addr);
+
+    /**
+     * Pre-copy migration, for segments that must keep taking writes while they move (DIRTY_TRACKING).
+     * Call it once the destination accepted the segment. The first round writes every touched page
+     * to the destination, each later round writes the pages dirtied while the previous one ran.
+     * Returns once the pages still dirty can be written within max_downtime_us at the rate of the
+     * last round, or after max_rounds. The caller then stops writing to the segment and calls
+     * Transfer, which writes the last dirty pages and hands the segment over with nothing to pull,
+     * so the downtime is that last round and the transfer message.
+     * Returns the number of rounds run, -1 on error or without DIRTY_TRACKING.
+    */
+    int PreCopy(void* v_addr, size_t size, int destination, uint64_t max_downtime_us, int max_rounds = 30);
+
     /**
      *  this should give you access to the entire memory 
      *  because the user has to ensure they have brought over all the memory required for closing the segment
      */
     void close(void* v_addr, size_t size, int source);
     
-    void SetPageSize(void* address, size_t page_size);
+    /**
+     * Sets the page size of the segment at address, see Pages::setPageSize for when it may change.
+     * RDMAMemory::AUTO_PAGE_SIZE keeps the current size and tunes it on every transfer.
+     * The size travels with the transfer, the receiver pages the segment in with it.
+     * Returns 0, or -1 if the size is invalid or the pages cannot be re-cut right now.
+    */
+    int SetPageSize(void* address, size_t page_size);
+
+    /**
+     * Sets how the segment at address is brought over by its next transfers, see MigrationPolicy.
+     * Returns 0, or -1 if there is no segment or the policy pages and the pager is not built in.
+    */
+    int SetPolicy(void* address, const MigrationPolicy& policy);
+
+    /**
+     * Makes the pages of the segment at address that are faulted in from now on prefer NUMA node node,
+     * call it before the segment is written. Without it, or with NumaNode::UNKNOWN, segments prefer the
+     * node of the RDMA device with NUMA_PLACEMENT and go wherever the kernel puts them otherwise. The node stays on this
+     * node, a segment that migrates is placed by its destination.
+     * Returns 0, or -1 if there is no segment or the node cannot be bound.
+    */
+    int SetNumaNode(void* address, int node);
 
     #if FAULT_TOLERANT
         void* allocate(void* v_addr, size_t size, int64_t applicaiton_id);
@@ -116,11 +300,20 @@ public:
 
 
     /**
-     * Pull methods for bringing over the entire segment
+     * Pull methods for bringing over the entire segment. They return -1 and stop once a page
+     * cannot be read intact, the segment is Invalid then (see FailPage), and PullAllPages does
+     * not close it.
+    */
+    int PullAllPagesWithoutCloseAsync(RDMAMemory* memory);
+    int PullAllPagesWithoutClose(RDMAMemory* memory);
+    int PullAllPages(RDMAMemory* memory);
+    /**
+     * PullAllPagesWithoutClose with workers threads, the caller being one of them, see PullJob.
+     * Pages are read in runs of consecutive Remote pages, each worker keeps PullJob::WINDOW reads
+     * in flight and a run turns Local with one mprotect. Returns once every page it claimed is Local.
+     * The userfaultfd pager reads through its one staging buffer, there it is the single sweep.
     */
-    void PullAllPagesWithoutCloseAsync(RDMAMemory* memory);
-    void PullAllPagesWithoutClose(RDMAMemory* memory);
-    void PullAllPages(RDMAMemory* memory);
+    int PullAllPagesParallel(RDMAMemory* memory, int workers);
 
     /**
      * Methods for detecting close
@@ -132,8 +325,73 @@ public:
     int PullAsync(void* v_addr, size_t size, int source, void (*callback)(void*), void* data);
 
     void MarkPageLocal(RDMAMemory* memory, void* address, size_t size);
+
+    /**
+     * Brings one page of a migrated segment over from its pair and marks it local, through
+     * mprotect for the sigsegv pager or the staging buffer and UFFDIO_COPY for userfaultfd.
+     * The caller must have moved the page from Remote to InFlight.
+     * batched leaves the mprotect to the segment's run batch, the caller flushes it when done.
+     * Returns -1 through FailPage if the page cannot be read intact.
+    */
+    int FetchPage(RDMAMemory* memory, void* address, size_t size, bool batched = false);
+
+    /**
+     * Gives up on an InFlight page that could not be read intact. The page goes back to Remote,
+     * which wakes the threads waiting on it so that they fault on it themselves and see the error
+     * instead of waiting forever, and the segment is marked Invalid so that sweeps over it stop.
+    */
+    void FailPage(RDMAMemory* memory, void* address, size_t size);
+
+    /**
+     * Reads [address, address + size) of memory from its pair again until it matches the checksums
+     * of the transfer, at most TRANSFER_CHECKSUM_RETRIES times. readable says the bytes can be read
+     * in place, otherwise they are read back through /proc/self/mem (see PageChecksums).
+     * Returns 0, or -1 if they still do not match or a read fails. No-op if the transfer carried no checksums.
+    */
+    int VerifyPulled(RDMAMemory* memory, void* address, size_t size, bool readable = false);
+
+    /**
+     * Called after a demand fault on address has been served, issues the readahead
+     * the segment's prefetcher asks for (no-op unless its policy has stride_prefetch).
+     * Returns -1 if a page it read synchronously failed, see FailPage.
+    */
+    int PrefetchAfterFault(RDMAMemory* memory, void* address);
+
+    /**
+     * Writes the counters and latency histograms as JSON lines: one for the manager (bytes moved,
+     * scheduler state) and one per segment in the index with its SegmentStats.
+     * Latencies are in nanoseconds, histogram buckets are [upper bound, count] pairs.
+     * The path variant appends to the file, "" writes to stderr. Returns 0 or -1.
+    */
+    void DumpStats(FILE* out);
+    int DumpStats(const std::string& path);
+    // on signum (SIGUSR1 unless given) the poller thread calls DumpStats(path)
+    void DumpStatsOnSignal(const std::string& path, int signum = SIGUSR1);
     RDMAMemNode coordinator;
 
+    // admission of background reads against demand faults, shared by all segments
+    PrefetchScheduler scheduler;
+
+    // bytes read from remote segments through Pull, PullAsync and the userfaultfd staging buffer
+    std::atomic<uint64_t> pulled_bytes;
+    // bytes written to remote segments through Push
+    std::atomic<uint64_t> pushed_bytes;
+    // NUMA node of the RDMA device, NumaNode::UNKNOWN without NUMA_PLACEMENT or if sysfs does not say
+    int nic_node;
+
+    // used, the page size, the policy, the layout and, if the policy asks for them, the generations and the table
+    static const size_t TRANSFER_HEADER_SIZE = 2 * sizeof(size_t) + 2 * sizeof(uint32_t) +
+        sizeof(TransferGeneration) + sizeof(ChecksumTable);
+    // runs that fit in a transfer message next to the header and the two counts
+    static const int MAX_TRANSFER_EXTENTS =
+        (rdma_message::MAX_DATA_SIZE - TRANSFER_HEADER_SIZE - 2 * sizeof(uint32_t)) / sizeof(PageExtent);
+
+    /**
+     * Unmaps every segment deallocate kept for a return, see MigrationPolicy::delta.
+     * Kept segments are also dropped oldest first past DELTA_RETAINED_BYTES.
+    */
+    void DropRetained();
+
     std::vector<int64_t> getLocalSegmentsList();
 private:
     int pull(void* v_addr, int source);
@@ -145,14 +403,113 @@ private:
 
     void* accept(void* v_addr, size_t size, int source);
     void* accept(void* v_addr, size_t size, int source, int64_t client_id);
+    // accept for every segment of a prepare batch, registers the accepted ones in one pass
+    // and answers with one accept batch, returns how many were accepted
+    int accept_many(const std::vector<rdma_batch_entry>& entries, int source);
     int transfer(void* v_addr, size_t size, int destination);
-    void on_transfer(void* v_addr, size_t size, int source);
+    // Transfer once the segment is found, without advancing its handle
+    int transfer(RDMAMemory* rmemory, size_t size, int destination, size_t used);
+    // ACCEPT and DECLINE from the destination, through the segment's handle if it has one
+    void on_accept(RDMAMemory* memory);
+    void on_decline(void* addr, size_t size, int source);
+    /**
+     * touched lists the runs of pages (of page_size) that still have to be read from the source,
+     * the rest of the segment is zero or was pushed ahead and becomes Local without a read,
+     * nullptr means all of [0, used). hot lists the pages pushed ahead, they seed the access log.
+     * policy is the sender's, nullptr keeps the one the segment has here.
+     * image is the coded copy to expand instead of reading the segment, nullptr if there is none.
+     * With a generation whose base is the copy this node kept, touched only lists what was written
+     * since the segment left, any other kept copy is dropped and [0, used) is read.
+     * checksums is the table every page read here is checked against, nullptr if there is none.
+     * Returns -1 and leaves a copied segment Invalid if a read fails or a page keeps failing its
+     * checksum, a paged segment reports that from the fault that reads the page.
+    */
+    int on_transfer(void* v_addr, size_t size, int source, size_t used, size_t page_size,
+        const MigrationPolicy* policy, const std::vector<PageExtent>* touched, const std::vector<PageExtent>* hot,
+        const CodedImage* image, const TransferGeneration* generation, const ChecksumTable* checksums);
+    /**
+     * Runs of pages of page_size in [v_addr, v_addr + used) that are resident or swapped out
+     * according to /proc/self/pagemap, the others were never touched and read as zeros.
+     * Returns -1 if pagemap cannot be read.
+    */
+    int TouchedExtents(void* v_addr, size_t used, size_t page_size, std::vector<PageExtent>& extents);
+    // merges the runs separated by the narrowest gaps until at most max_extents are left
+    static void FitExtents(std::vector<PageExtent>& extents, size_t max_extents);
+    static void ExtentsFromBits(const std::vector<bool>& bits, std::vector<PageExtent>& extents);
+    /**
+     * Writes the pages of the segment's access log that are still in pull (pages of unit) to the
+     * destination, takes them out of pull and returns them as runs in hot.
+     * Returns the number of pages written, -1 if a write fails.
+    */
+    int PushHotPages(RDMAMemory* memory, size_t used, size_t unit, std::vector<PageExtent>& pull,
+        std::vector<PageExtent>& hot, int destination);
+    /**
+     * Runs of pages of unit in [0, used) written since the segment arrived here, returns -1 if that is
+     * not known, e.g. the segment was allocated here, arrived as a copy or went through PreCopy.
+    */
+    int DirtyExtents(RDMAMemory* memory, size_t used, size_t unit, std::vector<PageExtent>& extents);
+    /**
+     * MSG_TRANSFER data: used, the page size, the encoded policy of the segment, the sender's
+     * TransferLayout, if the policy has delta its generation and base, if it has checksums its checksum
+     * table, then optionally the runs still to pull and the runs pushed ahead, each as a uint32_t count
+     * followed by the runs, and the coded image, which needs both lists and only fits when they are short
+    */
+    void SendTransfer(int destination, void* v_addr, size_t size, size_t used, size_t page_size,
+        const std::vector<PageExtent>* pull, const std::vector<PageExtent>* hot, const CodedImage* image, uint64_t base);
+    /**
+     * Version of the transfer header. Which optional fields follow it is told by the policy, so every
+     * build reads them the same way. The receiver turns down a transfer of another version instead of
+     * misreading it.
+    */
+    static uint32_t TransferLayout();
+    /**
+     * Codes [0, used) of memory into a staging area registered with destination if a sample of it
+     * codes to at most COMPRESSION_THRESHOLD percent, image is set to the result.
+     * Returns -1 when the segment goes uncoded.
+    */
+    int CompressSegment(RDMAMemory* memory, size_t used, int destination, CodedImage* image);
+    // reads image from source and expands it into [v_addr, v_addr + used), -1 if it did not arrive whole
+    int PullCompressed(void* v_addr, size_t used, int source, const CodedImage& image);
+    /**
+     * Maps a table of the checksums of [0, used) of memory in units of unit, registers it with
+     * destination and keeps it in memory->checksum_table. Returns -1 if it cannot be mapped,
+     * 0 without a table if used is 0.
+    */
+    int ChecksumSegment(RDMAMemory* memory, size_t used, size_t unit, int destination);
+    // reads the checksum table of a transfer from source into segment->checksums, -1 if it did not arrive
+    int PullChecksums(RDMAMemory* segment, size_t used, int source, const ChecksumTable& table);
+    // drops the staging area and the checksum table of memory once pair has closed the segment
+    void ReleaseStaging(RDMAMemory* memory, int pair);
+    // page size to ship with a transfer of memory, tuned from its fault density if it asks for it
+    size_t TransferPageSize(RDMAMemory* memory);
 
     void register_memory(void* v_addr, size_t size, int destination);
     void deregister_memory(void* v_addr, size_t size, int destination);
 
+    // prefers node for the pages of a fresh mapping, NumaNode::UNKNOWN is the RDMA device's node with NUMA_PLACEMENT
+    void PlaceSegment(void* address, size_t size, int node);
+    // keeps the calling thread next to the RDMA device (NUMA_PLACEMENT)
+    void PinThread();
+
+    // unmaps memory and puts it on the free list
+    void release(RDMAMemory* memory);
+    // keeps a segment that left for a return instead of releasing it, false if it cannot be kept
+    bool retain(RDMAMemory* memory);
+    // hands the copy kept at v_addr back mapped read write, returns its generation or 0 if there is none
+    uint64_t take_retained(void* v_addr, size_t size);
+    // never 0, which stands for an unknown generation
+    static uint64_t fresh_generation();
+
     void on_close(void* addr, size_t size, int pair);
 
+    // one worker of PullAllPagesParallel, claims chunks of job until there are none left
+    void pull_worker(RDMAMemory* memory, PullJob* job);
+    // the thread a transfer starts for a segment that prefetches, sweeps it the way its policy asks
+    void prefetch_thread_method(RDMAMemory* segment);
+
+    // posts an async read of one InFlight page, MarkPageLocalCB resolves it and decrements limiter
+    void PullPageAsync(RDMAMemory* memory, void* address, size_t size, std::atomic<int64_t>* limiter);
+
     int UpdateState(void* memory, RDMAMemory::State state);
     int UpdatePair(void* memory, int id); 
     
@@ -167,17 +524,53 @@ private:
             GETPARTITIONS,
             SENTPARTITIONS,
             USER,
+            PREPARE_BATCH,
+            ACCEPT_BATCH,
+            TRANSFER_BATCH,
         } type;
 
         void* addr;
         size_t size;
         void* container_address;
         size_t used;
+        // 0 when the sender did not send one
+        size_t page_size;
+        // the sender's policy, only valid with has_policy
+        bool has_policy;
+        MigrationPolicy policy;
+        // runs of a transfer still to pull and pushed ahead, only valid with has_touched and has_hot
+        bool has_touched;
+        std::vector<PageExtent> touched;
+        bool has_hot;
+        std::vector<PageExtent> hot;
+        // the coded copy of a compressed transfer, only valid with has_image
+        bool has_image;
+        CodedImage image;
+        // only valid with has_generation
+        bool has_generation;
+        TransferGeneration generation;
+        // only valid with has_checksums
+        bool has_checksums;
+        ChecksumTable checksums;
+        // a transfer laid out by a build that differs from this one, nothing past the policy was read
+        bool rejected;
+        // the segments of a batch, addr and size are unused
+        std::vector<rdma_batch_entry> entries;
         char* data;
         RDMAMessage(void* addr, size_t size, Type type, char* data) {
             this->addr = addr;
             this->size = size;
             this->type = type;
+            this->container_address = nullptr;
+            this->used = size;
+            this->page_size = 0;
+            this->has_policy = false;
+            this->has_touched = false;
+            this->has_hot = false;
+            this->has_image = false;
+            this->has_generation = false;
+            this->has_checksums = false;
+            this->rejected = false;
             this->data = data;
         }
 
@@ -187,6 +580,14 @@ private:
             this->type = type;
             this->container_address = container_address;
             this->used = used;
+            this->page_size = 0;
+            this->has_policy = false;
+            this->has_touched = false;
+            this->has_hot = false;
+            this->has_image = false;
+            this->has_generation = false;
+            this->has_checksums = false;
+            this->rejected = false;
         }
 
     };
@@ -211,6 +612,21 @@ private:
     #if FAULT_TOLERANT
     std::unordered_map<void*, RDMAMemory*> local_segments;
     #endif
+    //address ordered view of the segments above, used for fault lookups
+    SegmentIndex segment_index;
+
+    // segments deallocate kept for a return, MigrationPolicy::delta
+    struct RetainedCopy {
+        RDMAMemory* memory;
+        uint64_t generation;
+        // tells a copy apart from an older one at the same address in retained_order
+        uint64_t sequence;
+    };
+    std::mutex retained_mutex;
+    std::map<void*, RetainedCopy> retained;
+    std::deque<std::pair<void*, uint64_t>> retained_order;
+    size_t retained_bytes;
+    uint64_t retained_sequence;
 
     //thread for polling the queue
     std::thread poller_thread;
@@ -219,8 +635,23 @@ private:
     ThreadsafeQueue<RDMAMemory*> incoming_accepts;
     ThreadsafeQueue<RDMAMemory*> incoming_dones;
     volatile bool run;
+    std::string stats_path;
 
     std::atomic<int> num_threads_pulling;                
+
+    #if PAGING && USERFAULTFD
+    /*
+        userfaultfd pager, migrated segments are registered for missing page faults
+        and never registered with the NIC, remote pages land in the staging buffer first
+    */
+    static const size_t STAGING_SIZE = (size_t)2 * 1024 * 1024;
+    int uffd;
+    void* staging;
+    std::mutex staging_mutex;
+    std::thread fault_thread;
+    void start_userfault();
+    void fault_thread_method();
+    #endif
 };
 
 #include "distributed-allocator/RDMAMemory.tpp"
@@ -229,12 +660,21 @@ private:
 static struct sigaction act;
 
 /*
-    this method works with simple single threaded paging for now
-    methods for active paging are written, we would need to add
-    thread synchronization and waiting for threads by setting 
-    and getting the page state
+    the thread that moves a page from Remote to InFlight pulls it, any other thread
+    faulting on the same page sleeps on the page's futex until it turns Local
+    with DIRTY_TRACKING a write to a read only Local page goes through InFlight to Dirty,
+    InFlight keeps PushDirty from re-protecting the page halfway through
 */
 
+// the x86 page fault error code has bit 1 set for writes, elsewhere every fault counts as a read
+static bool fault_is_write(void* ucontext) {
+    #if DIRTY_TRACKING && defined(__x86_64__)
+        return (((ucontext_t*)ucontext)->uc_mcontext.gregs[REG_ERR] & 2) != 0;
+    #else
+        return false;
+    #endif
+}
+
 static void sigsegv_advance(int signum, siginfo_t *info_, void* ptr) { 
     if(manager == nullptr) {
         LogError("Manager is null");
@@ -254,21 +694,58 @@ static void sigsegv_advance(int signum, siginfo_t *info_, void* ptr) {
     addr = memory->pages.getPageAddress(addr);
     size_t page_size = memory->pages.getPageSize(addr); 
 
+    // holds off new background reads until this fault is served
+    int64_t start = manager->scheduler.demandBegin();
+
+    SegmentStats& stats = memory->stats;
+
+    #if DIRTY_TRACKING
+    if(memory->pages.setPageStateCAS(addr, PageState::Local, PageState::InFlight)) {
+        int64_t protect = LatencyHistogram::now();
+        if(mprotect(addr, page_size, PROT_READ | PROT_WRITE)) {
+            perror("couldnt mprotect in sigsegv");
+            exit(errno);
+        }
+        stats.protects.record(LatencyHistogram::now() - protect);
+        memory->pages.setPageState(addr, PageState::Dirty);
+        stats.write_faults.fetch_add(1, std::memory_order_relaxed);
+        stats.faults.record(manager->scheduler.demandEnd(start, false));
+        return;
+    }
+    #endif
+
     if(!memory->pages.setPageStateCAS(addr, PageState::Remote, PageState::InFlight)) {
-        // its either in flight or local, if its in flight, we will generate another sigsegv
-        //if its now local then processing should continue
+        // another thread or a prefetch owns the page, once it is local the access is retried
+        // the page may have landed already and sit in a pending run
+        memory->resolved.flush(memory->pages);
+        memory->pages.waitForPage(addr);
+        stats.retries.fetch_add(1, std::memory_order_relaxed);
+        stats.faults.record(manager->scheduler.demandEnd(start, false));
         return;
     }
     
-    if (manager->Pull(addr, page_size, source) != 0) {
+    int64_t read = LatencyHistogram::now();
+    if (manager->Pull(addr, page_size, source) != 0 || manager->VerifyPulled(memory, addr, page_size) != 0) {
         throw std::logic_error("RaMP Memory Error");
     }
-    memory->pages.setPageState(addr, PageState::Local);    
+    int64_t protect = LatencyHistogram::now();
+    stats.pulls.record(protect - read);
+    memory->demand_faults.fetch_add(1, std::memory_order_relaxed);
+    memory->accesses.record(memory->pages.getPageId(addr));
+
+    // a write fault maps the page writable and dirty at once instead of faulting again
+    bool write = fault_is_write(ptr);
 
-    if(mprotect(addr, page_size, PROT_READ | PROT_WRITE)) {
+    // unprotect before publishing Local, woken threads retry the access straight away
+    if(mprotect(addr, page_size, write ? PROT_READ | PROT_WRITE : LOCAL_PAGE_PROTECTION)) {
         perror("couldnt mprotect in sigsegv");
         exit(errno);
     }
+    stats.protects.record(LatencyHistogram::now() - protect);
+    memory->pages.setPageState(addr, write ? PageState::Dirty : PageState::Local);    
+    stats.faults.record(manager->scheduler.demandEnd(start, true));
+
+    manager->PrefetchAfterFault(memory, addr);
 }
 
 static void initialize() {
@@ -0,0 +1,67 @@
+#ifndef __RUN_CODEC_HPP__
+#define __RUN_CODEC_HPP__
+
+/**
+ * Zero and repeat run coding of a segment, used to shrink copied segments before they cross
+ * a slow link (COMPRESSED_TRANSFER). The data is read as 8 byte words and cut into records,
+ * each a 32 bit header (record kind in the low 2 bits, number of words above them) followed by
+ *   - nothing for a run of zero words,
+ *   - the repeated word for a run of one word,
+ *   - the words themselves for a literal run.
+ * A tail shorter than a word is stored as is after the last record.
+ *
+ * Container pools are mostly empty buckets, zero fill past freed blocks and repeated headers,
+ * which runs catch at memory speed. Anything else codes to slightly more than its raw size,
+ * sample() tells which case a segment is before the whole of it is coded.
+*/
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+#include "utils/miscutils.hpp"
+
+class RunCodec {
+public:
+    // sample() codes this many blocks of SAMPLE_BLOCK bytes spread evenly over the data
+    static const size_t SAMPLE_BLOCKS = 64;
+    static const size_t SAMPLE_BLOCK = 4096;
+
+    // returned by encode when the image does not fit, an empty input codes to 0 bytes
+    static const size_t NO_FIT = SIZE_MAX;
+
+    /**
+     * codes bytes from src into dst, returns the coded size
+     * or NO_FIT if it would not fit in capacity, dst is then partly written
+    */
+    static size_t encode(const void* src, size_t bytes, void* dst, size_t capacity);
+
+    /**
+     * expands coded bytes from src into exactly bytes at dst
+     * returns false if the image is malformed or does not expand to bytes
+    */
+    static bool decode(const void* src, size_t coded, void* dst, size_t bytes);
+
+    // coded size over raw size of a sample of the data, 1 or more means coding does not pay
+    static double sample(const void* src, size_t bytes);
+
+private:
+    enum Kind {
+        ZERO = 0,
+        REPEAT = 1,
+        LITERAL = 2,
+    };
+
+    static const int KIND_BITS = 2;
+    static const uint32_t MAX_WORDS = ((uint32_t)1 << (32 - KIND_BITS)) - 1;
+
+    // a repeat record is 12 bytes, shorter runs go into the surrounding literal
+    static const size_t MIN_REPEAT = 3;
+
+    // appends a record header, false if it does not fit
+    static bool put_header(char* dst, size_t capacity, size_t* out, Kind kind, uint32_t words);
+};
+
+#include "distributed-allocator/RunCodec.tpp"
+
+#endif // __RUN_CODEC_HPP__
@@ -0,0 +1,79 @@
+#ifndef __SEGMENT_INDEX_HPP__
+#define __SEGMENT_INDEX_HPP__
+
+/**
+ * Ordered interval index over the memory segments a RDMAMemoryManager knows about.
+ * It answers "which segment contains this address" in O(log n) and is used by the
+ * sigsegv fault handler, so the read path takes no locks and does not allocate.
+ *
+ * Writers (allocate, accept, deallocate) serialize on a mutex and keep a std::map keyed
+ * by the base address. After every change an immutable sorted array is published through
+ * an atomic pointer, readers binary search whichever array they see. Readers count themselves
+ * in one of two phases, a writer flips the phase after publishing and frees the retired array
+ * once the old phase has drained. Lookups that start after the flip count in the new phase,
+ * so steady fault traffic cannot hold a writer off. Writers never run inside the fault handler
+ * so waiting for readers cannot deadlock.
+*/
+
+#include <atomic>
+#include <cstdint>
+#include <cstdlib>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "utils/miscutils.hpp"
+
+class RDMAMemory;
+
+class SegmentIndex {
+public:
+    SegmentIndex();
+    ~SegmentIndex();
+
+    SegmentIndex(const SegmentIndex&) = delete;
+    SegmentIndex& operator=(const SegmentIndex&) = delete;
+
+    // add the segment [address, address + size), replaces any segment at the same base
+    void insert(void* address, size_t size, RDMAMemory* memory);
+    // remove the segment starting at address, no-op if it is not indexed
+    void remove(void* address);
+
+    /**
+     * lock free lookup, safe to call from a signal handler
+     * returns the segment that contains address or nullptr
+    */
+    RDMAMemory* find(void* address);
+
+    size_t size();
+    // the indexed segments in address order, takes the writer lock so not for the fault handler
+    void list(std::vector<RDMAMemory*>& memories);
+
+private:
+    struct Entry {
+        uintptr_t start;
+        uintptr_t end;
+        RDMAMemory* memory;
+    };
+
+    struct Snapshot {
+        size_t count;
+        Entry entries[1];
+    };
+
+    // rebuilds the sorted array from segments and retires the previous one
+    void publish();
+
+    std::mutex writer_mutex;
+    std::map<uintptr_t, Entry> segments;
+
+    std::atomic<Snapshot*> snapshot;
+    // readers[phase & 1] counts the lookups that entered in that phase
+    std::atomic<uint64_t> phase;
+    std::atomic<int> readers[2];
+};
+
+#include "distributed-allocator/SegmentIndex.tpp"
+
+#endif // __SEGMENT_INDEX_HPP__
@@ -0,0 +1,81 @@
+#ifndef __MAGAZINE_HPP__
+#define __MAGAZINE_HPP__
+
+/**
+ * Per thread allocation caches in front of a MemoryPool, so several threads can allocate from
+ * the same container without taking the pool lock on every call.
+ *
+ * Every thread keeps two magazines per size class and pool: the loaded one it allocates from and
+ * frees into, and a full spare. Only when both are empty (or both full) does the thread go to
+ * the pool, and then it trades a whole magazine with the lock free depot inside the pool, so all
+ * shared state still lives in the migrated memory. Requests above MemoryPool::MAX_SMALL_SIZE
+ * bypass the cache.
+ *
+ * Blocks held by a thread are lost to the pool when it migrates, threads that allocated from a
+ * container should call flush before it is prepared. Prepare flushes the calling thread.
+ * Pools are retired through the cache before their memory goes away (migration or destruction),
+ * a thread that exits only flushes the pools that have not been retired since it cached them.
+*/
+
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <unordered_map>
+
+#include "distributed-allocator/mempool.hpp"
+
+class MagazineCache {
+public:
+    static void* allocate(MemoryPool* pool, size_t bytes) noexcept;
+    static void deallocate(MemoryPool* pool, void* address, size_t bytes) noexcept;
+
+    // hand this thread's cached blocks for pool back to the depot
+    static void flush(MemoryPool* pool) noexcept;
+    // drop this thread's cache for pool without touching the pool, e.g. after it was unmapped
+    static void forget(MemoryPool* pool) noexcept;
+    // every thread drops its cache for pool, call before the pool is migrated or unmapped
+    static void retire(MemoryPool* pool) noexcept;
+
+    // number of pools a thread caches at once, the least recently added one is flushed to make room
+    static const int MAX_POOLS = 8;
+
+private:
+    struct Magazine {
+        uint64_t head;
+        int count;
+    };
+
+    struct Entry {
+        MemoryPool* pool;
+        uint64_t epoch;
+        Magazine loaded[MemoryPool::NUM_SIZE_CLASSES];
+        Magazine spare[MemoryPool::NUM_SIZE_CLASSES];
+    };
+
+    struct Cache {
+        // runs at thread exit
+        ~Cache();
+        Entry entries[MAX_POOLS];
+        int last;
+        int next_victim;
+    };
+
+    // epoch of every pool some thread has cached that was not retired since, exiting threads
+    // look pools up here instead of touching memory that may be gone
+    struct Registry {
+        std::mutex lock;
+        std::unordered_map<MemoryPool*, uint64_t> live;
+    };
+
+    static Cache& thread_cache() noexcept;
+    static Registry& registry() noexcept;
+    static Entry* lookup(MemoryPool* pool) noexcept;
+    static void reset(Entry* entry, MemoryPool* pool) noexcept;
+    static void flush(Entry* entry) noexcept;
+    // pushes a full magazine to the depot, or frees its blocks one by one if it is partial or the depot is full
+    static void give_back(MemoryPool* pool, int size_class, Magazine* magazine) noexcept;
+};
+
+#include "distributed-allocator/magazine.tpp"
+
+#endif // __MAGAZINE_HPP__
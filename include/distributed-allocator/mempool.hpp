@@ -5,9 +5,19 @@
  * This is a Mempool implementation, This is used by c++-container class
  * to allocate and deallocate memory to the container, the mempool is generated by RDMAMemoryManager
  * this class is intended to create a an interface for memory accesses for the data structure that resides in it.
+ *
+ * The pool object lives inside the memory it manages, so all allocator state (free lists included)
+ * migrates with the segment. Free lists are stored as offsets from the pool object instead of pointers.
+ *
+ * allocate and deallocate are thread safe, they serialize on a spin lock in the pool. Multi threaded
+ * containers go through the per thread magazine caches in magazine.hpp, which only come back to
+ * the pool to exchange whole magazines.
 */
 
+#include <algorithm>
+#include <atomic>
 #include <unordered_set>
+#include <vector>
 #include "utils/miscutils.hpp"
 
 class MemoryPool {
@@ -21,21 +31,92 @@ public:
     MemoryPool& operator=(const MemoryPool&) = delete;
 
     // Allocate size_t bytes from this memory pool.
-    // Returns the address you can use.
+    // Returns the address you can use, or nullptr if the pool is exhausted.
     void* allocate(size_t) noexcept;
 
     // Deallocate an address that was allocated from this pool.
-    // Note: currently a no-op. You'll probably want to implement your
-    // favourite memory allocation algorithm at some point.
+    // The size must be the one that was passed to allocate.
     void deallocate(void*, size_t) noexcept;
 
+    // bytes currently handed out to the container, blocks parked in thread caches count as handed out
+    size_t in_use() const noexcept;
+
+    /**
+     * Small blocks are freed onto their size class list and never merge on their own, so the
+     * watermark only comes down when large blocks at the top are freed. trim hands every block
+     * on the size class lists back to the large list, merges neighbours and pulls the watermark
+     * down to the highest block still in use. Blocks in thread caches or the depot stay where
+     * they are. Returns the bytes the watermark came down by.
+    */
+    size_t trim();
+
     friend std::ostream& operator<<(std::ostream&, const MemoryPool&);
 
+    /**
+     * Allocation granularity and size classes.
+     * Requests up to MAX_SMALL_SIZE are rounded up to a size class and served from a
+     * segregated free list for that class, larger requests go to a best fit list
+     * of free blocks sorted by address that coalesces neighbours on free.
+    */
+    static const size_t ALIGNMENT = 16;
+    static const size_t MAX_SMALL_SIZE = 4096;
+    static const int NUM_SIZE_CLASSES = 24;
+
+    static int size_class(size_t bytes) noexcept;
+    static size_t class_size(int size_class) noexcept;
+
+    /**
+     * A pool can span a chain of RDMA segments laid out back to back from addr.
+     * When the watermark reaches the end of the last segment the pool maps another one
+     * right after it through the grow hook, so blocks never move and pointers stay valid.
+     * Growth segments double the pool up to MAX_SEGMENT_SIZE each.
+    */
+    static const int MAX_SEGMENTS = 128;
+    static const size_t MAX_SEGMENT_SIZE = (size_t)1024 * 1024 * 1024;
+
+    typedef void* (*GrowHook)(void* context, void* address, size_t size);
+
+    // record the first segment of the chain and how much address space is reserved for it
+    void set_chain(size_t first_segment, size_t reserved) noexcept;
+    // set the process local hook used to map growth segments, must be redone after a migration
+    void set_grow_hook(GrowHook hook, void* context) noexcept;
+
+    int segment_count() const noexcept;
+    void* segment_address(int segment) const noexcept;
+    size_t segment_size(int segment) const noexcept;
+
+    /**
+     * Central depot for the thread caches. A magazine is a chain of magazine_size blocks of one
+     * size class, linked by offset through the first word of each block. Full magazines sit in
+     * DEPOT_SLOTS slots per size class that threads claim with a compare and swap. Nothing about
+     * the depot is kept inside the blocks, a block that was just popped can be written by its new
+     * owner while another thread is still looking at its slot.
+    */
+    static const int DEPOT_SLOTS = 32;
+    static int magazine_size(int size_class) noexcept;
+    // a full magazine or 0 if the depot is empty
+    uint64_t pop_magazine(int size_class) noexcept;
+    // false if every slot of the size class is taken, the caller keeps the magazine
+    bool push_magazine(int size_class, uint64_t magazine) noexcept;
+    // carves up to magazine_size fresh blocks under the pool lock, count is set to the number carved
+    uint64_t fill_magazine(int size_class, int* count) noexcept;
+
+    /**
+     * Thread caches are only valid for the epoch they were filled in. Retiring the caches
+     * (before a migration) makes every thread drop whatever it still holds for this pool.
+    */
+    uint64_t cache_epoch() const noexcept;
+    void retire_caches() noexcept;
+
+    // offsets are relative to the pool object, which sits in front of every block,
+    // so 0 can stand for "empty"
+    uint64_t to_offset(void* address) const noexcept;
+    void* from_offset(uint64_t offset) const noexcept;
 
 // protected:
     /**
      * MemoryPool metadata and state.
-     * The reason this may be different from the actual addr and size of the 
+     * The reason this may be different from the actual addr and size of the
      * underlying memory is because we may choose to embed information in the memory address themselves
      * this will not be required if we are using zookeeper
     */
@@ -43,15 +124,56 @@ public:
     size_t pool_size;
 
     /**
-     * The high watermark for allocated memory, this class implements a
-     * simple allocation algorithm by simply pushing the boundary forward, on an
-     * RDMA pull, we would only need to pull as much as a unused past
+     * The high watermark for allocated memory, fresh blocks are carved by
+     * pushing the boundary forward and a large free block that touches the
+     * boundary (or trim) pulls it back. On an RDMA pull, we would only need to pull as much as a unused past
     */
     void* unused_past;
 
     //the actualy add and size of the rdma memory region
     void* addr;
     size_t size;
+
+private:
+    // header written into every free block on the large list
+    struct FreeBlock {
+        size_t size;
+        uint64_t next;
+    };
+
+    // spin lock over everything but the magazine depot
+    class Guard {
+    public:
+        Guard(std::atomic<int>& lock) noexcept;
+        ~Guard() noexcept;
+    private:
+        std::atomic<int>& lock;
+    };
+
+    // unique enough across processes that a stale cache never matches a recycled address
+    static uint64_t fresh_epoch() noexcept;
+
+    void* allocate_unlocked(size_t bytes) noexcept;
+    void* bump(size_t bytes) noexcept;
+    bool grow(size_t bytes) noexcept;
+    void* allocate_large(size_t bytes) noexcept;
+    void deallocate_large(void* address, size_t bytes) noexcept;
+
+    uint64_t free_lists[NUM_SIZE_CLASSES];
+    uint64_t large_free;
+    size_t used;
+
+    // segment chain, addr + size is where the next segment goes
+    int num_segments;
+    size_t segment_sizes[MAX_SEGMENTS];
+    size_t reserved;
+
+    GrowHook grow_hook;
+    void* grow_context;
+
+    std::atomic<int> pool_lock;
+    std::atomic<uint64_t> depot[NUM_SIZE_CLASSES][DEPOT_SLOTS];
+    std::atomic<uint64_t> epoch;
 };
 
 #include "distributed-allocator/mempool.tpp"
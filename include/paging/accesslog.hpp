@@ -0,0 +1,40 @@
+#ifndef __ACCESSLOG_HPP
+#define __ACCESSLOG_HPP
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <vector>
+
+/**
+ * Recent page accesses of a segment, one per RDMAMemory.
+ * The pager records the page of every demand fault, and pages that arrived hot are seeded
+ * into it. The last CAPACITY entries are kept in a ring, so the log is a sample of the pages
+ * the node used most recently. A hybrid transfer pushes those pages ahead of the segment.
+ *
+ * record is a single fetch_add and store, so it is safe to call from the sigsegv handler.
+*/
+
+class PageAccessLog {
+public:
+    PageAccessLog();
+
+    PageAccessLog(const PageAccessLog&) = delete;
+    PageAccessLog& operator=(const PageAccessLog&) = delete;
+
+    // appends page_id, once the ring is full the oldest entry goes
+    void record(int page_id);
+    // distinct pages in the log, sorted
+    void snapshot(std::vector<int>& pages);
+    void clear();
+
+    static const int CAPACITY = 512;
+
+private:
+    std::atomic<uint64_t> next;
+    std::atomic<int> entries[CAPACITY];
+};
+
+#include "paging/accesslog.tpp"
+
+#endif //__ACCESSLOG_HPP
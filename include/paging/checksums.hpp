@@ -0,0 +1,79 @@
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+#include <vector>
+
+#include "utils/miscutils.hpp"
+#include "utils/crc32c.hpp"
+
+#ifndef __CHECKSUMS_HPP
+#define __CHECKSUMS_HPP
+
+/**
+ * CRC32C of every page of a segment as the source had it at Transfer (MigrationPolicy::checksums).
+ * The source computes the table over [0, used) and the destination reads it before the
+ * first page is pulled, each page is checked against its entry once its data has landed.
+ * The table is cut in units of the page size the transfer was sent with, a page of the
+ * destination has to cover whole units.
+ *
+ * Pages are checked while they are still protected, so the bytes are read back through
+ * /proc/self/mem, which ignores the protection of the mapping, instead of touching the page.
+*/
+
+class PageChecksums {
+public:
+    PageChecksums();
+    ~PageChecksums();
+
+    PageChecksums(const PageChecksums&) = delete;
+    PageChecksums& operator=(const PageChecksums&) = delete;
+
+    // bytes read back from /proc/self/mem at a time
+    static const size_t SCRATCH_BYTES = 64 * 1024;
+
+    // entries of a table over used bytes in units of unit, the last unit may be short
+    static size_t entries(size_t used, size_t unit);
+    // fills table with the entries(used, unit) checksums of [base, base + used)
+    static void compute(const void* base, size_t used, size_t unit, uint32_t* table);
+
+    // checks the segment at base against table from now on, the table is taken over
+    void load(void* base, size_t used, size_t unit, std::vector<uint32_t>& table);
+    // stops checking
+    void clear();
+    bool active() const;
+    size_t getUnit() const;
+
+    /**
+     * true if the units in [address, address + bytes) match the table, address has to start a unit
+     * and nothing past used is checked. data is where those bytes can be read instead,
+     * nullptr reads them through /proc/self/mem so that protected pages can be checked.
+     * Safe to call from the sigsegv handler and async completions.
+    */
+    bool verify(void* address, size_t bytes, const void* data = nullptr);
+
+    uint64_t getMismatches() const;
+    // the most times a unit in [address, address + bytes) has failed verify since the table was loaded
+    int getFailures(void* address, size_t bytes) const;
+
+private:
+    // crc of bytes at address, read through /proc/self/mem, false if they cannot be read
+    bool read_crc(uintptr_t address, size_t bytes, uint32_t* crc);
+
+    uintptr_t base;
+    size_t used;
+    // 0 while there is no table
+    size_t unit;
+    std::vector<uint32_t> table;
+    // per unit, saturates at UINT8_MAX
+    std::vector<std::atomic<uint8_t>> failures;
+    int memory_fd;
+    std::atomic<uint64_t> mismatches;
+};
+
+#include "paging/checksums.tpp"
+
+#endif //__CHECKSUMS_HPP
@@ -0,0 +1,87 @@
+#ifndef __FAULTSTATS_HPP
+#define __FAULTSTATS_HPP
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <stdio.h>
+
+/**
+ * Latency histogram in nanoseconds, HDR style: values below SUB_BUCKETS get a bucket each,
+ * above that every power of two is split into SUB_BUCKETS linear buckets, so a bucket is
+ * at most 1/SUB_BUCKETS of its value wide. Values past 2^MAX_BITS land in the last bucket.
+ *
+ * record is a few relaxed atomic adds, so it is safe to call from the sigsegv handler.
+ * Readers see a consistent enough picture for percentiles, not an exact snapshot.
+*/
+
+class LatencyHistogram {
+public:
+    LatencyHistogram();
+
+    LatencyHistogram(const LatencyHistogram&) = delete;
+    LatencyHistogram& operator=(const LatencyHistogram&) = delete;
+
+    void record(int64_t ns);
+    void reset();
+
+    uint64_t count() const;
+    int64_t max() const;
+    double mean() const;
+    // upper bound of the bucket that holds the q quantile, 0 <= q <= 1, 0 when empty
+    int64_t percentile(double q) const;
+
+    // {"count":..,"mean":..,"p50":..,"p90":..,"p99":..,"p999":..,"max":..,"buckets":[[upper,count],..]}
+    // only buckets that were hit are listed
+    void write(FILE* out) const;
+
+    static int bucket(int64_t ns);
+    static int64_t bucketUpper(int bucket);
+    static int64_t now();
+
+    static const int SUB_BITS = 3;
+    static const int SUB_BUCKETS = 1 << SUB_BITS;
+    static const int MAX_BITS = 36;
+    static const int NUM_BUCKETS = (MAX_BITS - SUB_BITS + 1) * SUB_BUCKETS;
+
+private:
+    std::atomic<uint32_t> buckets[NUM_BUCKETS];
+    std::atomic<uint64_t> total;
+    std::atomic<uint64_t> sum;
+    std::atomic<int64_t> max_ns;
+};
+
+/**
+ * What the pager saw for one segment, one per RDMAMemory, kept for as long as the node has the
+ * segment object. A fault is timed from the handler entry until the access can be retried and
+ * splits into the read of the page, the wait for another thread's read and the mprotect.
+*/
+
+class SegmentStats {
+public:
+    SegmentStats();
+
+    SegmentStats(const SegmentStats&) = delete;
+    SegmentStats& operator=(const SegmentStats&) = delete;
+
+    void reset();
+    // the members below as JSON fields, without the enclosing braces
+    void write(FILE* out) const;
+
+    LatencyHistogram faults;
+    // RDMA reads of demand faults and of synchronous background fetches
+    LatencyHistogram pulls;
+    // RDMA writes of dirty and hot pages
+    LatencyHistogram pushes;
+    // mprotect calls on the fault path
+    LatencyHistogram protects;
+
+    // faults that found the page already being read and waited for it
+    std::atomic<uint64_t> retries;
+    // writes to local read only pages under DIRTY_TRACKING
+    std::atomic<uint64_t> write_faults;
+};
+
+#include "paging/faultstats.tpp"
+
+#endif //__FAULTSTATS_HPP
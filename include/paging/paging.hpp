@@ -8,6 +8,10 @@
 #include <limits.h>    /* for PAGESIZE */
 #include <cstring>
 #include <atomic>
+#include <climits>
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <unistd.h>
 
 #include "distributed-allocator/RDMAMemory.hpp"
 
@@ -16,29 +20,33 @@ using namespace std;
 #ifndef __PAGING_HPP
 #define __PAGING_HPP
 
+// 2 bits per page, Remote has to stay 0 so that a fresh bitmap is all remote
+// Dirty is Local and written since the last write back (DIRTY_TRACKING)
 enum class PageState{
-    Remote,
-    InFlight,
-    Local
+    Remote = 0,
+    InFlight = 1,
+    Local = 2,
+    Dirty = 3
 };
 
-class Page{
-public:
-    Page() : ps(PageState::Remote) {};
-    ~Page(){};
-    Page(const Page &p) {
-        ps.store(p.ps);
-    };
-    std::atomic<PageState> ps;
-};
+// protection of a page once it is Local, read only while writes are being tracked
+#define LOCAL_PAGE_PROTECTION (DIRTY_TRACKING ? PROT_READ : (PROT_READ | PROT_WRITE))
 
+/**
+ * Page states are packed 16 to a 32 bit word, a 64 GB segment of 4 KB pages needs 4 MB of state.
+ * Every update is a CAS on the whole word, and the word is also the futex waiters sleep on.
+*/
 class Pages{
     public:
         Pages(uintptr_t start_address, size_t memory_size, size_t page_size);
         ~Pages();
 
+        Pages(const Pages&) = delete;
+        Pages& operator=(const Pages&) = delete;
+
         void* getPageAddress(int page_id);
         void* getPageAddress(void* address);
+        int getPageId(void* address);
         
         size_t getPageSize(int page_id);
         size_t getPageSize(void* address);
@@ -47,17 +55,67 @@ class Pages{
         void setPageState(void* address, PageState state);
         bool setPageStateCAS(void* address, PageState old_state, PageState new_state);
 
+        /**
+         * Sleeps while the page is InFlight, on a futex keyed by the page's state word.
+         * Every transition out of InFlight wakes the sleepers of that page.
+         * Only uses the futex syscall, so it may be called from the sigsegv handler.
+        */
+        void waitForPage(void* address);
+
         PageState getPageState(int page_id);
         PageState getPageState(void* address);
 
-        void setPageSize(size_t page_size);
+        /**
+         * first page at or after start that is Remote, num_pages if there is none
+         * scans a word at a time, runs of pages that are local or in flight cost one load per 16 pages
+        */
+        int find_next_remote(int start);
+        // same scan for any state
+        int find_next(int start, PageState state);
+
+        /**
+         * Re-cuts the segment into pages of page_size, a power of two from MIN_PAGE_SIZE to MAX_PAGE_SIZE.
+         * A new page is Local if every old page it covers is Local and Remote if all of them are Remote.
+         * Fails and changes nothing for a bad size, if a page is InFlight or Dirty, or if a new page would
+         * cover both Local and Remote bytes. Nothing may fault on or pull the segment meanwhile,
+         * call it before the segment is shared or right after it arrives.
+        */
+        bool setPageSize(size_t page_size);
         size_t getPageSize();
 
-        vector<Page> pages;
+        static bool validPageSize(size_t page_size);
+
+        static const size_t MIN_PAGE_SIZE = 4096;
+        static const size_t MAX_PAGE_SIZE = 2 * 1024 * 1024;
+
+        // bytes of page state, for experiments
+        size_t stateBytes();
+
+        // mappings (VMAs) the segment is split into right now, read from /proc/self/maps
+        int mappingCount();
+
+        static const int PAGES_PER_WORD = 16;
+
+        // pages that are Local or Dirty
         std::atomic<int> local_pages;
         int num_pages;
 
     private:
+        // fresh word array for num_pages, all Remote with the padding slots Local
+        static std::atomic<uint32_t>* allocateStates(int num_pages, int num_words);
+
+        void wakePage(int page_id);
+        void countTransition(PageState old_state, PageState new_state);
+
+        static uint32_t fieldMask(int page_id);
+        static int fieldShift(int page_id);
+
+        std::atomic<uint32_t>* states;
+        int num_words;
+
+        // threads sleeping in waitForPage, saves the wake syscall when nobody waits
+        std::atomic<int> waiters;
+
         uintptr_t start_address;
         uintptr_t end_address;
         size_t memory_size;
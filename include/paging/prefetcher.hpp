@@ -0,0 +1,51 @@
+#ifndef __PREFETCHER_HPP
+#define __PREFETCHER_HPP
+
+#include <atomic>
+#include <cstdint>
+
+/**
+ * Readahead for demand paging, one per RDMAMemory.
+ * Watches the page ids of demand faults for a constant stride (1 for sequential scans).
+ * Once two faults in a row share a stride it asks for the next `window` pages along it.
+ * A fault that lands just past what was prefetched counts as a hit and doubles the window up to
+ * MAX_WINDOW, a fault off the pattern halves it and drops the pattern once it reaches 0.
+ *
+ * The state is guarded by a try lock, a fault that finds it busy simply gets no readahead,
+ * so it is safe to call from the sigsegv handler.
+*/
+
+class FaultPrefetcher {
+public:
+    FaultPrefetcher();
+
+    FaultPrefetcher(const FaultPrefetcher&) = delete;
+    FaultPrefetcher& operator=(const FaultPrefetcher&) = delete;
+
+    /**
+     * Records a demand fault on page_id and returns how many pages to read ahead,
+     * they are first, first + stride, ... and already clipped to [0, num_pages)
+    */
+    int onFault(int page_id, int num_pages, int* first, int* stride);
+
+    static const int MIN_WINDOW = 2;
+    static const int MAX_WINDOW = 32;
+
+    // counters for experiments
+    std::atomic<uint64_t> faults;
+    std::atomic<uint64_t> issued;
+    std::atomic<uint64_t> hits;
+
+private:
+    std::atomic<bool> busy;
+    int last_page;
+    int candidate;
+    int stride;
+    int window;
+    // first page past the last readahead
+    int next_page;
+};
+
+#include "paging/prefetcher.tpp"
+
+#endif //__PREFETCHER_HPP
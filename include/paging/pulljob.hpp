@@ -0,0 +1,75 @@
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <sys/mman.h>
+
+#include "utils/miscutils.hpp"
+#include "paging/paging.hpp"
+#include "paging/checksums.hpp"
+#include "paging/faultstats.hpp"
+
+#ifndef __PULLJOB_HPP
+#define __PULLJOB_HPP
+
+/**
+ * Shared state of a parallel pull of one segment (RDMAMemoryManager::PullAllPagesParallel).
+ * The pages are cut into chunks of CHUNK_BYTES that the workers claim in order, so a worker that
+ * finds a chunk already brought in by faults just takes the next one. Inside its chunk a worker
+ * claims runs of consecutive Remote pages of up to MAX_READ bytes and reads each run with one
+ * async read, keeping at most WINDOW of its own reads on the wire. A completed read unprotects its
+ * run with a single mprotect before the pages turn Local. With MigrationPolicy::checksums a page of the run
+ * that does not match its checksum goes back to Remote instead, the rest are unprotected around it.
+ *
+ * All workers post to the connection's queue pair, reads are admitted by the manager's
+ * PrefetchScheduler like every other background read, so demand faults still go first.
+*/
+
+class PullJob {
+public:
+    PullJob(Pages& pages, SegmentStats& stats, PageChecksums& checksums);
+
+    PullJob(const PullJob&) = delete;
+    PullJob& operator=(const PullJob&) = delete;
+
+    static const size_t CHUNK_BYTES = (size_t)2 * 1024 * 1024;
+    static const size_t MAX_READ = (size_t)512 * 1024;
+    static const int WINDOW = 4;
+
+    // claims the next chunk of pages [first, last), false once every chunk is taken
+    bool next(int* first, int* last);
+    // moves the Remote pages from first on to InFlight, up to MAX_READ bytes and not past last,
+    // returns how many, 0 if the page at first is not Remote
+    int claim(int first, int last);
+    // bytes from the start of page first to the end of page first + count - 1
+    size_t runBytes(int first, int count);
+
+    // one read of a run of pages, the data of its completion
+    struct Read {
+        PullJob* job;
+        int first;
+        int count;
+        int64_t start;
+        // reads the posting worker has on the wire
+        std::atomic<int>* window;
+        // the scheduler slot the read holds
+        std::atomic<int64_t>* slots;
+    };
+
+    // completion callback of a Read, resolves its run and frees it
+    static void complete(void* read);
+    // pages of the run of read that match their checksums turn Local, the others Remote
+    static void resolve_checked(Read* read);
+
+    Pages& pages;
+    SegmentStats& stats;
+    PageChecksums& checksums;
+
+private:
+    std::atomic<int> next_chunk;
+    int chunk_pages;
+    int num_chunks;
+};
+
+#include "paging/pulljob.tpp"
+
+#endif //__PULLJOB_HPP
@@ -0,0 +1,60 @@
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <sys/mman.h>
+
+#include "utils/miscutils.hpp"
+#include "paging/paging.hpp"
+
+#ifndef __RUNBATCH_HPP
+#define __RUNBATCH_HPP
+
+/**
+ * Coalesces the pages a background pull has brought in into runs, one per RDMAMemory.
+ * A page whose data has landed stays InFlight and protected until its run is resolved with a
+ * single mprotect, after which every page of the run turns Local and its waiters wake up.
+ * A run is resolved when the next page is not adjacent, when it reaches MAX_RUN pages, when the
+ * last async read of the segment completes, or when a demand fault has to wait on a page.
+ *
+ * Per page mprotect splits the segment's VMA and takes mmap_sem for writing every time,
+ * with BATCHED_RESOLUTION off a run is a single page, as before.
+*/
+
+class PageRunBatch {
+public:
+    PageRunBatch();
+
+    PageRunBatch(const PageRunBatch&) = delete;
+    PageRunBatch& operator=(const PageRunBatch&) = delete;
+
+    static const int MAX_RUN = BATCHED_RESOLUTION ? 64 : 1;
+
+    // an async read that will end in complete() has been posted
+    void expect();
+    // data for the page at address has landed, from an async completion
+    void complete(Pages& pages, void* address);
+    // data for the page at address has landed, the caller flushes when it is done
+    void add(Pages& pages, void* address);
+    // the async read of the page at address brought the wrong data, it goes back to Remote
+    // instead of into a run and the next fault or sweep reads it again
+    void abandon(Pages& pages, void* address);
+    // resolves the pending run, if any
+    void flush(Pages& pages);
+
+    uint64_t getProtectCalls() const;
+
+private:
+    void add_locked(Pages& pages, int page_id);
+    void flush_locked(Pages& pages);
+
+    std::mutex lock;
+    // pending run [start, end)
+    int start;
+    int end;
+    std::atomic<int> outstanding;
+    std::atomic<uint64_t> protect_calls;
+};
+
+#include "paging/runbatch.tpp"
+
+#endif //__RUNBATCH_HPP
@@ -0,0 +1,72 @@
+#ifndef __SCHEDULER_HPP
+#define __SCHEDULER_HPP
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <thread>
+
+#include "utils/miscutils.hpp"
+
+/**
+ * Two class admission for the reads a manager posts to its queue pairs.
+ * Demand faults post their read straight away. Background sweeps (the async prefetchers and
+ * the stride readahead) take a slot first, and no slot is handed out while a demand fault is
+ * outstanding, so a fault only queues behind the `depth` background reads already on the wire.
+ *
+ * depth adapts to the demand latency AIMD style: it grows by one after `depth` admissions without
+ * a slow fault, up to max_async_pending, and halves when a fault that read its own page took more
+ * than SLOWDOWN times the fastest such fault seen.
+ *
+ * With PRIORITY_PREFETCHING off the slots are a plain max_async_pending limit, as before.
+ * The demand side is lock free and safe in the sigsegv handler.
+*/
+
+class PrefetchScheduler {
+public:
+    PrefetchScheduler();
+
+    PrefetchScheduler(const PrefetchScheduler&) = delete;
+    PrefetchScheduler& operator=(const PrefetchScheduler&) = delete;
+
+    // brackets a demand fault, pulled is set when the fault read the page itself
+    // demandEnd returns the latency of the fault in nanoseconds
+    int64_t demandBegin();
+    int64_t demandEnd(int64_t start, bool pulled);
+
+    /**
+     * background slots, in_flight is decremented when the read completes
+     * (MarkPageLocalCB does it) or by release if the slot went unused
+    */
+    void acquire();
+    bool tryAcquire();
+    void release();
+
+    // for synchronous sweeps that hold no slot
+    void yieldToDemand();
+
+    int getDepth() const;
+    // fastest demand pull seen, nanoseconds
+    int64_t getFloor() const;
+    uint64_t getSlowFaults() const;
+
+    static const int MIN_DEPTH = 1;
+    static const int SLOWDOWN = 2;
+
+    std::atomic<int64_t> in_flight;
+
+private:
+    static int64_t now();
+    void admitted();
+
+    std::atomic<int> demand;
+    std::atomic<int> depth;
+    // admissions since depth last changed
+    std::atomic<int> credit;
+    std::atomic<int64_t> floor_ns;
+    std::atomic<uint64_t> slow_faults;
+};
+
+#include "paging/scheduler.tpp"
+
+#endif //__SCHEDULER_HPP
@@ -9,7 +9,9 @@
 #include <thread>
 #include <unordered_set>
 #include <utility>
+#include <vector>
 #include "utils/miscutils.hpp"
+#include "utils/numa.hpp"
 
 #include "rdma-network/util.hpp"
 
@@ -56,6 +58,15 @@ public:
     void register_memory(
         uintptr_t conn_id, void* addr, size_t len);
 
+    /*
+        registers many regions in one pass under one lock and without sending meminfo,
+        regions that sit back to back share one registration, so a batch of small
+        segments pins and costs one ibv_reg_mr per contiguous run instead of one per segment.
+        The rkeys travel in the batch messages (see send_batch).
+    */
+    void register_memory_many(
+        uintptr_t conn_id, const std::vector<std::pair<void*, size_t>>& regions, bool remote_access);
+
 
     void deregister_memory(uintptr_t conn_id, void* addr);
     // Sends arbitrary data to the remote side.
@@ -89,8 +100,22 @@ public:
     void send_decline(uintptr_t conn_id, void* addr, size_t len);
 
     void send_transfer(uintptr_t conn_id, void* addr, size_t len);
+    // used is the number of bytes from addr that hold data, it travels in the data field
+    void send_transfer(uintptr_t conn_id, void* addr, size_t len, size_t used);
+    // page_size follows used in the data field, 0 leaves the receiver's page size alone
+    void send_transfer(uintptr_t conn_id, void* addr, size_t len, size_t used, size_t page_size);
+    // data_size bytes of data already packed by the caller, up to MAX_DATA_SIZE
+    void send_transfer(uintptr_t conn_id, void* addr, size_t len, const char* data, size_t data_size);
     
     void send_close(uintptr_t conn_id, void* addr, size_t len);
+
+    // Batched send_prepare, send_accept and send_transfer, count segment descriptors packed
+    // MAX_BATCH_ENTRIES to a message. Prepares and transfers fill in the rkey of each region.
+    // Return 0, or -1 if a send could not be posted.
+    int send_prepare_batch(uintptr_t conn_id, const struct rdma_batch_entry* entries, size_t count);
+    int send_accept_batch(uintptr_t conn_id, const struct rdma_batch_entry* entries, size_t count);
+    int send_transfer_batch(uintptr_t conn_id, const struct rdma_batch_entry* entries, size_t count);
+
     // Receive a send() on a connection, as identified by the connection ID.
     // Returns the memory address and the size of the message.
     // The caller is responsible for deallocating this memory when they
@@ -105,7 +130,9 @@ public:
     int rdma_read(uintptr_t conn_id, void* local_addr, void* remote_addr, size_t len);
     void rdma_read_async(uintptr_t conn_id, void* local_addr, void* remote_addr, size_t len,void (*callback)(void*), void* data);
 
-    void rdma_write(uintptr_t conn_id, void* local_addr, void* remote_addr, size_t len);
+    // Writes `len` bytes from local_addr here to remote_addr on the remote server,
+    // same preconditions as rdma_read. Returns -1 if either side is not registered.
+    int rdma_write(uintptr_t conn_id, void* local_addr, void* remote_addr, size_t len);
 
     // Call this when you are finished with this connection.
     // Close the connection indicated by the connection ID.
@@ -123,6 +150,10 @@ public:
 
     //to check if there is a pending message on the recv queue
     bool checkForMessage(uintptr_t conn_id);
+
+    // The NUMA node of the RDMA device this server uses, read from sysfs.
+    // -1 (NumaNode::UNKNOWN) before the first connection or if sysfs does not say.
+    int device_numa_node();
 // Protected internal fields.
 protected:
     // An event channel, which should be bound to get events from ALL sockets
@@ -243,6 +274,11 @@ protected:
     // after this method has returned).
     struct ibv_mr* register_memory_with_conn(struct rdma_connection*, void* addr, int size, int access_flags);
 
+    // The lkey of a registration that covers [addr, addr + len), and the rkey of a remote one.
+    // Return false if no registration covers the range.
+    bool find_lkey(struct rdma_connection*, void* addr, size_t len, uint32_t* lkey);
+    bool find_rkey(struct rdma_connection*, void* addr, size_t len, uint32_t* rkey);
+
     // Communicate information about a local memory registration
     // to enable the other side to perform operatons on it.
     //
@@ -262,6 +298,11 @@ protected:
     // (The message will be copied out before being sent.)
     int post_rdma_send(struct rdma_connection*, struct rdma_message*, sem_t*);
 
+    // Posts the entries as messages of msg's type, waiting for each one to leave the send
+    // buffer before packing the next. with_rkeys fills the rkey of each region from registrations.
+    int post_rdma_batch(struct rdma_connection*, struct rdma_message* msg,
+        const struct rdma_batch_entry* entries, size_t count, bool with_rkeys);
+
     // Post an RDMA read.
     // sem_t, if not null, will be signalled when the send is done.
     void post_rdma_read(
@@ -344,6 +385,9 @@ struct rdma_connection {
     // All memory regions registered with this RDMA connection.
     // A map of address to registration information.
     std::map<void*, struct ibv_mr*> registrations;
+    // How many entries of registrations share a registration made by register_memory_many,
+    // it is only deregistered with the last of them. Registrations made one at a time are not counted.
+    std::map<struct ibv_mr*, int> shared_registrations;
 
     // The addresses of the buffers to use for RDMA sends and receives
     // (not RDMA reads and writes).
@@ -432,6 +476,11 @@ struct rdma_message {
             //message is sent once the source server reliquishes its command over the partition
             //a reply is not required as we are using RDMA_RC connections
         MSG_DONE_TRANSFER,
+        MSG_PREPARE_BATCH,
+        MSG_ACCEPT_BATCH,
+        MSG_TRANSFER_BATCH,
+            //the same as MSG_PREPARE, MSG_ACCEPT and MSG_TRANSFER for many segments at once,
+            //data holds data_size / sizeof(rdma_batch_entry) descriptors, region_info is unused
     } message_type;
 
     // See MessageType for details.
@@ -440,6 +489,19 @@ struct rdma_message {
     size_t data_size;
 };
 
+// One segment of a batched prepare, accept or transfer, packed back to back in rdma_message::data.
+// used, page_size and policy are only read from transfers (see MSG_TRANSFER),
+// application_id only from prepares of fault tolerant managers.
+struct rdma_batch_entry {
+    struct remote_region region;
+    uint32_t policy;
+    size_t used;
+    size_t page_size;
+    int64_t application_id;
+};
+
+static const size_t MAX_BATCH_ENTRIES = rdma_message::MAX_DATA_SIZE / sizeof(struct rdma_batch_entry);
+
 std::string toRDMAErrorString(int event);
 
 #endif // __RDMA_SERVER_PROTOTYPE_HPP__
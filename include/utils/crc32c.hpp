@@ -0,0 +1,150 @@
+#ifndef __CRC32C_HPP__
+#define __CRC32C_HPP__
+
+/**
+ * CRC32C (Castagnoli polynomial, the one the SSE4.2 crc32 instruction computes), used to check
+ * that pages pulled from a source are the ones it sent (MigrationPolicy::checksums).
+ * On x86-64 CPUs with SSE4.2 it runs 8 bytes per crc32 instruction, the build does not need
+ * -msse4.2, the instruction path is compiled for it on its own and picked at run time.
+ * Elsewhere a byte at a time table is used.
+ *
+ * The instruction has a latency of 3 cycles and issues every cycle, a single buffer leaves it
+ * two thirds idle, compute3 runs three independent buffers side by side to keep it busy.
+*/
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+#if defined(__x86_64__)
+#include <nmmintrin.h>
+#endif
+
+class CRC32C {
+public:
+    // crc of bytes at data following on from crc, extend(extend(0, a), b) is the crc of a then b
+    static uint32_t extend(uint32_t crc, const void* data, size_t bytes);
+    static uint32_t compute(const void* data, size_t bytes);
+    // crcs of the three buffers of bytes each at data[0..2] into out[0..2]
+    static void compute3(const void* const data[3], size_t bytes, uint32_t out[3]);
+
+    // true if the crc32 instruction is used
+    static bool hardware();
+
+private:
+    static const uint32_t POLYNOMIAL = 0x82f63b78;
+
+    struct Table {
+        Table();
+        uint32_t entries[256];
+    };
+
+    static uint32_t extend_table(uint32_t crc, const unsigned char* data, size_t bytes);
+    #if defined(__x86_64__)
+    __attribute__((target("sse4.2")))
+    static uint32_t extend_sse42(uint32_t crc, const unsigned char* data, size_t bytes);
+    __attribute__((target("sse4.2")))
+    static void compute3_sse42(const void* const data[3], size_t bytes, uint32_t out[3]);
+    #endif
+};
+
+inline
+CRC32C::Table::Table() {
+    for (uint32_t i = 0; i < 256; i++) {
+        uint32_t crc = i;
+        for (int bit = 0; bit < 8; bit++) {
+            crc = (crc & 1) ? (crc >> 1) ^ POLYNOMIAL : crc >> 1;
+        }
+        entries[i] = crc;
+    }
+}
+
+inline
+bool CRC32C::hardware() {
+    #if defined(__x86_64__)
+        static const bool sse42 = (__builtin_cpu_init(), __builtin_cpu_supports("sse4.2"));
+        return sse42;
+    #else
+        return false;
+    #endif
+}
+
+// crc is kept inverted while bytes go in, as the instruction expects
+inline
+uint32_t CRC32C::extend_table(uint32_t crc, const unsigned char* data, size_t bytes) {
+    static const Table table;
+    for (size_t i = 0; i < bytes; i++) {
+        crc = table.entries[(crc ^ data[i]) & 0xff] ^ (crc >> 8);
+    }
+    return crc;
+}
+
+#if defined(__x86_64__)
+inline
+uint32_t CRC32C::extend_sse42(uint32_t crc, const unsigned char* data, size_t bytes) {
+    uint64_t crc64 = crc;
+    for (; bytes >= sizeof(uint64_t); bytes -= sizeof(uint64_t), data += sizeof(uint64_t)) {
+        uint64_t word;
+        memcpy(&word, data, sizeof(word));
+        crc64 = _mm_crc32_u64(crc64, word);
+    }
+    crc = (uint32_t)crc64;
+    for (; bytes > 0; bytes--, data++) {
+        crc = _mm_crc32_u8(crc, *data);
+    }
+    return crc;
+}
+
+inline
+void CRC32C::compute3_sse42(const void* const data[3], size_t bytes, uint32_t out[3]) {
+    const unsigned char* a = (const unsigned char*)data[0];
+    const unsigned char* b = (const unsigned char*)data[1];
+    const unsigned char* c = (const unsigned char*)data[2];
+    uint64_t crc_a = 0xffffffff;
+    uint64_t crc_b = 0xffffffff;
+    uint64_t crc_c = 0xffffffff;
+    size_t words = bytes / sizeof(uint64_t);
+    for (size_t i = 0; i < words; i++) {
+        uint64_t word_a, word_b, word_c;
+        memcpy(&word_a, a + i * sizeof(uint64_t), sizeof(uint64_t));
+        memcpy(&word_b, b + i * sizeof(uint64_t), sizeof(uint64_t));
+        memcpy(&word_c, c + i * sizeof(uint64_t), sizeof(uint64_t));
+        crc_a = _mm_crc32_u64(crc_a, word_a);
+        crc_b = _mm_crc32_u64(crc_b, word_b);
+        crc_c = _mm_crc32_u64(crc_c, word_c);
+    }
+    size_t done = words * sizeof(uint64_t);
+    out[0] = ~extend_sse42((uint32_t)crc_a, a + done, bytes - done);
+    out[1] = ~extend_sse42((uint32_t)crc_b, b + done, bytes - done);
+    out[2] = ~extend_sse42((uint32_t)crc_c, c + done, bytes - done);
+}
+#endif
+
+inline
+uint32_t CRC32C::extend(uint32_t crc, const void* data, size_t bytes) {
+    #if defined(__x86_64__)
+        if (hardware())
+            return ~extend_sse42(~crc, (const unsigned char*)data, bytes);
+    #endif
+    return ~extend_table(~crc, (const unsigned char*)data, bytes);
+}
+
+inline
+uint32_t CRC32C::compute(const void* data, size_t bytes) {
+    return extend(0, data, bytes);
+}
+
+inline
+void CRC32C::compute3(const void* const data[3], size_t bytes, uint32_t out[3]) {
+    #if defined(__x86_64__)
+        if (hardware()) {
+            compute3_sse42(data, bytes, out);
+            return;
+        }
+    #endif
+    for (int i = 0; i < 3; i++) {
+        out[i] = compute(data[i], bytes);
+    }
+}
+
+#endif // __CRC32C_HPP__
@@ -17,21 +17,148 @@
 
 
 /**
- * enables demand paging and sets up pages and sigsegv handler
+ * builds the pager in (pages, the sigsegv handler, the global manager) and makes paging the default
+ * MigrationPolicy, segments can still be copied with MigrationPolicy::Copy()
+ * can be set from the build (-DPAGING=1)
 */
+#ifndef PAGING
 #define PAGING 0
+#endif
 
 /**
- * enable fault tolerance
+ * enable fault tolerance, build wide since it changes the allocate and deallocate signatures
+ * can be set from the build (-DFAULT_TOLERANT=1)
 */
+#ifndef FAULT_TOLERANT
 #define FAULT_TOLERANT 0
+#endif
 
 
 /**
- * allows automatic prefetching of the entire memory segment on a new thread
+ * default MigrationPolicy for paged segments, prefetch the entire segment on a new thread after
+ * the transfer, with async reads for ASYNC_PREFETCHING
+ * can be set from the build (-DPREFETCHING=1 -DASYNC_PREFETCHING=1)
 */
+#ifndef PREFETCHING
 #define PREFETCHING 0
+#endif
+#ifndef ASYNC_PREFETCHING
 #define ASYNC_PREFETCHING 0
+#endif
+
+/**
+ * default of MigrationPolicy::stride_prefetch, with PAGING every demand fault on such a segment feeds
+ * its stride detector (paging/prefetcher.hpp) that reads ahead along sequential and strided access patterns
+ * can be set from the build (-DSTRIDE_PREFETCHING=1)
+*/
+#ifndef STRIDE_PREFETCHING
+#define STRIDE_PREFETCHING 0
+#endif
+
+/**
+ * with PAGING, faults on migrated segments are serviced by a userfaultfd handler thread instead
+ * of the sigsegv handler, pages are read into a staging buffer and placed with UFFDIO_COPY
+ * can be set from the build (-DUSERFAULTFD=1)
+*/
+#ifndef USERFAULTFD
+#define USERFAULTFD 0
+#endif
+
+/**
+ * with PAGING, pages of a migrated segment are mapped read only once they are local and the
+ * first write marks them Dirty, RDMAMemoryManager::PushDirty writes back only those pages
+ * only the sigsegv pager supports it
+ * can be set from the build (-DDIRTY_TRACKING=1)
+*/
+#ifndef DIRTY_TRACKING
+#define DIRTY_TRACKING 0
+#endif
+#if DIRTY_TRACKING && USERFAULTFD
+#error "DIRTY_TRACKING needs the sigsegv pager, build without USERFAULTFD"
+#endif
+
+/**
+ * Transfer reads /proc/self/pagemap for the pages of the segment that were ever touched and ships
+ * them as runs with the transfer, the receiver marks the rest Local without reading them
+ * can be set from the build (-DZERO_PAGE_ELISION=0)
+*/
+#ifndef ZERO_PAGE_ELISION
+#define ZERO_PAGE_ELISION 1
+#endif
+
+/**
+ * hybrid transfer, Transfer writes the pages in the segment's access log (paging/accesslog.hpp)
+ * into the destination before handing the segment over, the rest is left to faults and pulls
+ * can be set from the build (-DHOT_PAGE_PUSH=1)
+*/
+#ifndef HOT_PAGE_PUSH
+#define HOT_PAGE_PUSH 0
+#endif
+#if HOT_PAGE_PUSH && PAGING && USERFAULTFD
+#error "HOT_PAGE_PUSH writes into the registered segment, build without USERFAULTFD"
+#endif
+
+/**
+ * the synchronous prefetch started after a paged transfer pulls the segment with this many workers
+ * (RDMAMemoryManager::PullAllPagesParallel), 1 keeps the single threaded page by page sweep
+ * can be set from the build (-DPULL_WORKERS=4)
+*/
+#ifndef PULL_WORKERS
+#define PULL_WORKERS 1
+#endif
+
+/**
+ * default of MigrationPolicy::coded, copied segments with it are run coded (distributed-allocator/RunCodec.hpp)
+ * into a registered staging area before the transfer when a sample of them codes to at most
+ * COMPRESSION_THRESHOLD percent of its size, the destination reads the coded image and expands it into
+ * the segment, paged segments are not coded and a destination with the userfaultfd pager reads them uncoded
+ * can be set from the build (-DCOMPRESSED_TRANSFER=1 -DCOMPRESSION_THRESHOLD=50)
+*/
+#ifndef COMPRESSED_TRANSFER
+#define COMPRESSED_TRANSFER 0
+#endif
+#ifndef COMPRESSION_THRESHOLD
+#define COMPRESSION_THRESHOLD 50
+#endif
+
+/**
+ * default of MigrationPolicy::delta for paged segments, deallocate keeps a segment with it that was
+ * transferred away mapped (up to DELTA_RETAINED_BYTES in all), when it is accepted back from the node
+ * it went to only the pages written there are read again, those come from DIRTY_TRACKING so only
+ * paged segments move as a delta
+ * can be set from the build (-DDELTA_MIGRATION=1 -DDELTA_RETAINED_BYTES=..)
+*/
+#ifndef DELTA_MIGRATION
+#define DELTA_MIGRATION 0
+#endif
+#ifndef DELTA_RETAINED_BYTES
+#define DELTA_RETAINED_BYTES ((size_t)1024 * 1024 * 1024)
+#endif
+#if DELTA_MIGRATION && !(PAGING && DIRTY_TRACKING)
+#error "DELTA_MIGRATION takes the written pages from DIRTY_TRACKING, build with PAGING and DIRTY_TRACKING"
+#endif
+
+/**
+ * default of MigrationPolicy::checksums, Transfer ships a CRC32C of every page of [0, used) of such a
+ * segment and the destination checks each page it pulls against it, a page that does not match is
+ * read again up to TRANSFER_CHECKSUM_RETRIES times
+ * can be set from the build (-DTRANSFER_CHECKSUMS=1 -DTRANSFER_CHECKSUM_RETRIES=..)
+*/
+#ifndef TRANSFER_CHECKSUMS
+#define TRANSFER_CHECKSUMS 0
+#endif
+#ifndef TRANSFER_CHECKSUM_RETRIES
+#define TRANSFER_CHECKSUM_RETRIES 3
+#endif
+
+/**
+ * segments prefer the NUMA node of the RDMA device (or the node given to allocate) and the
+ * completion, poller, fault and prefetch threads run on the cpus of the device's node
+ * can be set from the build (-DNUMA_PLACEMENT=1)
+*/
+#ifndef NUMA_PLACEMENT
+#define NUMA_PLACEMENT 0
+#endif
 
 #define ASCII_STARS "**********************************************************************"
 /**
@@ -52,8 +179,26 @@
  * max async prefetching limitation, async prefetcher will wait until the callback is executed after
  * max_async_pending operations
 */
+#ifndef MAX_ASYNC_PENDING
+#define MAX_ASYNC_PENDING 64
+#endif
+static const int max_async_pending = MAX_ASYNC_PENDING;
+
+/**
+ * background reads yield to demand faults and adapt their depth to the fault latency
+ * (paging/scheduler.hpp), 0 keeps the fixed max_async_pending limit
+*/
+#ifndef PRIORITY_PREFETCHING
+#define PRIORITY_PREFETCHING 1
+#endif
 
-// static int max_async_pending = 1;
+/**
+ * pages brought in by background pulls are unprotected in runs with one mprotect each
+ * (paging/runbatch.hpp), 0 unprotects every page on its own
+*/
+#ifndef BATCHED_RESOLUTION
+#define BATCHED_RESOLUTION 1
+#endif
 #if FAULT_TOLERANT || PAGING
 class RDMAMemoryManager; // forward decleration
 static RDMAMemoryManager* manager = nullptr;
@@ -0,0 +1,120 @@
+#ifndef __NUMA_HPP__
+#define __NUMA_HPP__
+
+/**
+ * NUMA placement for segments and the threads that move them (NUMA_PLACEMENT).
+ * On a multi socket box the RDMA device sits on one socket's PCIe root, reads into or writes
+ * out of memory on another socket cross the interconnect and lose a good part of the bandwidth.
+ * Everything here comes from sysfs and raw syscalls, so there is no libnuma to link.
+ * A node of -1 stands for unknown: single node boxes and devices sysfs has no node for report it,
+ * and every call treats it as "leave the placement to the kernel".
+*/
+
+#include <cstddef>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <linux/mempolicy.h>
+#include <pthread.h>
+#include <sched.h>
+#include <string>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+class NumaNode {
+public:
+    static const int UNKNOWN = -1;
+    // nodes a binding can name
+    static const int MAX_NODES = 1024;
+
+    // node of the PCI function behind the RDMA device called name (ibv_get_device_name)
+    static int ofDevice(const std::string& name);
+
+    /**
+     * Prefers node for the pages of [address, address + size) that are faulted in from now on,
+     * pages already there stay where they are. A preferred node that is full spills over to the
+     * others instead of failing the fault. Returns 0, or -1 if node is unknown or mbind fails.
+    */
+    static int bind(void* address, size_t size, int node);
+
+    // fills cpus with the cpus of node, false if sysfs does not list them
+    static bool cpus(int node, cpu_set_t* cpus);
+    // keeps the calling thread on the cpus of node, 0 or -1 if node is unknown or pinning fails
+    static int pinThread(int node);
+
+private:
+    // parses a sysfs cpu list ("0-15,32-47") into cpus
+    static bool parseList(const char* list, cpu_set_t* cpus);
+};
+
+inline
+int NumaNode::ofDevice(const std::string& name) {
+    std::string path = "/sys/class/infiniband/" + name + "/device/numa_node";
+    FILE* file = fopen(path.c_str(), "r");
+    if (file == nullptr)
+        return UNKNOWN;
+    int node = UNKNOWN;
+    if (fscanf(file, "%d", &node) != 1 || node < 0 || node >= MAX_NODES)
+        node = UNKNOWN;
+    fclose(file);
+    return node;
+}
+
+inline
+int NumaNode::bind(void* address, size_t size, int node) {
+    if (node < 0 || node >= MAX_NODES)
+        return -1;
+    const size_t BITS = 8 * sizeof(unsigned long);
+    unsigned long mask[MAX_NODES / BITS];
+    memset(mask, 0, sizeof(mask));
+    mask[node / BITS] |= 1UL << (node % BITS);
+    return syscall(SYS_mbind, address, size, MPOL_PREFERRED, mask, (unsigned long)MAX_NODES, 0) == 0 ? 0 : -1;
+}
+
+inline
+bool NumaNode::parseList(const char* list, cpu_set_t* cpus) {
+    CPU_ZERO(cpus);
+    const char* p = list;
+    while (*p != '\0' && *p != '\n') {
+        char* end = nullptr;
+        long first = strtol(p, &end, 10);
+        if (end == p)
+            return false;
+        long last = first;
+        p = end;
+        if (*p == '-') {
+            last = strtol(p + 1, &end, 10);
+            p = end;
+        }
+        for (long cpu = first; cpu <= last && cpu < CPU_SETSIZE; cpu++) {
+            CPU_SET(cpu, cpus);
+        }
+        if (*p == ',')
+            p++;
+    }
+    return CPU_COUNT(cpus) > 0;
+}
+
+inline
+bool NumaNode::cpus(int node, cpu_set_t* cpus) {
+    if (node < 0)
+        return false;
+    std::string path = "/sys/devices/system/node/node" + std::to_string(node) + "/cpulist";
+    FILE* file = fopen(path.c_str(), "r");
+    if (file == nullptr)
+        return false;
+    char list[4096];
+    bool found = fgets(list, sizeof(list), file) != nullptr && parseList(list, cpus);
+    fclose(file);
+    return found;
+}
+
+inline
+int NumaNode::pinThread(int node) {
+    cpu_set_t set;
+    if (!cpus(node, &set))
+        return -1;
+    return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0 ? 0 : -1;
+}
+
+#endif // __NUMA_HPP__
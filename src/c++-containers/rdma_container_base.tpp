@@ -1,7 +1,9 @@
 // rdma_container_base.tpp
 
+#include <algorithm>
 #include <scoped_allocator>
 #include <utility>
+#include <vector>
 
 template <class T>
 inline
@@ -22,10 +24,21 @@ template <class T>
 inline
 RDMAContainerBase<T>::~RDMAContainerBase() {
     if (mempool->addr) {
+        // the chain is recorded in the head segment, so release the growth segments first
+        std::vector<void*> segments;
+        for (int i=0; i<mempool->segment_count(); i++) {
+            segments.push_back(mempool->segment_address(i));
+        }
+        // other threads drop their caches for this pool instead of flushing into freed memory at exit
+        MagazineCache::retire(mempool);
+        MagazineCache::forget(mempool);
+        for (size_t i=1; i<segments.size(); i++) {
+            manager->deallocate(segments[i]);
+        }
         #if FAULT_TOLERANT
             manager->deallocate(id);
         #else 
-            manager->deallocate(mempool->addr);
+            manager->deallocate(segments[0]);
         #endif
     }
     
@@ -34,11 +47,11 @@ RDMAContainerBase<T>::~RDMAContainerBase() {
 template <class T>
 inline
 void RDMAContainerBase<T>::set_up_allocator() {
-    // allocate using the manager
+    // allocate using the manager, with room behind the segment for the pool to grow
     #if FAULT_TOLERANT
-        void* memory = manager->allocate(DEFAULT_POOL_SIZE, id);
+        void* memory = manager->allocate(DEFAULT_POOL_SIZE, id, MAX_POOL_SIZE);
     #else
-        void* memory = manager->allocate(DEFAULT_POOL_SIZE);
+        void* memory = manager->allocate(DEFAULT_POOL_SIZE, MAX_POOL_SIZE);
     #endif
     /*
         set up pool information within the memory
@@ -47,131 +60,260 @@ void RDMAContainerBase<T>::set_up_allocator() {
     */
     MemoryPool** pool_ = (MemoryPool**)memory;
     (*pool_) = (MemoryPool*)((char*)memory + sizeof(MemoryPool**));
-    //set up the pool
-    (*pool_)->pool_addr = (void*)((char*)memory + sizeof(MemoryPool**) + sizeof(MemoryPool) + sizeof(void*));
-    (*pool_)->unused_past = (*pool_)->pool_addr;
-    (*pool_)->pool_size = DEFAULT_POOL_SIZE - (sizeof(MemoryPool**) + sizeof(MemoryPool) + sizeof(void*));
+    //set up the pool, blocks start after the container address slot on an aligned boundary
+    uintptr_t pool_start = (uintptr_t)memory + sizeof(MemoryPool**) + sizeof(MemoryPool) + sizeof(void*);
+    pool_start = (pool_start + MemoryPool::ALIGNMENT - 1) & ~(MemoryPool::ALIGNMENT - 1);
+    new (*pool_) MemoryPool((void*)pool_start, DEFAULT_POOL_SIZE - (pool_start - (uintptr_t)memory));
     (*pool_)->size = DEFAULT_POOL_SIZE;
     (*pool_)->addr = memory;
+    (*pool_)->set_chain(DEFAULT_POOL_SIZE, MAX_POOL_SIZE);
 
     mempool = *pool_;
     alloc = PoolBasedAllocator<T>(&(*pool_));
+    bind_pool();
 }
 
+template <class T>
+inline
+void RDMAContainerBase<T>::bind_pool() {
+    mempool->set_grow_hook(&RDMAContainerBase<T>::grow_pool, (void*)this);
+}
+
+template <class T>
+inline
+void* RDMAContainerBase<T>::grow_pool(void* context, void* address, size_t size) {
+    RDMAContainerBase<T>* container = (RDMAContainerBase<T>*)context;
+    LogInfo("growing pool at %p by %zu bytes", address, size);
+    #if FAULT_TOLERANT
+        return container->manager->allocate(address, size, container->id);
+    #else
+        return container->manager->allocate(address, size);
+    #endif
+}
+
+template <class T>
+inline
+void RDMAContainerBase<T>::deallocate_segment(void* address) {
+    #if FAULT_TOLERANT
+        if (address == (void*)chain_start) {
+            manager->deallocate(id);
+            return;
+        }
+    #endif
+    manager->deallocate(address);
+}
+
+template <class T>
+inline
+bool RDMAContainerBase<T>::in_chain(void* address) {
+    return (uintptr_t)address >= chain_start && (uintptr_t)address < chain_end;
+}
+
+template <class T>
+inline
+void RDMAContainerBase<T>::FlushThreadCache() {
+    if (mempool != nullptr)
+        MagazineCache::flush(mempool);
+}
+
+/*
+    every segment of the chain is prepared separately, the head goes first
+*/
 template <class T>
 inline
 bool RDMAContainerBase<T>::Prepare(int destination) {
     void* addr = mempool->addr;
-    size_t size = mempool->size;
     void** destination_address = (void**)((char*)addr + sizeof(MemoryPool**) + sizeof(MemoryPool));
     *destination_address = this->get_container_address(); 
     void* copied_address = *destination_address; 
     LogInfo("container address destination is packed is: %p", destination_address);
     LogInfo("container address packed is: %p", copied_address);
 
-    if (!manager->Prepare(addr, size, destination))
-        return true;
-    return false;
+    // blocks still cached by other threads are dropped, they have to flush before this point
+    MagazineCache::flush(mempool);
+    MagazineCache::retire(mempool);
+
+    chain_start = (uintptr_t)addr;
+    chain_end = (uintptr_t)addr + mempool->size;
+    pending_segments = mempool->segment_count();
+    for (int i=0; i<mempool->segment_count(); i++) {
+        if (manager->Prepare(mempool->segment_address(i), mempool->segment_size(i), destination))
+            return false;
+    }
+    return true;
 }
 
+/*
+    returns true once every segment of the chain has been accepted
+*/
 template <class T>
 inline
 bool RDMAContainerBase<T>::PollForAccept() {
-    rdma_memory = manager->PeekAccept();
-    if(rdma_memory == NULL)
-        return false;
-    if(rdma_memory->vaddr == mempool->addr)
-        rdma_memory = manager->PollForAccept();        
-    return true;
+    RDMAMemory* accepted = manager->PeekAccept();
+    while (accepted != NULL && in_chain(accepted->vaddr)) {
+        accepted = manager->PollForAccept();
+        if (accepted->vaddr == mempool->addr)
+            rdma_memory = accepted;
+        pending_segments--;
+        accepted = manager->PeekAccept();
+    }
+    return pending_segments == 0;
 }
 
 template <class T>
 inline
 bool RDMAContainerBase<T>::Transfer() {
     LogAssert(rdma_memory!=nullptr, "Prepare not sent");
-    if(this->manager->Transfer(rdma_memory->vaddr, rdma_memory->size, rdma_memory->pair))
-        return false;
+    pending_segments = mempool->segment_count();
+    // only the part of each segment below the pool watermark is shipped, freed small blocks
+    // at the top are merged back first so it reflects what is still in use
+    mempool->trim();
+    uintptr_t used_end = (uintptr_t)mempool->unused_past;
+    for (int i=0; i<mempool->segment_count(); i++) {
+        uintptr_t segment = (uintptr_t)mempool->segment_address(i);
+        size_t used = 0;
+        if (segment < used_end)
+            used = std::min(mempool->segment_size(i), (size_t)(used_end - segment));
+        if (this->manager->Transfer((void*)segment, mempool->segment_size(i), rdma_memory->pair, used))
+            return false;
+    }
     return true;
 }
 
+/*
+    the head segment arrives first and holds the chain, returns true once the
+    rest of the chain has arrived as well
+*/
 template <class T>
 inline
 bool RDMAContainerBase<T>::PollForTransfer() {
     RDMAMemory* mem = manager->PollForTransfer();
-    if(mem == nullptr)
-        return false;
-    this->rdma_memory = mem;
-    return true; 
+    while (mem != nullptr) {
+        if (pending_segments == 0) {
+            this->rdma_memory = mem;
+            MemoryPool* pool = (MemoryPool*)((char*)mem->vaddr + sizeof(MemoryPool**));
+            chain_start = (uintptr_t)mem->vaddr;
+            chain_end = (uintptr_t)mem->vaddr + pool->size;
+            pending_segments = pool->segment_count() - 1;
+        } else {
+            LogAssert(in_chain(mem->vaddr), "transfer for a segment outside of the pool chain");
+            pending_segments--;
+        }
+        if (pending_segments == 0)
+            return true;
+        mem = manager->PollForTransfer();
+    }
+    return false;
 }
 
 template <class T>
 inline
 bool RDMAContainerBase<T>::PollForClose() {
     RDMAMemory* r_memory = manager->PeekClose();
-    if(r_memory == NULL)
-        return false;
-    if(r_memory->vaddr == mempool->addr) {
-        rdma_memory = manager->PollForClose();
-        #if FAULT_TOLERANT
-            manager->deallocate(rdma_memory->application_id);
-        #else 
-            manager->deallocate(rdma_memory->vaddr);
-        #endif
-    } else {
-        return false;
+    while (r_memory != NULL && in_chain(r_memory->vaddr)) {
+        r_memory = manager->PollForClose();
+        if (r_memory->vaddr == (void*)chain_start)
+            rdma_memory = r_memory;
+        deallocate_segment(r_memory->vaddr);
+        pending_segments--;
+        r_memory = manager->PeekClose();
     }
-    
-    return true;
-    
+    return pending_segments == 0;
 }
 
 template <class T>
 inline
 void RDMAContainerBase<T>::Close() {
-    manager->close(rdma_memory->vaddr, rdma_memory->size, rdma_memory->pair);
+    for (int i=0; i<mempool->segment_count(); i++) {
+        manager->close(mempool->segment_address(i), mempool->segment_size(i), rdma_memory->pair);
+    }
 }
 
+/*
+    the pull helpers only go up to the pool watermark, clipped per segment
+    since every segment is registered as its own memory region
+*/
 template <class T>
 inline
 void RDMAContainerBase<T>::Pull() {
-    manager->Pull(
-        this->rdma_memory->vaddr, 
-        (size_t) ( (uintptr_t)this->mempool->unused_past - (uintptr_t)this->rdma_memory->vaddr),
-        this->rdma_memory->pair);
+    uintptr_t used_end = (uintptr_t)this->mempool->unused_past;
+    for (int i=0; i<mempool->segment_count(); i++) {
+        uintptr_t segment = (uintptr_t)mempool->segment_address(i);
+        if (segment >= used_end)
+            break;
+        size_t size = std::min(mempool->segment_size(i), (size_t)(used_end - segment));
+        manager->Pull((void*)segment, size, this->rdma_memory->pair);
+    }
 }
 
 template <class T>
 inline
 void RDMAContainerBase<T>::Push() {
-    manager->Push(
-        this->rdma_memory->vaddr, 
-        (size_t) ( (uintptr_t)this->mempool->unused_past - (uintptr_t)this->rdma_memory->vaddr),
-        this->rdma_memory->pair);
+    uintptr_t used_end = (uintptr_t)this->mempool->unused_past;
+    for (int i=0; i<mempool->segment_count(); i++) {
+        uintptr_t segment = (uintptr_t)mempool->segment_address(i);
+        if (segment >= used_end)
+            break;
+        size_t size = std::min(mempool->segment_size(i), (size_t)(used_end - segment));
+        manager->Push((void*)segment, size, this->rdma_memory->pair);
+    }
+}
+
+template <class T>
+inline
+int RDMAContainerBase<T>::PushDirty() {
+    int pushed = 0;
+    uintptr_t used_end = (uintptr_t)this->mempool->unused_past;
+    for (int i=0; i<mempool->segment_count(); i++) {
+        uintptr_t segment = (uintptr_t)mempool->segment_address(i);
+        if (segment >= used_end)
+            break;
+        int pages = manager->PushDirty((void*)segment);
+        if (pages < 0)
+            return -1;
+        pushed += pages;
+    }
+    return pushed;
 }
 
 template <class T>
 inline
-void RDMAContainerBase<T>::PullSync() {
-    manager->PullPagesSync(
-        this->rdma_memory->vaddr, 
-        (size_t) ( (uintptr_t)this->mempool->unused_past - (uintptr_t)this->rdma_memory->vaddr),
-        this->rdma_memory->pair);
+bool RDMAContainerBase<T>::PullSync() {
+    uintptr_t used_end = (uintptr_t)this->mempool->unused_past;
+    for (int i=0; i<mempool->segment_count(); i++) {
+        uintptr_t segment = (uintptr_t)mempool->segment_address(i);
+        if (segment >= used_end)
+            break;
+        size_t size = std::min(mempool->segment_size(i), (size_t)(used_end - segment));
+        if (manager->PullPagesSync((void*)segment, size, this->rdma_memory->pair) != 0)
+            return false;
+    }
+    return true;
 }
 
 template <class T>
 inline
-void RDMAContainerBase<T>::PullAsync(int rate_limiter) {
-    manager->PullPagesAsync(
-        this->rdma_memory->vaddr, 
-        (size_t) ( (uintptr_t)this->mempool->unused_past - (uintptr_t)this->rdma_memory->vaddr),
-        this->rdma_memory->pair,
-        rate_limiter);
+bool RDMAContainerBase<T>::PullAsync(int rate_limiter) {
+    uintptr_t used_end = (uintptr_t)this->mempool->unused_past;
+    for (int i=0; i<mempool->segment_count(); i++) {
+        uintptr_t segment = (uintptr_t)mempool->segment_address(i);
+        if (segment >= used_end)
+            break;
+        size_t size = std::min(mempool->segment_size(i), (size_t)(used_end - segment));
+        if (manager->PullPagesAsync((void*)segment, size, this->rdma_memory->pair, rate_limiter) != 0)
+            return false;
+    }
+    return true;
 }
 
 template <class T>
 inline
-void RDMAContainerBase<T>::PullAndClose() {
-    manager->PullAllPages(this->rdma_memory);
+bool RDMAContainerBase<T>::PullAndClose() {
+    for (int i=0; i<mempool->segment_count(); i++) {
+        if (manager->PullAllPages(manager->getRDMAMemory(mempool->segment_address(i))) != 0)
+            return false;
+    }
+    return true;
 }
 
 template <class T>
@@ -184,6 +326,23 @@ void RDMAContainerBase<T>::SetContainerSize(size_t size) {
 template <class T>
 inline
 void RDMAContainerBase<T>::SetPageSize(size_t size) {
-    if(rdma_memory != nullptr)
-        this->rdma_memory->pages.setPageSize(size);
+    if(rdma_memory == nullptr)
+        return;
+    for (int i=0; i<mempool->segment_count(); i++) {
+        if (manager->SetPageSize(mempool->segment_address(i), size) != 0)
+            LogError("could not set page size %zu on segment %d", size, i);
+    }
+}
+
+template <class T>
+inline
+void RDMAContainerBase<T>::SetMaxContainerSize(size_t size) {
+    if(mempool == nullptr)
+        this->MAX_POOL_SIZE = size;
+}
+
+template <class T>
+inline
+const MemoryPool* RDMAContainerBase<T>::GetMemoryPool() const {
+    return this->mempool;
 }
@@ -0,0 +1,74 @@
+// MigrationHandle.tpp
+
+inline
+MigrationHandle::MigrationHandle(RDMAMemory* memory, int destination) :
+    memory(memory),
+    destination(destination),
+    current(State::Preparing) {}
+
+inline
+MigrationHandle::State MigrationHandle::state() {
+    std::lock_guard<std::mutex> guard(mutex);
+    return current;
+}
+
+inline
+bool MigrationHandle::wait(State state, int64_t timeout_us) {
+    std::unique_lock<std::mutex> lock(mutex);
+    auto done = [this, state]() { return reached(current, state) || finished(current); };
+    if (timeout_us < 0)
+        changed.wait(lock, done);
+    else
+        changed.wait_for(lock, std::chrono::microseconds(timeout_us), done);
+    return reached(current, state);
+}
+
+inline
+void MigrationHandle::then(State state, Continuation fn) {
+    std::unique_lock<std::mutex> lock(mutex);
+    if (reached(current, state)) {
+        lock.unlock();
+        fn(*this);
+        return;
+    }
+    if (finished(current))
+        return;
+    pending.push_back(std::make_pair(state, fn));
+}
+
+inline
+void MigrationHandle::advance(State state) {
+    std::vector<Continuation> ready;
+    {
+        std::lock_guard<std::mutex> guard(mutex);
+        if (finished(current) || reached(current, state))
+            return;
+        current = state;
+        std::vector<std::pair<State, Continuation>> waiting;
+        for (auto& it : pending) {
+            if (reached(current, it.first))
+                ready.push_back(it.second);
+            else if (!finished(current))
+                waiting.push_back(it);
+        }
+        pending.swap(waiting);
+    }
+    changed.notify_all();
+
+    // outside the lock, a continuation may advance the handle itself (e.g. by calling Transfer)
+    for (Continuation& fn : ready) {
+        fn(*this);
+    }
+}
+
+inline
+bool MigrationHandle::reached(State current, State state) {
+    if (current == State::Declined || state == State::Declined)
+        return current == state;
+    return (int)current >= (int)state;
+}
+
+inline
+bool MigrationHandle::finished(State current) {
+    return current == State::Closed || current == State::Declined;
+}
@@ -0,0 +1,69 @@
+// MigrationPolicy.tpp
+
+inline
+MigrationPolicy MigrationPolicy::Default() {
+    MigrationPolicy policy;
+    policy.paging = PAGING != 0;
+    policy.prefetch = PREFETCHING != 0;
+    policy.async_prefetch = ASYNC_PREFETCHING != 0;
+    policy.stride_prefetch = STRIDE_PREFETCHING != 0;
+    policy.coded = COMPRESSED_TRANSFER != 0;
+    policy.delta = DELTA_MIGRATION != 0;
+    policy.checksums = TRANSFER_CHECKSUMS != 0;
+    return policy;
+}
+
+inline
+MigrationPolicy MigrationPolicy::Copy(bool coded) {
+    MigrationPolicy policy;
+    policy.paging = false;
+    policy.prefetch = false;
+    policy.async_prefetch = false;
+    policy.stride_prefetch = false;
+    policy.coded = coded;
+    policy.delta = false;
+    policy.checksums = TRANSFER_CHECKSUMS != 0;
+    return policy;
+}
+
+inline
+MigrationPolicy MigrationPolicy::Paged(bool prefetch, bool async_prefetch, bool stride_prefetch) {
+    MigrationPolicy policy;
+    policy.paging = true;
+    policy.prefetch = prefetch;
+    policy.async_prefetch = async_prefetch;
+    policy.stride_prefetch = stride_prefetch;
+    policy.coded = false;
+    policy.delta = DELTA_MIGRATION != 0;
+    policy.checksums = TRANSFER_CHECKSUMS != 0;
+    return policy;
+}
+
+inline
+uint32_t MigrationPolicy::encode() const {
+    return (paging ? 1 : 0) | (prefetch ? 2 : 0) | (async_prefetch ? 4 : 0) | (coded ? 8 : 0)
+        | (stride_prefetch ? 16 : 0) | (delta ? 32 : 0) | (checksums ? 64 : 0);
+}
+
+inline
+MigrationPolicy MigrationPolicy::decode(uint32_t bits) {
+    MigrationPolicy policy;
+    policy.paging = (bits & 1) != 0;
+    policy.prefetch = (bits & 2) != 0;
+    policy.async_prefetch = (bits & 4) != 0;
+    policy.coded = (bits & 8) != 0;
+    policy.stride_prefetch = (bits & 16) != 0;
+    policy.delta = (bits & 32) != 0;
+    policy.checksums = (bits & 64) != 0;
+    return policy;
+}
+
+inline
+bool MigrationPolicy::operator==(const MigrationPolicy& other) const {
+    return encode() == other.encode();
+}
+
+inline
+bool MigrationPolicy::operator!=(const MigrationPolicy& other) const {
+    return !(*this == other);
+}
@@ -1,12 +1,38 @@
 // RDMAMemory.tpp
 
 #include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <functional>
+#include <new>
+
+#if PAGING && USERFAULTFD
+#include <linux/userfaultfd.h>
+#include <poll.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#endif
 
 inline
 RDMAMemory::RDMAMemory(int owner, void* addr, size_t size) :
     state(State::Clean),
     pair(-1),
-    pages((uintptr_t)addr, size, 4096) {    
+    policy(MigrationPolicy::Default()),
+    pages((uintptr_t)addr, size, 4096),
+    auto_page_size(false),
+    demand_faults(0),
+    faults_measured(false),
+    pre_copied(false),
+    staging(nullptr),
+    staging_size(0),
+    checksum_table(nullptr),
+    checksum_table_size(0),
+    generation(0),
+    retained_generation(0),
+    numa_node(NumaNode::UNKNOWN) {    
     this->owner = owner;
     this->vaddr = addr;
     this->size = size;
@@ -16,7 +42,19 @@ inline
 RDMAMemory::RDMAMemory(int owner, void* addr, size_t size, size_t page_size) :
     state(State::Clean),
     pair(-1),
-    pages((uintptr_t)addr, size, page_size) {    
+    policy(MigrationPolicy::Default()),
+    pages((uintptr_t)addr, size, page_size),
+    auto_page_size(false),
+    demand_faults(0),
+    faults_measured(false),
+    pre_copied(false),
+    staging(nullptr),
+    staging_size(0),
+    checksum_table(nullptr),
+    checksum_table_size(0),
+    generation(0),
+    retained_generation(0),
+    numa_node(NumaNode::UNKNOWN) {    
     this->owner = owner;
     this->vaddr = addr;
     this->size = size;
@@ -28,7 +66,19 @@ inline
 RDMAMemory::RDMAMemory(int owner, void* addr, size_t size, int64_t app_id) :
     state(State::Clean),
     pair(-1),
-    pages((uintptr_t)addr, size, 4096) {    
+    policy(MigrationPolicy::Default()),
+    pages((uintptr_t)addr, size, 4096),
+    auto_page_size(false),
+    demand_faults(0),
+    faults_measured(false),
+    pre_copied(false),
+    staging(nullptr),
+    staging_size(0),
+    checksum_table(nullptr),
+    checksum_table_size(0),
+    generation(0),
+    retained_generation(0),
+    numa_node(NumaNode::UNKNOWN) {    
     this->owner = owner;
     this->vaddr = addr;
     this->size = size;
@@ -39,7 +89,19 @@ inline
 RDMAMemory::RDMAMemory(int owner, void* addr, size_t size, size_t page_size, int64_t app_id) :
     state(State::Clean),
     pair(-1),
-    pages((uintptr_t)addr, size, page_size) {    
+    policy(MigrationPolicy::Default()),
+    pages((uintptr_t)addr, size, page_size),
+    auto_page_size(false),
+    demand_faults(0),
+    faults_measured(false),
+    pre_copied(false),
+    staging(nullptr),
+    staging_size(0),
+    checksum_table(nullptr),
+    checksum_table_size(0),
+    generation(0),
+    retained_generation(0),
+    numa_node(NumaNode::UNKNOWN) {    
     this->owner = owner;
     this->vaddr = addr;
     this->size = size;
@@ -51,9 +113,30 @@ RDMAMemory::RDMAMemory(int owner, void* addr, size_t size, size_t page_size, int
 inline
 RDMAMemory::~RDMAMemory() {}
 
+/*
+    the members cannot be assigned, so the segment is destroyed and built again in place,
+    pointers to it stay valid
+*/
+inline
+void RDMAMemory::reset(int owner, void* addr, size_t size) {
+    #if FAULT_TOLERANT
+        int64_t app_id = this->application_id;
+        this->~RDMAMemory();
+        new (this) RDMAMemory(owner, addr, size, app_id);
+    #else
+        this->~RDMAMemory();
+        new (this) RDMAMemory(owner, addr, size);
+    #endif
+}
+
 inline
 RDMAMemoryManager::RDMAMemoryManager(std::string config, int serverid) : 
     coordinator(config, serverid), 
+    pulled_bytes(0),
+    pushed_bytes(0),
+    nic_node(NumaNode::UNKNOWN),
+    retained_bytes(0),
+    retained_sequence(0),
     incoming_transfers(), 
     incoming_accepts(),
     incoming_dones(),
@@ -80,6 +163,17 @@ RDMAMemoryManager::RDMAMemoryManager(std::string config, int serverid) :
 
     // the memlist and free list do not need allocation
     this->coordinator.connect_mesh();
+    #if NUMA_PLACEMENT
+        // every connection goes through the one device, any of them knows where it is
+        for (auto& connection : this->coordinator.connections) {
+            this->nic_node = this->coordinator.getServer(connection.first, connection.second)->device_numa_node();
+            break;
+        }
+        LogInfo("RDMA device is on NUMA node %d", this->nic_node);
+    #endif
+    #if PAGING && USERFAULTFD
+        this->start_userfault();
+    #endif
     this->poller_thread = std::thread(&RDMAMemoryManager::poller_thread_method, this);
     this->poller_thread.detach();
 }
@@ -97,10 +191,10 @@ RDMAMemoryManager::~RDMAMemoryManager() {
 
 inline
 #if FAULT_TOLERANT
-void* RDMAMemoryManager::allocate(size_t size, int64_t application_id){
+void* RDMAMemoryManager::allocate(size_t size, int64_t application_id, size_t reserve){
     LogInfo("allocating using zookeeper, fetching memory address");
     RDMAMemory* r_memory = nullptr;
-    void* address = coordinator.getAllocationAddress(size);
+    void* address = coordinator.getAllocationAddress(reserve > size ? reserve : size);
 
     // mmap this address.
     int prot = PROT_READ | PROT_WRITE;
@@ -117,6 +211,7 @@ void* RDMAMemoryManager::allocate(size_t size, int64_t application_id){
     
     LogInfo("called mmap on %lu and returning address %lu", (uintptr_t)address, (uintptr_t)res);
     LogAssert((uintptr_t)address == (uintptr_t)res, "asserting the addresses match");
+    this->PlaceSegment(res, size, NumaNode::UNKNOWN);
 
     if (coordinator.createMemorySegmentNode(address, size, this->server_id, -1, application_id) != 0) {
         goto failure_;
@@ -128,6 +223,7 @@ void* RDMAMemoryManager::allocate(size_t size, int64_t application_id){
     
     r_memory = new RDMAMemory(this->server_id, res, size, application_id);
     local_segments[res] = r_memory; 
+    segment_index.insert(res, size, r_memory);
     return r_memory->vaddr;
 
     failure_:
@@ -138,6 +234,26 @@ void* RDMAMemoryManager::allocate(size_t size, int64_t application_id){
     return nullptr;
 }
 
+inline
+void* RDMAMemoryManager::allocate(size_t size, int64_t application_id, const MigrationPolicy& policy, size_t reserve) {
+    void* address = this->allocate(size, application_id, reserve);
+    if (address != nullptr && this->SetPolicy(address, policy) != 0) {
+        this->deallocate(application_id);
+        return nullptr;
+    }
+    return address;
+}
+
+inline
+void* RDMAMemoryManager::allocate(size_t size, int64_t application_id, const MigrationPolicy& policy, int numa_node, size_t reserve) {
+    void* address = this->allocate(size, application_id, policy, reserve);
+    if (address != nullptr && this->SetNumaNode(address, numa_node) != 0) {
+        this->deallocate(application_id);
+        return nullptr;
+    }
+    return address;
+}
+
 inline
 int RDMAMemoryManager::deallocate(int64_t application_id) {
     //this memory needs to be in memory map
@@ -166,7 +282,7 @@ int RDMAMemoryManager::deallocate(int64_t application_id) {
             LogError("could not update process list");
         }
         local_segments.erase(v_addr);
-        
+        segment_index.remove(v_addr);
     }
 
     int rc = this->coordinator.deleteMemorySegment(application_id, this->coordinator.server_id);
@@ -178,12 +294,27 @@ int RDMAMemoryManager::deallocate(int64_t application_id) {
     return 0;
 }
 
+inline
+void RDMAMemoryManager::deallocate(void* v_addr) {
+    auto it = local_segments.find(v_addr);
+    LogAssert(it != local_segments.end(), "memory not found in local segments");
+
+    RDMAMemory* memory = it->second;
+    int res_munmap = munmap(v_addr, memory->size);
+    if(res_munmap == -1) {
+        LogError("munmap failed beause %s", strerror(errno));
+    }
+    local_segments.erase(it);
+    segment_index.remove(v_addr);
+}
+
 #else
-void* RDMAMemoryManager::allocate(size_t size){
+void* RDMAMemoryManager::allocate(size_t size, size_t reserve){
     RDMAMemory* r_memory = nullptr; 
 
+    // a reused segment has no room behind it, reservations always come from the shared space
     std::unordered_map<size_t, std::vector<RDMAMemory*>>::const_iterator x = this->free_map.find(size);
-    if(x != free_map.end()){
+    if(reserve <= size && x != free_map.end()){
         LogInfo("memory found in free map");
 
         std::vector<RDMAMemory*> vec = x->second;
@@ -211,14 +342,20 @@ void* RDMAMemoryManager::allocate(size_t size){
             free_map[size] = vec;
         }
 
+        // nothing of the last life of the segment carries over, a leftover pre_copied would send nothing
+        memory->reset(this->server_id, res, size);
+        this->PlaceSegment(res, size, NumaNode::UNKNOWN);
         memory_map[memory->vaddr] = memory;
+        segment_index.insert(memory->vaddr, memory->size, memory);
         return memory->vaddr;
     }
 
     alloc:
     LogInfo("memory not found in free map, will try to allocate from shared space");
 
-    uintptr_t end = this->alloc_address + size;
+    if (reserve < size)
+        reserve = size;
+    uintptr_t end = this->alloc_address + reserve;
     if (end > this->end_address) {
         LogError("shared memory block exhausted");
         return nullptr;
@@ -239,23 +376,56 @@ void* RDMAMemoryManager::allocate(size_t size){
     
     LogInfo("called mmap on %lu and returning address %lu", this->alloc_address, (uintptr_t)res);
     LogAssert(this->alloc_address == (uintptr_t)res, "asserting the addresses match");
-    this->alloc_address += size;
+    this->alloc_address += reserve;
+    this->PlaceSegment(res, size, NumaNode::UNKNOWN);
 
     r_memory = new RDMAMemory(this->server_id, res, size);
     memory_map[res] = r_memory; 
+    segment_index.insert(res, size, r_memory);
     return r_memory->vaddr;
 }
 
+inline
+void* RDMAMemoryManager::allocate(size_t size, const MigrationPolicy& policy, size_t reserve) {
+    void* address = this->allocate(size, reserve);
+    if (address != nullptr && this->SetPolicy(address, policy) != 0) {
+        this->deallocate(address);
+        return nullptr;
+    }
+    return address;
+}
+
+inline
+void* RDMAMemoryManager::allocate(size_t size, const MigrationPolicy& policy, int numa_node, size_t reserve) {
+    void* address = this->allocate(size, policy, reserve);
+    if (address != nullptr && this->SetNumaNode(address, numa_node) != 0) {
+        this->deallocate(address);
+        return nullptr;
+    }
+    return address;
+}
+
 inline
 void RDMAMemoryManager::deallocate(void* v_addr){
     //this memory needs to be in memory map
     LogAssert(memory_map.find(v_addr) != memory_map.end(), "memory not found in memory map");
 
     RDMAMemory *memory = memory_map.find(v_addr)->second;
+    // a segment that moved on may come back to us
+    if (memory->policy.delta && memory->owner != this->server_id && memory->generation != 0 && this->retain(memory))
+        return;
+    this->release(memory);
+}
+
+inline
+void RDMAMemoryManager::release(RDMAMemory* memory){
+    // normally gone with the close, unless the segment was transferred and never closed
+    this->ReleaseStaging(memory, memory->pair);
     int res = munmap(memory->vaddr, memory->size);
     if(res == -1) {
         LogError("munmap failed beause %s", strerror(errno));
     } 
+    segment_index.remove(memory->vaddr);
 
     // add this to the free list
     auto x = free_map.find(memory->size);
@@ -281,22 +451,29 @@ inline
 void* RDMAMemoryManager::allocate(void* v_addr, size_t size){
 #endif
 
+    // the copy kept when the segment left is reused as it is, on_transfer tells whether it is still good
+    uint64_t kept = this->take_retained(v_addr, size);
+
     // mmap this address.
     RDMAMemory* r_memory = nullptr; 
-    int prot = PROT_READ | PROT_WRITE;
-    int flags = MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE;
-    int fd = -1;
-    off_t offset = 0;
-    void* res = (void*) mmap((void*)v_addr, size, prot, flags, fd, offset);
-    if (res == MAP_FAILED) {
-        std::string str = strerror(errno);
-        LogError("%s",str.c_str());
-        return nullptr;
-    }
+    void* res = v_addr;
+    if (kept == 0) {
+        int prot = PROT_READ | PROT_WRITE;
+        int flags = MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE;
+        int fd = -1;
+        off_t offset = 0;
+        res = (void*) mmap((void*)v_addr, size, prot, flags, fd, offset);
+        if (res == MAP_FAILED) {
+            std::string str = strerror(errno);
+            LogError("%s",str.c_str());
+            return nullptr;
+        }
 
-    LogInfo("called mmap on %p and returning address %p", v_addr, res);
-    LogAssert(v_addr == res, "asserting the addresses match");
-    
+        LogInfo("called mmap on %p and returning address %p", v_addr, res);
+        LogAssert(v_addr == res, "asserting the addresses match");
+        // the pulls into it come in through the device
+        this->PlaceSegment(res, size, NumaNode::UNKNOWN);
+    }
     
     #if FAULT_TOLERANT
         r_memory = new RDMAMemory(this->server_id, res, size, application_id);
@@ -305,6 +482,8 @@ void* RDMAMemoryManager::allocate(void* v_addr, size_t size){
         r_memory = new RDMAMemory(this->server_id, res, size);
         memory_map[res] = r_memory;
     #endif
+    r_memory->retained_generation = kept;
+    segment_index.insert(res, size, r_memory);
 
     return r_memory->vaddr;
 }
@@ -338,6 +517,42 @@ int RDMAMemoryManager::Prepare(void* v_addr, size_t size, int destination) {
     return 0;
 }
 
+inline
+int RDMAMemoryManager::Prepare(void* v_addr, size_t size, int destination, size_t page_size) {
+    if (this->SetPageSize(v_addr, page_size) != 0)
+        return -1;
+    return this->Prepare(v_addr, size, destination);
+}
+
+inline
+int RDMAMemoryManager::Prepare(void* v_addr, size_t size, int destination, const MigrationPolicy& policy) {
+    if (this->SetPolicy(v_addr, policy) != 0)
+        return -1;
+    return this->Prepare(v_addr, size, destination);
+}
+
+inline
+std::shared_ptr<MigrationHandle> RDMAMemoryManager::PrepareAsync(void* v_addr, size_t size, int destination) {
+    RDMAMemory* memory = this->getRDMAMemory(v_addr);
+    if (memory == nullptr || memory->vaddr != v_addr) {
+        LogError("no segment starts at %p", v_addr);
+        return nullptr;
+    }
+    if (memory->handle) {
+        LogError("segment %p is already migrating", v_addr);
+        return nullptr;
+    }
+
+    // in place before the prepare goes out, the accept may come back right away
+    std::shared_ptr<MigrationHandle> handle = std::make_shared<MigrationHandle>(memory, destination);
+    memory->handle = handle;
+    if (this->Prepare(v_addr, size, destination) != 0) {
+        memory->handle.reset();
+        handle->advance(MigrationHandle::State::Declined);
+    }
+    return handle;
+}
+
 /*
     prior to this call the user should wait for the queue message for prepare
     and should be able to allocate and register the required memory address 
@@ -361,8 +576,11 @@ void* RDMAMemoryManager::accept(void* v_addr, size_t size, int source, int64_t c
     
     this->UpdatePair(mem, source);
 
+    #if !(PAGING && USERFAULTFD)
+    // with userfaultfd pages are read into the staging buffer, the segment itself stays unpinned
     LogInfo("registering memory");
     this->coordinator.getServer(source, conn_id)->register_memory(this->coordinator.connections[source],v_addr, size, false);
+    #endif
     LogInfo("sending accept");
     if (this->coordinator.getServer(source, conn_id)->send_accept(conn_id, mem, size) != 0) {
         this->deallocate(client_id);
@@ -384,8 +602,11 @@ void* RDMAMemoryManager::accept(void* v_addr, size_t size, int source){
 
     this->UpdatePair(mem, source);
     
+    #if !(PAGING && USERFAULTFD)
+    // with userfaultfd pages are read into the staging buffer, the segment itself stays unpinned
     LogInfo("registering memory");
     this->coordinator.getServer(source, conn_id)->register_memory(this->coordinator.connections[source],v_addr, size, false);
+    #endif
     LogInfo("sending accept");
     this->coordinator.getServer(source, conn_id)->send_accept(conn_id, mem, size);
    
@@ -393,8 +614,174 @@ void* RDMAMemoryManager::accept(void* v_addr, size_t size, int source){
 }
 #endif
 
+#if FAULT_TOLERANT
+inline
+int RDMAMemoryManager::accept_many(const std::vector<rdma_batch_entry>& entries, int source) {
+    uintptr_t conn_id = this->coordinator.connections[source];
+    RDMAServerPrototype* server = this->coordinator.getServer(source, conn_id);
+    std::vector<rdma_batch_entry> accepted;
+    std::vector<std::pair<void*, size_t>> regions;
+    for (const rdma_batch_entry& entry : entries) {
+        void* mem = this->allocate(entry.region.addr, entry.region.length, entry.application_id);
+        this->coordinator.addToProcessList(entry.application_id);
+        if (mem == nullptr) {
+            LogInfo("could not allocate %p for accept, sending reject", entry.region.addr);
+            server->send_decline(conn_id, entry.region.addr, entry.region.length);
+            continue;
+        }
+        this->UpdatePair(mem, source);
+        regions.push_back(std::make_pair(mem, entry.region.length));
+        accepted.push_back(entry);
+    }
+
+    #if !(PAGING && USERFAULTFD)
+    server->register_memory_many(conn_id, regions, false);
+    #endif
+    if (server->send_accept_batch(conn_id, accepted.data(), accepted.size()) != 0) {
+        for (const rdma_batch_entry& entry : accepted) {
+            this->deallocate(entry.application_id);
+        }
+        return 0;
+    }
+    return accepted.size();
+}
+#else
+inline
+int RDMAMemoryManager::accept_many(const std::vector<rdma_batch_entry>& entries, int source) {
+    uintptr_t conn_id = this->coordinator.connections[source];
+    RDMAServerPrototype* server = this->coordinator.getServer(source, conn_id);
+    std::vector<rdma_batch_entry> accepted;
+    std::vector<std::pair<void*, size_t>> regions;
+    for (const rdma_batch_entry& entry : entries) {
+        void* mem = this->allocate(entry.region.addr, entry.region.length);
+        if (mem == nullptr) {
+            LogInfo("could not allocate %p for accept, sending reject", entry.region.addr);
+            server->send_decline(conn_id, entry.region.addr, entry.region.length);
+            continue;
+        }
+        this->UpdatePair(mem, source);
+        regions.push_back(std::make_pair(mem, entry.region.length));
+        accepted.push_back(entry);
+    }
+
+    #if !(PAGING && USERFAULTFD)
+    // with userfaultfd pages are read into the staging buffer, the segments themselves stay unpinned
+    server->register_memory_many(conn_id, regions, false);
+    #endif
+    server->send_accept_batch(conn_id, accepted.data(), accepted.size());
+    return accepted.size();
+}
+#endif
+
+inline
+int RDMAMemoryManager::PrepareMany(const std::vector<void*>& addresses, int destination) {
+    std::vector<RDMAMemory*> memories;
+    for (void* v_addr : addresses) {
+        RDMAMemory* memory = this->getRDMAMemory(v_addr);
+        if (memory == nullptr || memory->vaddr != v_addr) {
+            LogError("no segment starts at %p", v_addr);
+            return -1;
+        }
+        #if !FAULT_TOLERANT
+            LogAssert(memory->state == RDMAMemory::State::Clean, "memory not clean, please ensure all memory is local before moving it along");
+        #endif
+        memories.push_back(memory);
+    }
+
+    std::vector<rdma_batch_entry> entries;
+    std::vector<std::pair<void*, size_t>> regions;
+    for (RDMAMemory* memory : memories) {
+        this->UpdatePair(memory->vaddr, destination);
+        rdma_batch_entry entry;
+        memset(&entry, 0, sizeof(entry));
+        entry.region.addr = memory->vaddr;
+        entry.region.length = memory->size;
+        #if FAULT_TOLERANT
+            entry.application_id = memory->application_id;
+        #endif
+        entries.push_back(entry);
+        regions.push_back(std::make_pair(memory->vaddr, memory->size));
+    }
+
+    uintptr_t conn_id = this->coordinator.connections[destination];
+    RDMAServerPrototype* server = this->coordinator.getServer(destination, conn_id);
+    server->register_memory_many(conn_id, regions, true);
+    if (server->send_prepare_batch(conn_id, entries.data(), entries.size()) != 0)
+        return -1;
+    return entries.size();
+}
+
+inline
+int RDMAMemoryManager::TransferMany(const std::vector<void*>& addresses, int destination) {
+    std::vector<size_t> used;
+    for (void* v_addr : addresses) {
+        RDMAMemory* memory = this->getRDMAMemory(v_addr);
+        used.push_back(memory != nullptr ? memory->size : 0);
+    }
+    return this->TransferMany(addresses, destination, used);
+}
+
+inline
+int RDMAMemoryManager::TransferMany(const std::vector<void*>& addresses, int destination, const std::vector<size_t>& used) {
+    if (used.size() != addresses.size()) {
+        LogError("%zu used sizes for %zu segments", used.size(), addresses.size());
+        return -1;
+    }
+    std::vector<RDMAMemory*> memories;
+    for (size_t i=0; i<addresses.size(); i++) {
+        RDMAMemory* memory = this->getRDMAMemory(addresses[i]);
+        if (memory == nullptr || memory->vaddr != addresses[i]) {
+            LogError("no segment starts at %p", addresses[i]);
+            return -1;
+        }
+        LogAssert(used[i] <= memory->size, "used bytes past the end of the segment");
+        memories.push_back(memory);
+    }
+
+    std::vector<rdma_batch_entry> entries;
+    // taken before the send, once it is out the poller may close the migration and reset the handles
+    std::vector<std::shared_ptr<MigrationHandle>> handles;
+    for (size_t i=0; i<memories.size(); i++) {
+        RDMAMemory* memory = memories[i];
+        #if PAGING && DIRTY_TRACKING
+            // the last dirty pages have to go out with an empty pull list, which only Transfer sends
+            if (memory->pre_copied) {
+                if (this->Transfer(memory->vaddr, memory->size, destination, used[i]) != 0)
+                    return -1;
+                continue;
+            }
+        #endif
+        memory->owner = destination;
+        memory->state = RDMAMemory::State::Shared;
+        rdma_batch_entry entry;
+        memset(&entry, 0, sizeof(entry));
+        entry.region.addr = memory->vaddr;
+        entry.region.length = memory->size;
+        entry.used = used[i];
+        entry.page_size = this->TransferPageSize(memory);
+        entry.policy = memory->policy.encode();
+        entries.push_back(entry);
+        if (memory->handle)
+            handles.push_back(memory->handle);
+    }
+
+    uintptr_t conn_id = this->coordinator.connections[destination];
+    if (this->coordinator.getServer(destination, conn_id)->send_transfer_batch(conn_id, entries.data(), entries.size()) != 0)
+        return -1;
+    for (std::shared_ptr<MigrationHandle>& handle : handles) {
+        handle->advance(MigrationHandle::State::Transferred);
+    }
+    return memories.size();
+}
+
 inline
 int RDMAMemoryManager::Transfer(void* v_addr, size_t size, int destination){
+    return this->Transfer(v_addr, size, destination, size);
+}
+
+inline
+int RDMAMemoryManager::Transfer(void* v_addr, size_t size, int destination, size_t used){
+    LogAssert(used <= size, "used bytes past the end of the segment");
     RDMAMemory* rmemory = nullptr;
     #if FAULT_TOLERANT
         auto x = local_segments.find(v_addr);
@@ -408,14 +795,493 @@ int RDMAMemoryManager::Transfer(void* v_addr, size_t size, int destination){
         rmemory = x->second;
     #endif
 
+    // taken before the send, once it is out the poller may close the migration and reset the handle
+    std::shared_ptr<MigrationHandle> handle = rmemory->handle;
+    int result = this->transfer(rmemory, size, destination, used);
+    if (result == 0 && handle)
+        handle->advance(MigrationHandle::State::Transferred);
+    return result;
+}
+
+inline
+int RDMAMemoryManager::transfer(RDMAMemory* rmemory, size_t size, int destination, size_t used){
+    void* v_addr = rmemory->vaddr;
+    // restored if the transfer cannot go out
+    int owner = rmemory->owner;
+    RDMAMemory::State state = rmemory->state;
     rmemory->owner = destination;
     rmemory->state = RDMAMemory::State::Shared;
+    size_t page_size = this->TransferPageSize(rmemory);
+    // runs in the message count pages of the size the destination will use
+    size_t unit = page_size & ~RDMAMemory::AUTO_PAGE_SIZE;
+    // the pages written here are a delta against the generation the segment arrived with
+    uint64_t base = rmemory->generation;
+    if (rmemory->policy.delta)
+        rmemory->generation = fresh_generation();
+    #if PAGING && DIRTY_TRACKING
+        if (rmemory->pre_copied) {
+            // writers have stopped, the pages they dirtied since the last round are all that is left
+            rmemory->pre_copied = false;
+            if (this->PushDirty(v_addr) < 0)
+                return -1;
+            std::vector<PageExtent> nothing;
+            this->SendTransfer(destination, v_addr, size, used, page_size, &nothing, nullptr, nullptr, 0);
+            return 0;
+        }
+    #endif
+    // a segment sent again before it was closed drops what the last transfer staged
+    this->ReleaseStaging(rmemory, destination);
+    // whatever the destination reads, through runs or a coded image, is checked against the segment as it is now,
+    // without the table the destination would check nothing, so the segment stays here instead
+    if (rmemory->policy.checksums && this->ChecksumSegment(rmemory, used, unit, destination) != 0) {
+        LogError("segment %p is not transferred to %d, its checksums could not be staged", v_addr, destination);
+        rmemory->owner = owner;
+        rmemory->state = state;
+        rmemory->generation = base;
+        return -1;
+    }
+    // a paged segment is read page by page from where it lies, only a copy can go coded
+    if (rmemory->policy.coded && !(PAGING && rmemory->policy.paging)) {
+        CodedImage image;
+        if (this->CompressSegment(rmemory, used, destination, &image) == 0) {
+            std::vector<PageExtent> nothing;
+            this->SendTransfer(destination, v_addr, size, used, page_size, &nothing, &nothing, &image, 0);
+            return 0;
+        }
+    }
+    std::vector<PageExtent> pull;
+    bool elided = rmemory->policy.delta && base != 0 && this->DirtyExtents(rmemory, used, unit, pull) == 0;
+    if (!elided)
+        base = 0;
+    #if ZERO_PAGE_ELISION
+        if (!elided)
+            elided = this->TouchedExtents(v_addr, used, unit, pull) == 0;
+    #endif
+    #if HOT_PAGE_PUSH
+        if (!elided) {
+            PageExtent all = {0, (uint32_t)((used + unit - 1) / unit)};
+            pull.assign(1, all);
+        }
+        std::vector<PageExtent> hot;
+        if (this->PushHotPages(rmemory, used, unit, pull, hot, destination) < 0)
+            return -1;
+        FitExtents(hot, MAX_TRANSFER_EXTENTS / 4);
+        FitExtents(pull, MAX_TRANSFER_EXTENTS - hot.size());
+        this->SendTransfer(destination, v_addr, size, used, page_size, &pull, &hot, nullptr, base);
+        return 0;
+    #endif
+    if (elided) {
+        FitExtents(pull, MAX_TRANSFER_EXTENTS);
+        this->SendTransfer(destination, v_addr, size, used, page_size, &pull, nullptr, nullptr, base);
+        return 0;
+    }
+    this->SendTransfer(destination, v_addr, size, used, page_size, nullptr, nullptr, nullptr, 0);
+    return 0;
+}
+
+/*
+    bumped whenever the header changes, 1 had the optional fields follow the build instead of the policy
+*/
+inline
+uint32_t RDMAMemoryManager::TransferLayout() {
+    const uint32_t VERSION = 2;
+    return VERSION;
+}
+
+inline
+void RDMAMemoryManager::SendTransfer(int destination, void* v_addr, size_t size, size_t used, size_t page_size,
+    const std::vector<PageExtent>* pull, const std::vector<PageExtent>* hot, const CodedImage* image, uint64_t base) {
+    char data[rdma_message::MAX_DATA_SIZE];
+    size_t data_size = 0;
+    memcpy(data, &used, sizeof(used));
+    data_size += sizeof(used);
+    memcpy(data + data_size, &page_size, sizeof(page_size));
+    data_size += sizeof(page_size);
+    RDMAMemory* memory = this->getRDMAMemory(v_addr);
+    MigrationPolicy policy = memory != nullptr ? memory->policy : MigrationPolicy::Default();
+    uint32_t bits = policy.encode();
+    memcpy(data + data_size, &bits, sizeof(bits));
+    data_size += sizeof(bits);
+    uint32_t layout = TransferLayout();
+    memcpy(data + data_size, &layout, sizeof(layout));
+    data_size += sizeof(layout);
+    if (policy.delta) {
+        TransferGeneration generation = {memory != nullptr ? memory->generation : 0, base};
+        memcpy(data + data_size, &generation, sizeof(generation));
+        data_size += sizeof(generation);
+    }
+    if (policy.checksums) {
+        ChecksumTable checksums = {nullptr, 0};
+        if (memory != nullptr && memory->checksum_table != nullptr) {
+            checksums.addr = memory->checksum_table;
+            checksums.unit = page_size & ~RDMAMemory::AUTO_PAGE_SIZE;
+        }
+        memcpy(data + data_size, &checksums, sizeof(checksums));
+        data_size += sizeof(checksums);
+    }
+
+    const std::vector<PageExtent>* lists[2] = {pull, hot};
+    for (int i=0; i<2 && lists[i] != nullptr; i++) {
+        uint32_t count = lists[i]->size();
+        memcpy(data + data_size, &count, sizeof(count));
+        data_size += sizeof(count);
+        if (count > 0)
+            memcpy(data + data_size, lists[i]->data(), count * sizeof(PageExtent));
+        data_size += count * sizeof(PageExtent);
+    }
+    if (image != nullptr) {
+        LogAssert(pull != nullptr && hot != nullptr, "a coded image goes after both lists");
+        LogAssert(data_size + sizeof(CodedImage) <= rdma_message::MAX_DATA_SIZE, "no room for the coded image");
+        memcpy(data + data_size, image, sizeof(CodedImage));
+        data_size += sizeof(CodedImage);
+    }
+
     uintptr_t conn_id = this->coordinator.connections[destination];
-    this->coordinator.getServer(destination, conn_id)->send_transfer(conn_id, v_addr, size);
+    this->coordinator.getServer(destination, conn_id)->send_transfer(conn_id, v_addr, size, data, data_size);
+}
+
+/*
+    the staging area is mapped at the full used size, an image that would not come out smaller
+    than the segment is dropped half way, the pages it never reached were never touched
+*/
+inline
+int RDMAMemoryManager::CompressSegment(RDMAMemory* memory, size_t used, int destination, CodedImage* image) {
+    LogAssert(memory->staging == nullptr, "staging of %p was not released", memory->vaddr);
+    if (used < RunCodec::SAMPLE_BLOCK)
+        return -1;
+    double ratio = RunCodec::sample(memory->vaddr, used);
+    if (ratio * 100 > COMPRESSION_THRESHOLD) {
+        LogInfo("segment %p samples at %.3f of its size, sending it uncoded", memory->vaddr, ratio);
+        return -1;
+    }
+
+    void* staging = mmap(NULL, used, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (staging == MAP_FAILED) {
+        LogError("could not map %zu bytes of staging for %p because %s", used, memory->vaddr, strerror(errno));
+        return -1;
+    }
+    size_t coded = RunCodec::encode(memory->vaddr, used, staging, used);
+    if (coded == RunCodec::NO_FIT) {
+        LogInfo("segment %p does not code below its size, sending it uncoded", memory->vaddr);
+        munmap(staging, used);
+        return -1;
+    }
+
+    // the meminfo goes out ahead of the transfer on the same connection, so the rkey is there first
+    uintptr_t conn_id = this->coordinator.connections[destination];
+    this->coordinator.getServer(destination, conn_id)->register_memory(conn_id, staging, coded, true);
+    memory->staging = staging;
+    memory->staging_size = used;
+    image->addr = staging;
+    image->bytes = coded;
+    LogInfo("segment %p coded from %zu to %zu bytes", memory->vaddr, used, coded);
+    return 0;
+}
 
+inline
+int RDMAMemoryManager::PullCompressed(void* v_addr, size_t used, int source, const CodedImage& image) {
+    void* buffer = mmap(NULL, image.bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (buffer == MAP_FAILED) {
+        LogError("could not map %lu bytes for the image of %p because %s", (unsigned long)image.bytes, v_addr, strerror(errno));
+        return -1;
+    }
+    uintptr_t conn_id = this->coordinator.connections[source];
+    RDMAServerPrototype* server = this->coordinator.getServer(source, conn_id);
+    server->register_memory(conn_id, buffer, image.bytes, false);
+
+    this->pulled_bytes.fetch_add(image.bytes, std::memory_order_relaxed);
+    int result = server->rdma_read(conn_id, buffer, image.addr, image.bytes);
+    if (result == 0 && !RunCodec::decode(buffer, image.bytes, v_addr, used)) {
+        LogError("coded image of %p does not expand to %zu bytes", v_addr, used);
+        result = -1;
+    }
+
+    server->deregister_memory(conn_id, buffer);
+    munmap(buffer, image.bytes);
+    return result;
+}
+
+inline
+int RDMAMemoryManager::ChecksumSegment(RDMAMemory* memory, size_t used, size_t unit, int destination) {
+    LogAssert(memory->checksum_table == nullptr, "checksums of %p were not released", memory->vaddr);
+    // nothing is read, so there is nothing to check
+    if (used == 0)
+        return 0;
+    if (unit == 0)
+        return -1;
+    size_t bytes = PageChecksums::entries(used, unit) * sizeof(uint32_t);
+    void* table = mmap(NULL, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (table == MAP_FAILED) {
+        LogError("could not map %zu bytes of checksums for %p because %s", bytes, memory->vaddr, strerror(errno));
+        return -1;
+    }
+    int64_t start = LatencyHistogram::now();
+    PageChecksums::compute(memory->vaddr, used, unit, (uint32_t*)table);
+    LogInfo("checksummed %zu bytes of %p in %ld us", used, memory->vaddr, (long)((LatencyHistogram::now() - start) / 1000));
+
+    // like a coded image, the meminfo is ahead of the transfer that points at the table
+    uintptr_t conn_id = this->coordinator.connections[destination];
+    this->coordinator.getServer(destination, conn_id)->register_memory(conn_id, table, bytes, true);
+    memory->checksum_table = table;
+    memory->checksum_table_size = bytes;
+    return 0;
+}
+
+inline
+int RDMAMemoryManager::PullChecksums(RDMAMemory* segment, size_t used, int source, const ChecksumTable& table) {
+    std::vector<uint32_t> checksums(PageChecksums::entries(used, table.unit));
+    size_t bytes = checksums.size() * sizeof(uint32_t);
+    uintptr_t conn_id = this->coordinator.connections[source];
+    RDMAServerPrototype* server = this->coordinator.getServer(source, conn_id);
+    server->register_memory(conn_id, checksums.data(), bytes, false);
+
+    this->pulled_bytes.fetch_add(bytes, std::memory_order_relaxed);
+    int result = server->rdma_read(conn_id, checksums.data(), table.addr, bytes);
+    server->deregister_memory(conn_id, checksums.data());
+    if (result != 0) {
+        LogError("could not read the checksums of %p, its pages go unchecked", segment->vaddr);
+        return -1;
+    }
+    segment->checksums.load(segment->vaddr, used, table.unit, checksums);
+    return 0;
+}
+
+inline
+void RDMAMemoryManager::ReleaseStaging(RDMAMemory* memory, int pair) {
+    if (memory->checksum_table != nullptr) {
+        this->deregister_memory(memory->checksum_table, memory->checksum_table_size, pair);
+        munmap(memory->checksum_table, memory->checksum_table_size);
+        memory->checksum_table = nullptr;
+        memory->checksum_table_size = 0;
+    }
+    if (memory->staging == nullptr)
+        return;
+    this->deregister_memory(memory->staging, memory->staging_size, pair);
+    munmap(memory->staging, memory->staging_size);
+    memory->staging = nullptr;
+    memory->staging_size = 0;
+}
+
+/*
+    pagemap has one 64 bit entry per system page, bit 63 is set while the page is present and
+    bit 62 while it is swapped out, an anonymous page that has neither was never touched
+    (a page that was only read maps the zero page and counts as touched, which is safe)
+*/
+inline
+int RDMAMemoryManager::TouchedExtents(void* v_addr, size_t used, size_t page_size, std::vector<PageExtent>& extents) {
+    const uint64_t PAGEMAP_PRESENT = (uint64_t)1 << 63;
+    const uint64_t PAGEMAP_SWAPPED = (uint64_t)1 << 62;
+    const size_t CHUNK = 512;
+
+    extents.clear();
+    int fd = open("/proc/self/pagemap", O_RDONLY);
+    if (fd < 0) {
+        LogError("could not open pagemap because %s", strerror(errno));
+        return -1;
+    }
+
+    size_t system_page = sysconf(_SC_PAGESIZE);
+    size_t blocks_per_page = page_size / system_page;
+    size_t num_blocks = (used + system_page - 1) / system_page;
+    uint64_t first_entry = (uintptr_t)v_addr / system_page;
+    uint64_t entries[CHUNK];
+
+    for (size_t done = 0; done < num_blocks; done += CHUNK) {
+        size_t n = std::min(CHUNK, num_blocks - done);
+        ssize_t bytes = pread(fd, entries, n * sizeof(uint64_t), (first_entry + done) * sizeof(uint64_t));
+        if (bytes != (ssize_t)(n * sizeof(uint64_t))) {
+            LogError("short read from pagemap at %p", (char*)v_addr + done * system_page);
+            ::close(fd);
+            return -1;
+        }
+        for (size_t i = 0; i < n; i++) {
+            if ((entries[i] & (PAGEMAP_PRESENT | PAGEMAP_SWAPPED)) == 0)
+                continue;
+            uint32_t page = (done + i) / blocks_per_page;
+            if (!extents.empty() && extents.back().first + extents.back().count > page)
+                continue;
+            if (!extents.empty() && extents.back().first + extents.back().count == page) {
+                extents.back().count++;
+            } else {
+                PageExtent extent = {page, 1};
+                extents.push_back(extent);
+            }
+        }
+    }
+    ::close(fd);
     return 0;
 }
 
+/*
+    merging a gap only sends pages that did not need to go, so the widest gaps are the ones kept
+*/
+inline
+void RDMAMemoryManager::FitExtents(std::vector<PageExtent>& extents, size_t max_extents) {
+    if (extents.size() <= max_extents)
+        return;
+    if (max_extents == 0) {
+        extents.clear();
+        return;
+    }
+    if (max_extents == 1) {
+        extents[0].count = extents.back().first + extents.back().count - extents[0].first;
+        extents.resize(1);
+        return;
+    }
+
+    // keep the max_extents - 1 widest gaps, every other gap is merged into its runs
+    std::vector<uint32_t> gaps;
+    for (size_t i = 1; i < extents.size(); i++) {
+        gaps.push_back(extents[i].first - (extents[i - 1].first + extents[i - 1].count));
+    }
+    size_t keep = max_extents - 1;
+    std::nth_element(gaps.begin(), gaps.begin() + (keep - 1), gaps.end(), std::greater<uint32_t>());
+    uint32_t narrowest = gaps[keep - 1];
+    for (uint32_t gap : gaps) {
+        if (gap > narrowest)
+            keep--;
+    }
+
+    std::vector<PageExtent> merged;
+    merged.push_back(extents[0]);
+    for (size_t i = 1; i < extents.size(); i++) {
+        PageExtent& last = merged.back();
+        uint32_t gap = extents[i].first - (last.first + last.count);
+        if (gap > narrowest || (gap == narrowest && keep > 0)) {
+            if (gap == narrowest)
+                keep--;
+            merged.push_back(extents[i]);
+        } else {
+            last.count = extents[i].first + extents[i].count - last.first;
+        }
+    }
+    extents.swap(merged);
+}
+
+inline
+void RDMAMemoryManager::ExtentsFromBits(const std::vector<bool>& bits, std::vector<PageExtent>& extents) {
+    extents.clear();
+    for (uint32_t page = 0; page < bits.size(); page++) {
+        if (!bits[page])
+            continue;
+        if (!extents.empty() && extents.back().first + extents.back().count == page) {
+            extents.back().count++;
+        } else {
+            PageExtent extent = {page, 1};
+            extents.push_back(extent);
+        }
+    }
+}
+
+/*
+    a page of the segment's own size that was written marks every page of unit it overlaps
+*/
+inline
+int RDMAMemoryManager::DirtyExtents(RDMAMemory* memory, size_t used, size_t unit, std::vector<PageExtent>& extents) {
+    extents.clear();
+    #if PAGING && DIRTY_TRACKING
+        if (memory->generation == 0 || !memory->faults_measured || !memory->policy.paging)
+            return -1;
+        Pages& pages = memory->pages;
+        uint32_t num_units = (used + unit - 1) / unit;
+        for (int page = pages.find_next(0, PageState::Dirty); page < pages.num_pages; page = pages.find_next(page + 1, PageState::Dirty)) {
+            size_t start = (uintptr_t)pages.getPageAddress(page) - (uintptr_t)memory->vaddr;
+            size_t end = start + pages.getPageSize(page);
+            uint32_t first = start / unit;
+            uint32_t last = std::min((uint32_t)((end + unit - 1) / unit), num_units);
+            if (!extents.empty() && extents.back().first + extents.back().count > first)
+                first = extents.back().first + extents.back().count;
+            if (first >= last)
+                continue;
+            if (!extents.empty() && extents.back().first + extents.back().count == first) {
+                extents.back().count += last - first;
+            } else {
+                PageExtent extent = {first, last - first};
+                extents.push_back(extent);
+            }
+        }
+        return 0;
+    #else
+        return -1;
+    #endif
+}
+
+/*
+    the log counts pages of the segment's own size, a hot page of a larger unit is pushed whole
+*/
+inline
+int RDMAMemoryManager::PushHotPages(RDMAMemory* memory, size_t used, size_t unit, std::vector<PageExtent>& pull,
+    std::vector<PageExtent>& hot, int destination) {
+    hot.clear();
+    std::vector<int> accessed;
+    memory->accesses.snapshot(accessed);
+    memory->accesses.clear();
+    uint32_t num_units = (used + unit - 1) / unit;
+    if (accessed.empty() || num_units == 0)
+        return 0;
+
+    std::vector<bool> remote(num_units, false);
+    for (const PageExtent& extent : pull) {
+        for (uint32_t page = extent.first; page < extent.first + extent.count && page < num_units; page++) {
+            remote[page] = true;
+        }
+    }
+    std::vector<bool> pushed(num_units, false);
+    size_t logged = memory->pages.getPageSize();
+    for (int page : accessed) {
+        uint64_t first = (uint64_t)page * logged / unit;
+        uint64_t last = ((uint64_t)(page + 1) * logged - 1) / unit;
+        for (uint64_t target = first; target <= last && target < num_units; target++) {
+            if (remote[target]) {
+                remote[target] = false;
+                pushed[target] = true;
+            }
+        }
+    }
+    ExtentsFromBits(pushed, hot);
+    ExtentsFromBits(remote, pull);
+
+    int pages = 0;
+    for (const PageExtent& extent : hot) {
+        size_t offset = (size_t)extent.first * unit;
+        size_t bytes = std::min((size_t)extent.count * unit, used - offset);
+        int64_t start = LatencyHistogram::now();
+        if (this->Push((char*)memory->vaddr + offset, bytes, destination) != 0) {
+            LogError("could not push %zu hot bytes at %p", bytes, (char*)memory->vaddr + offset);
+            return -1;
+        }
+        memory->stats.pushes.record(LatencyHistogram::now() - start);
+        pages += extent.count;
+    }
+    LogInfo("pushed %d hot pages of segment %p ahead of the transfer", pages, memory->vaddr);
+    return pages;
+}
+
+/*
+    a segment that was demand faulted on most of its pages moves whole anyway and is better served
+    by fewer, larger reads, one that was barely touched wastes most of every large page it pulls
+    the band in between keeps the size, so one hop at a new size does not flip it straight back
+*/
+inline
+size_t RDMAMemoryManager::TransferPageSize(RDMAMemory* memory) {
+    size_t page_size = memory->pages.getPageSize();
+    if (!memory->auto_page_size)
+        return page_size;
+    if (memory->faults_measured && memory->pages.num_pages > 0) {
+        double density = (double)memory->demand_faults.load() / memory->pages.num_pages;
+        if (density >= 0.5)
+            page_size *= 4;
+        else if (density < 1.0 / 16)
+            page_size /= 4;
+        if (page_size > Pages::MAX_PAGE_SIZE)
+            page_size = Pages::MAX_PAGE_SIZE;
+        if (page_size < Pages::MIN_PAGE_SIZE)
+            page_size = Pages::MIN_PAGE_SIZE;
+        LogInfo("segment %p faulted on %.3f of its pages, next page size %zu", memory->vaddr, density, page_size);
+    }
+    return page_size | RDMAMemory::AUTO_PAGE_SIZE;
+}
+
 
 inline
 int RDMAMemoryManager::transfer(void* v_addr, size_t size, int destination){
@@ -431,49 +1297,206 @@ int RDMAMemoryManager::transfer(void* v_addr, size_t size, int destination){
     return 0;
 }
 
+/*
+    only [v_addr, v_addr + used) is fetched, the tail of the segment was freshly mapped
+    at accept and already reads as zeros, so it is treated as local from the start
+    the same holds for every page the source never touched, only the touched runs are protected
+    the segment is cut into the sender's page size before anything is protected
+*/
 inline
-void RDMAMemoryManager::on_transfer(void* v_addr, size_t size, int source) {
+int RDMAMemoryManager::on_transfer(void* v_addr, size_t size, int source, size_t used, size_t page_size,
+    const MigrationPolicy* policy, const std::vector<PageExtent>* touched, const std::vector<PageExtent>* hot,
+    const CodedImage* image, const TransferGeneration* generation, const ChecksumTable* checksums) {
     // updateState(v_addr, RDMAMemory::State::Shared);
+    // the runs are counted in the sender's page size
+    size_t extent_unit = page_size & ~RDMAMemory::AUTO_PAGE_SIZE;
+    RDMAMemory* segment = this->getRDMAMemory(v_addr);
+    LogAssert(segment != nullptr, "could not find memory in allocated list");
+    if (policy != nullptr)
+        segment->policy = *policy;
+    // the runs are only a delta against the very copy they were taken against
+    uint64_t kept = segment->retained_generation;
+    bool delta = generation != nullptr && generation->base != 0 && generation->base == kept;
+    if (kept != 0 && !delta) {
+        LogInfo("copy of %p kept here is not the base of the transfer, reading it whole", v_addr);
+        touched = nullptr;
+        if (used < size)
+            memset((char*)v_addr + used, 0, size - used);
+    } else if (!delta && generation != nullptr && generation->base != 0) {
+        touched = nullptr;
+    }
+    if (delta && touched != nullptr)
+        LogInfo("segment %p came back, reading %zu runs written since it left", v_addr, touched->size());
+    segment->retained_generation = 0;
+    segment->generation = generation != nullptr ? generation->generation : 0;
+    // in place before any page is pulled, faults check against it from the first one
+    if (segment->policy.checksums && checksums == nullptr && used > 0)
+        LogError("transfer of %p from %d came without its checksums, its pages go unchecked", v_addr, source);
+    if (checksums == nullptr || this->PullChecksums(segment, used, source, *checksums) != 0)
+        segment->checksums.clear();
     #if PAGING
-        if(mprotect(v_addr, size, PROT_NONE)  != 0) {
+    if (segment->policy.paging) {
+        if (page_size != 0) {
+            segment->auto_page_size = (page_size & RDMAMemory::AUTO_PAGE_SIZE) != 0;
+            page_size &= ~RDMAMemory::AUTO_PAGE_SIZE;
+            if (!segment->pages.setPageSize(page_size))
+                LogError("keeping page size %zu for segment %p", segment->pages.getPageSize(), v_addr);
+        }
+        segment->demand_faults.store(0);
+        segment->faults_measured = true;
+        page_size = segment->pages.getPageSize();
+        if (segment->checksums.active() && page_size % segment->checksums.getUnit() != 0) {
+            LogError("pages of %zu bytes do not cover checksums of %zu bytes, pages of %p go unchecked",
+                page_size, segment->checksums.getUnit(), v_addr);
+            segment->checksums.clear();
+        }
+        // the pages the source used last are likely the next ones used here
+        segment->accesses.clear();
+        if (hot != nullptr && extent_unit == page_size) {
+            for (const PageExtent& extent : *hot) {
+                for (uint32_t page = extent.first; page < extent.first + extent.count; page++) {
+                    segment->accesses.record(page);
+                }
+            }
+        }
+        size_t remote_bytes = (used + page_size - 1) & ~(page_size - 1);
+        if (remote_bytes > size)
+            remote_bytes = size;
+        uint32_t remote_pages = (remote_bytes + page_size - 1) / page_size;
+
+        std::vector<PageExtent> everything;
+        if (touched == nullptr || extent_unit != page_size) {
+            PageExtent all = {0, remote_pages};
+            everything.push_back(all);
+            touched = &everything;
+        }
+
+        #if !USERFAULTFD && DIRTY_TRACKING
+        // local pages are read only until written, the touched runs are closed off below
+        if(mprotect(v_addr, size, PROT_READ) != 0) {
             LogError("Mprotect failed");
             exit(errno);
         }
-        UpdateState(v_addr, RDMAMemory::State::Shared);
-
-        #if PREFETCHING
-            RDMAMemory* rmemory = nullptr;
-            #if FAULT_TOLERANT
-            auto x = local_segments.find(v_addr);
-            LogAssert(x != local_segments.end(), "could not find memory in allocated list");
-            rmemory = x->second;
+        #endif
+        // pages before a run and past the last one are zero on both sides
+        int id = 0;
+        for (const PageExtent& extent : *touched) {
+            if (extent.first >= remote_pages)
+                break;
+            uint32_t count = std::min(extent.count, remote_pages - extent.first);
+            void* start = (char*)v_addr + (size_t)extent.first * page_size;
+            size_t bytes = std::min((size_t)count * page_size, size - (size_t)extent.first * page_size);
+
+            #if USERFAULTFD
+            struct uffdio_register reg;
+            reg.range.start = (uintptr_t)start;
+            reg.range.len = bytes;
+            reg.mode = UFFDIO_REGISTER_MODE_MISSING;
+            if (ioctl(this->uffd, UFFDIO_REGISTER, &reg) != 0) {
+                LogError("userfaultfd register failed because %s", strerror(errno));
+                exit(errno);
+            }
             #else
-            auto x = memory_map.find(v_addr);
-            LogAssert(x != memory_map.end(), "could not find memory in allocated list");
-            rmemory = x->second; 
+            if(mprotect(start, bytes, PROT_NONE) != 0) {
+                LogError("Mprotect failed");
+                exit(errno);
+            }
             #endif
-            
+            for (; id < (int)extent.first; id++) {
+                segment->pages.setPageState(id, PageState::Local);
+            }
+            id = extent.first + count;
+        }
+        for (; id < segment->pages.num_pages; id++) {
+            segment->pages.setPageState(id, PageState::Local);
+        }
+        UpdateState(v_addr, RDMAMemory::State::Shared);
+
+        if (segment->policy.prefetch) {
             // std::thread(&RDMAMemoryManager::poller_thread_method, this).detach();
-            #if ASYNC_PREFETCHING
-                std::thread(&RDMAMemoryManager::PullAllPagesWithoutCloseAsync, this, rmemory).detach();
-            #else
-                std::thread(&RDMAMemoryManager::PullAllPagesWithoutClose, this, rmemory).detach();
-            #endif
-        #endif
+            std::thread(&RDMAMemoryManager::prefetch_thread_method, this, segment).detach();
+        }
+        return 0;
+    }
+    #endif
 
+    #if PAGING && USERFAULTFD
+        // accept left the segment to the userfaultfd pager, a copy reads straight into it
+        uintptr_t conn_id = this->coordinator.connections[source];
+        this->coordinator.getServer(source, conn_id)->register_memory(conn_id, v_addr, size, false);
+    #endif
+    // timer.start();
+    // the source keeps the segment registered as it was, an image that did not arrive whole falls back to reading
+    // all of [0, used), the lists that came with it are empty
+    int result = 0;
+    #if PAGING && USERFAULTFD
+        // expanding would write into pages the pager owns, the fallback reads the segment uncoded
+        bool expanded = false;
     #else
-        // timer.start();
-        this->Pull(v_addr, size, source);
-        UpdateState(v_addr, RDMAMemory::State::Clean);
-        // timer.stop();
+        bool expanded = image != nullptr && this->PullCompressed(v_addr, used, source, *image) == 0;
     #endif
+    if (expanded) {
+        // [0, used) is already in place
+    } else if (touched == nullptr || extent_unit == 0 || image != nullptr) {
+        if (used > 0)
+            result = this->Pull(v_addr, used, source);
+    } else {
+        for (const PageExtent& extent : *touched) {
+            size_t offset = (size_t)extent.first * extent_unit;
+            if (offset >= used)
+                break;
+            result = this->Pull((char*)v_addr + offset, std::min((size_t)extent.count * extent_unit, used - offset), source);
+            if (result != 0)
+                break;
+        }
+    }
+    // pages that were not read are the copy kept here or zero, only check what arrived
+    if (result == 0 && segment->checksums.active()) {
+        size_t unit = segment->checksums.getUnit();
+        std::vector<PageExtent> everything;
+        if (image != nullptr || touched == nullptr || extent_unit != unit) {
+            PageExtent all = {0, (uint32_t)PageChecksums::entries(used, unit)};
+            everything.push_back(all);
+            touched = &everything;
+        }
+        for (const PageExtent& extent : *touched) {
+            for (uint32_t page = extent.first; result == 0 && page < extent.first + extent.count && (size_t)page * unit < used; page++) {
+                result = this->VerifyPulled(segment, (char*)v_addr + (size_t)page * unit, unit, true);
+            }
+        }
+    }
+    segment->checksums.clear();
+    if (result != 0) {
+        // the data is not what the source sent, the segment must not be used
+        LogError("segment %p could not be read intact from %d", v_addr, source);
+        UpdateState(v_addr, RDMAMemory::State::Invalid);
+        return -1;
+    }
+    UpdateState(v_addr, RDMAMemory::State::Clean);
+    // timer.stop();
+    return 0;
 }
 
 inline
 void RDMAMemoryManager::close(void* v_addr, size_t size, int source) {
-    
     #if PAGING
-        if(mprotect(v_addr, size, PROT_READ | PROT_WRITE)  != 0) {
+        RDMAMemory* mem = this->getRDMAMemory(v_addr);
+        LogAssert(mem != nullptr, "could not find RDMA memory at specified location");
+        // a copied segment was read whole by the transfer and has nothing protected
+        bool paged = mem != nullptr && mem->policy.paging;
+    #endif
+
+    #if PAGING && USERFAULTFD
+        if (paged) {
+            struct uffdio_range range;
+            range.start = (uintptr_t)v_addr;
+            range.len = size;
+            if (ioctl(this->uffd, UFFDIO_UNREGISTER, &range) != 0) {
+                LogError("userfaultfd unregister failed because %s", strerror(errno));
+            }
+        }
+    #elif PAGING
+        if(paged && mprotect(v_addr, size, PROT_READ | PROT_WRITE)  != 0) {
             LogError("Mprotect failed");
             exit(errno);
         }
@@ -484,18 +1507,21 @@ void RDMAMemoryManager::close(void* v_addr, size_t size, int source) {
         this->coordinator.cleanMemorySegment(app_id);
     #endif
 
-    #if PREFETCHING && !FAULT_TOLERANT
-        auto x = this->memory_map.find(v_addr);
-        LogAssert(x != memory_map.end(), "could not find RDMA memory at specified location");
-        
-        RDMAMemory* mem = x->second;
-        this->PullAllPagesWithoutClose(mem);
+    #if PAGING
+        // a segment that failed keeps its source, it is not closed
+        if (paged && mem->policy.prefetch && this->PullAllPagesWithoutClose(mem) != 0) {
+            LogError("could not pull all pages of %p, it is not closed", v_addr);
+            return;
+        }
     #endif
 
     UpdateState(v_addr, RDMAMemory::State::Clean);
 
     uintptr_t conn_id = this->coordinator.connections[source];
     this->coordinator.getServer(source, conn_id)->send_close(conn_id, v_addr, size);
+    #if PAGING && USERFAULTFD
+    if (!paged)
+    #endif
     this->deregister_memory(v_addr, size, source);
 }
 
@@ -514,6 +1540,7 @@ inline
 int RDMAMemoryManager::PullAsync(void* v_addr, size_t size, int source, void (*callback)(void*), void* data){
     uintptr_t conn_id = this->coordinator.connections[source];
     LogInfo("pulling memory at %p of size %zu", v_addr, size);
+    this->pulled_bytes.fetch_add(size, std::memory_order_relaxed);
     this->coordinator.getServer(source, conn_id)->rdma_read_async(conn_id, v_addr, v_addr, size, callback, data);
     return 0;
 }
@@ -527,33 +1554,254 @@ int RDMAMemoryManager::Pull(void* v_addr, size_t size, int source){
 
     uintptr_t conn_id = this->coordinator.connections[source];
     LogInfo("pulling memory at %p of size %zu", v_addr, size);
+    this->pulled_bytes.fetch_add(size, std::memory_order_relaxed);
     return this->coordinator.getServer(source, conn_id)->rdma_read(conn_id, v_addr, v_addr, size);
 }
 
 inline
-int RDMAMemoryManager::push(void* v_addr, int destination){
+int RDMAMemoryManager::push(void* v_addr, int destination){
+    uintptr_t conn_id = this->coordinator.connections[destination];
+    this->coordinator.getServer(destination, conn_id)->rdma_write(conn_id, v_addr, v_addr, this->memory_map.find(v_addr)->second->size);
+    return 0;
+}
+
+inline
+int RDMAMemoryManager::Push(void* v_addr, size_t size, int destination){
+    uintptr_t conn_id = this->coordinator.connections[destination];
+    this->pushed_bytes.fetch_add(size, std::memory_order_relaxed);
+    return this->coordinator.getServer(destination, conn_id)->rdma_write(conn_id, v_addr, v_addr, size);
+}
+
+inline
+int RDMAMemoryManager::PushDirty(void* v_addr){
+    #if PAGING && DIRTY_TRACKING
+        RDMAMemory* memory = this->getRDMAMemory(v_addr);
+        if (memory == nullptr) {
+            LogError("no segment at %p to push", v_addr);
+            return -1;
+        }
+        Pages& pages = memory->pages;
+        int pushed = 0;
+        int id = pages.find_next(0, PageState::Dirty);
+        while (id < pages.num_pages) {
+            // claim the run, a writer that faults on it now waits until it is read only again
+            int end = id;
+            while (end < pages.num_pages && pages.setPageStateCAS(pages.getPageAddress(end), PageState::Dirty, PageState::InFlight)) {
+                end++;
+            }
+            if (end == id) {
+                id = pages.find_next(id + 1, PageState::Dirty);
+                continue;
+            }
+
+            void* first = pages.getPageAddress(id);
+            size_t bytes = (uintptr_t)pages.getPageAddress(end - 1) + pages.getPageSize(end - 1) - (uintptr_t)first;
+            // read only before the copy goes out, any later write dirties the page again
+            if(mprotect(first, bytes, PROT_READ)) {
+                perror("couldnt mprotect dirty pages");
+                exit(errno);
+            }
+            for (int page = id; page < end; page++) {
+                pages.setPageState(page, PageState::Local);
+            }
+
+            int64_t start = LatencyHistogram::now();
+            int res = this->Push(first, bytes, memory->pair);
+            memory->stats.pushes.record(LatencyHistogram::now() - start);
+            if (res != 0) {
+                LogError("could not write back %zu bytes at %p", bytes, first);
+                // keep them dirty, unless a writer got there first they become writable again
+                for (int page = id; page < end; page++) {
+                    void* address = pages.getPageAddress(page);
+                    if (pages.setPageStateCAS(address, PageState::Local, PageState::InFlight)) {
+                        mprotect(address, pages.getPageSize(page), PROT_READ | PROT_WRITE);
+                        pages.setPageState(page, PageState::Dirty);
+                    }
+                }
+                return -1;
+            }
+            pushed += end - id;
+            id = pages.find_next(end, PageState::Dirty);
+        }
+        return pushed;
+    #else
+        LogError("PushDirty needs PAGING and DIRTY_TRACKING");
+        return -1;
+    #endif
+}
+
+/*
+    the source pages are tracked the way a migrated segment is under DIRTY_TRACKING, a page is Dirty
+    and writable until PushDirty copies it out, then Local and read only until the next write
+    a touched page starts Dirty, an untouched one starts Local since the destination reads zeros there too
+*/
+inline
+int RDMAMemoryManager::PreCopy(void* v_addr, size_t size, int destination, uint64_t max_downtime_us, int max_rounds){
+    #if PAGING && DIRTY_TRACKING
+        RDMAMemory* memory = this->getRDMAMemory(v_addr);
+        if (memory == nullptr || memory->pair != destination) {
+            LogError("segment at %p was not prepared for %d", v_addr, destination);
+            return -1;
+        }
+        Pages& pages = memory->pages;
+        size_t page_size = pages.getPageSize();
+
+        std::vector<PageExtent> touched;
+        if (this->TouchedExtents(v_addr, size, page_size, touched) != 0) {
+            PageExtent all = {0, (uint32_t)pages.num_pages};
+            touched.assign(1, all);
+        }
+        if(mprotect(v_addr, size, PROT_READ)) {
+            perror("couldnt mprotect for pre-copy");
+            exit(errno);
+        }
+        int id = 0;
+        for (const PageExtent& extent : touched) {
+            for (; id < (int)extent.first; id++) {
+                pages.setPageState(id, PageState::Local);
+            }
+            void* first = pages.getPageAddress((int)extent.first);
+            size_t bytes = std::min((size_t)extent.count * page_size, size - (size_t)extent.first * page_size);
+            if(mprotect(first, bytes, PROT_READ | PROT_WRITE)) {
+                perror("couldnt mprotect for pre-copy");
+                exit(errno);
+            }
+            for (; id < (int)(extent.first + extent.count); id++) {
+                pages.setPageState(id, PageState::Dirty);
+            }
+        }
+        for (; id < pages.num_pages; id++) {
+            pages.setPageState(id, PageState::Local);
+        }
+        memory->pre_copied = true;
+        // the pages written since the segment arrived are no longer told apart
+        memory->generation = 0;
+
+        // bytes per microsecond of the last round that wrote anything
+        double rate = 0;
+        int round = 0;
+        while (round < max_rounds) {
+            auto start = std::chrono::steady_clock::now();
+            int pushed = this->PushDirty(v_addr);
+            uint64_t elapsed = std::chrono::duration_cast<std::chrono::microseconds>(
+                std::chrono::steady_clock::now() - start).count();
+            round++;
+            if (pushed < 0) {
+                memory->pre_copied = false;
+                return -1;
+            }
+            if (pushed > 0)
+                rate = (double)pushed * page_size / (elapsed > 0 ? elapsed : 1);
+
+            int dirty = 0;
+            for (int page = pages.find_next(0, PageState::Dirty); page < pages.num_pages; page = pages.find_next(page + 1, PageState::Dirty)) {
+                dirty++;
+            }
+            LogInfo("pre-copy round %d wrote %d pages in %lu us, %d dirty again", round, pushed, (unsigned long)elapsed, dirty);
+            if (dirty == 0 || (rate > 0 && dirty * page_size / rate <= max_downtime_us))
+                break;
+        }
+        return round;
+    #else
+        LogError("PreCopy needs PAGING and DIRTY_TRACKING");
+        return -1;
+    #endif
+}
+
+inline
+void RDMAMemoryManager::register_memory(void* v_addr, size_t size, int destination){
     uintptr_t conn_id = this->coordinator.connections[destination];
-    this->coordinator.getServer(destination, conn_id)->rdma_write(conn_id, v_addr, v_addr, this->memory_map.find(v_addr)->second->size);
-    return 0;
+    this->coordinator.getServer(destination, conn_id)->register_memory(conn_id, v_addr, size);
 }
 
 inline
-int RDMAMemoryManager::Push(void* v_addr, size_t size, int destination){
+void RDMAMemoryManager::deregister_memory(void* v_addr, size_t size, int destination){
     uintptr_t conn_id = this->coordinator.connections[destination];
-    this->coordinator.getServer(destination, conn_id)->rdma_write(conn_id, v_addr, v_addr, size);
-    return 0;
+    this->coordinator.getServer(destination, conn_id)->deregister_memory(conn_id, v_addr);
 }
 
+/*
+    a kept segment is protected so that a stray write cannot change the base of a later delta,
+    it is out of the segment index, so such a write faults like one to unmapped memory
+*/
 inline
-void RDMAMemoryManager::register_memory(void* v_addr, size_t size, int destination){
-    uintptr_t conn_id = this->coordinator.connections[destination];
-    this->coordinator.getServer(destination, conn_id)->register_memory(conn_id, v_addr, size);
+bool RDMAMemoryManager::retain(RDMAMemory* memory) {
+    if (memory->size > DELTA_RETAINED_BYTES)
+        return false;
+    if (mprotect(memory->vaddr, memory->size, PROT_NONE) != 0) {
+        LogError("could not protect the copy of %p because %s", memory->vaddr, strerror(errno));
+        return false;
+    }
+    segment_index.remove(memory->vaddr);
+
+    std::vector<RDMAMemory*> dropped;
+    {
+        std::lock_guard<std::mutex> guard(retained_mutex);
+        RetainedCopy copy = {memory, memory->generation, ++retained_sequence};
+        retained[memory->vaddr] = copy;
+        retained_order.push_back(std::make_pair(memory->vaddr, copy.sequence));
+        retained_bytes += memory->size;
+        while (retained_bytes > DELTA_RETAINED_BYTES && !retained_order.empty()) {
+            std::pair<void*, uint64_t> oldest = retained_order.front();
+            retained_order.pop_front();
+            auto it = retained.find(oldest.first);
+            if (it == retained.end() || it->second.sequence != oldest.second)
+                continue;
+            retained_bytes -= it->second.memory->size;
+            dropped.push_back(it->second.memory);
+            retained.erase(it);
+        }
+    }
+    for (RDMAMemory* old : dropped) {
+        this->release(old);
+    }
+    LogInfo("keeping segment %p of %zu bytes for its return", memory->vaddr, memory->size);
+    return true;
 }
 
 inline
-void RDMAMemoryManager::deregister_memory(void* v_addr, size_t size, int destination){
-    uintptr_t conn_id = this->coordinator.connections[destination];
-    this->coordinator.getServer(destination, conn_id)->deregister_memory(conn_id, v_addr);
+uint64_t RDMAMemoryManager::take_retained(void* v_addr, size_t size) {
+    RetainedCopy copy;
+    {
+        std::lock_guard<std::mutex> guard(retained_mutex);
+        auto it = retained.find(v_addr);
+        if (it == retained.end())
+            return 0;
+        copy = it->second;
+        retained_bytes -= copy.memory->size;
+        retained.erase(it);
+    }
+    if (copy.memory->size != size || mprotect(v_addr, size, PROT_READ | PROT_WRITE) != 0) {
+        LogError("copy of %p kept here does not fit a segment of %zu bytes", v_addr, size);
+        this->release(copy.memory);
+        return 0;
+    }
+    return copy.generation;
+}
+
+inline
+void RDMAMemoryManager::DropRetained() {
+    std::vector<RDMAMemory*> dropped;
+    {
+        std::lock_guard<std::mutex> guard(retained_mutex);
+        for (auto& it : retained) {
+            dropped.push_back(it.second.memory);
+        }
+        retained.clear();
+        retained_order.clear();
+        retained_bytes = 0;
+    }
+    for (RDMAMemory* memory : dropped) {
+        this->release(memory);
+    }
+}
+
+inline
+uint64_t RDMAMemoryManager::fresh_generation() {
+    static std::atomic<uint64_t> counter(0);
+    uint64_t now = (uint64_t)std::chrono::high_resolution_clock::now().time_since_epoch().count();
+    uint64_t generation = (now << 8) ^ counter.fetch_add(1);
+    return generation != 0 ? generation : 1;
 }
 
 inline
@@ -627,6 +1875,12 @@ RDMAMemoryManager::RDMAMessage::Type RDMAMemoryManager::getMessageType(rdma_mess
         return RDMAMessage::Type::GETPARTITIONS;
     } else if(type == rdma_message::MessageType::MSG_SENT_PARTITIONS) {
         return RDMAMessage::Type::SENTPARTITIONS;
+    } else if(type == rdma_message::MessageType::MSG_PREPARE_BATCH) {
+        return RDMAMessage::Type::PREPARE_BATCH;
+    } else if(type == rdma_message::MessageType::MSG_ACCEPT_BATCH) {
+        return RDMAMessage::Type::ACCEPT_BATCH;
+    } else if(type == rdma_message::MessageType::MSG_TRANSFER_BATCH) {
+        return RDMAMessage::Type::TRANSFER_BATCH;
     } else {
         return RDMAMessage::Type::DONE;
     }
@@ -638,7 +1892,84 @@ RDMAMemoryManager::RDMAMessage* RDMAMemoryManager::GetMessage(int source) {
     std::pair<void*, size_t> message = this->coordinator.getServer(source, conn_id)->receive(conn_id);
 
     struct rdma_message* msg = (struct rdma_message*) message.first;
-    return new RDMAMessage(msg->region_info.addr, msg->region_info.length, this->getMessageType(msg->message_type), msg->data);
+    RDMAMessage* result = new RDMAMessage(msg->region_info.addr, msg->region_info.length, this->getMessageType(msg->message_type), msg->data);
+    // data_size comes off the wire, a transfer that claims more than a message holds is not read at all
+    if (result->type == RDMAMessage::Type::TRANSFER && msg->data_size > (size_t)rdma_message::MAX_DATA_SIZE) {
+        LogError("transfer of %p from %d claims %zu bytes of data", result->addr, source, msg->data_size);
+        result->rejected = true;
+        return result;
+    }
+    // transfers carry the number of bytes in use and the page size, older senders ship the whole segment
+    if (result->type == RDMAMessage::Type::TRANSFER && msg->data_size >= sizeof(size_t)) {
+        memcpy(&result->used, msg->data, sizeof(size_t));
+    }
+    if (result->type == RDMAMessage::Type::TRANSFER && msg->data_size >= 2 * sizeof(size_t)) {
+        memcpy(&result->page_size, msg->data + sizeof(size_t), sizeof(size_t));
+    }
+    if (result->type == RDMAMessage::Type::TRANSFER && msg->data_size >= 2 * sizeof(size_t) + sizeof(uint32_t)) {
+        uint32_t policy = 0;
+        memcpy(&policy, msg->data + 2 * sizeof(size_t), sizeof(policy));
+        result->has_policy = true;
+        result->policy = MigrationPolicy::decode(policy);
+    }
+    if (result->type == RDMAMessage::Type::TRANSFER && msg->data_size > 2 * sizeof(size_t) + sizeof(uint32_t)) {
+        size_t offset = 2 * sizeof(size_t) + sizeof(uint32_t);
+        // the rest is laid out by the sender's build, one laid out otherwise is not read at all
+        uint32_t layout = 0;
+        if (msg->data_size >= offset + sizeof(layout))
+            memcpy(&layout, msg->data + offset, sizeof(layout));
+        offset += sizeof(layout);
+        if (layout != TransferLayout()) {
+            LogError("transfer of %p from %d is laid out as %#x, this build reads %#x", result->addr, source,
+                layout, TransferLayout());
+            result->rejected = true;
+            return result;
+        }
+        // the policy says which of the optional fields the sender put in
+        if (result->policy.delta) {
+            if (msg->data_size >= offset + sizeof(TransferGeneration)) {
+                memcpy(&result->generation, msg->data + offset, sizeof(TransferGeneration));
+                result->has_generation = true;
+            }
+            offset += sizeof(TransferGeneration);
+        }
+        if (result->policy.checksums) {
+            if (msg->data_size >= offset + sizeof(ChecksumTable)) {
+                memcpy(&result->checksums, msg->data + offset, sizeof(ChecksumTable));
+                result->has_checksums = result->checksums.unit != 0;
+            }
+            offset += sizeof(ChecksumTable);
+        }
+        bool* present[2] = {&result->has_touched, &result->has_hot};
+        std::vector<PageExtent>* lists[2] = {&result->touched, &result->hot};
+        for (int i=0; i<2 && msg->data_size >= offset + sizeof(uint32_t); i++) {
+            uint32_t count = 0;
+            memcpy(&count, msg->data + offset, sizeof(count));
+            offset += sizeof(count);
+            // offset is within data_size here, so this cannot wrap
+            if (count > (msg->data_size - offset) / sizeof(PageExtent)) {
+                LogError("transfer of %p from %d lists %u pages past the end of its message", result->addr, source, count);
+                result->rejected = true;
+                return result;
+            }
+            *present[i] = true;
+            lists[i]->resize(count);
+            if (count > 0)
+                memcpy(lists[i]->data(), msg->data + offset, count * sizeof(PageExtent));
+            offset += count * sizeof(PageExtent);
+        }
+        if (result->has_hot && msg->data_size >= offset + sizeof(CodedImage)) {
+            memcpy(&result->image, msg->data + offset, sizeof(CodedImage));
+            result->has_image = true;
+        }
+    }
+    if (result->type == RDMAMessage::Type::PREPARE_BATCH || result->type == RDMAMessage::Type::ACCEPT_BATCH
+        || result->type == RDMAMessage::Type::TRANSFER_BATCH) {
+        result->entries.resize(std::min(msg->data_size / sizeof(rdma_batch_entry), MAX_BATCH_ENTRIES));
+        if (!result->entries.empty())
+            memcpy(result->entries.data(), msg->data, result->entries.size() * sizeof(rdma_batch_entry));
+    }
+    return result;
 }
 
 inline
@@ -715,12 +2046,50 @@ void RDMAMemoryManager::on_close(void* addr, size_t size, int pair) {
         LogAssert(it != memory_map.end(), "memory not allocated");
     #endif
 
-    this->incoming_dones.enqueue(it->second);
+    RDMAMemory* memory = it->second;
+    this->ReleaseStaging(memory, pair);
+    if (memory->handle) {
+        // the migration is over, the segment lets go of its handle
+        std::shared_ptr<MigrationHandle> handle = memory->handle;
+        memory->handle.reset();
+        handle->advance(MigrationHandle::State::Closed);
+        return;
+    }
+    this->incoming_dones.enqueue(memory);
+}
+
+inline
+void RDMAMemoryManager::on_accept(RDMAMemory* memory) {
+    #if FAULT_TOLERANT
+        this->coordinator.updateSegmentDestination(memory->application_id, memory->pair);
+    #endif
+    if (memory->handle) {
+        memory->handle->advance(MigrationHandle::State::Accepted);
+        return;
+    }
+    this->incoming_accepts.enqueue(memory);
+}
+
+inline
+void RDMAMemoryManager::on_decline(void* addr, size_t size, int source) {
+    this->deregister_memory(addr, size, source);
+    RDMAMemory* memory = this->getRDMAMemory(addr);
+    if (memory != nullptr && memory->handle) {
+        std::shared_ptr<MigrationHandle> handle = memory->handle;
+        memory->handle.reset();
+        handle->advance(MigrationHandle::State::Declined);
+    }
 }
 
 inline
 void RDMAMemoryManager::poller_thread_method() {
+    this->PinThread();
     while(run) {
+        if (stats_requested) {
+            stats_requested = 0;
+            this->DumpStats(this->stats_path);
+        }
+
         int source = this->HasMessage();
         if(source == -1)
             continue;
@@ -742,18 +2111,24 @@ void RDMAMemoryManager::poller_thread_method() {
             #if FAULT_TOLERANT
                 std::unordered_map<void*, RDMAMemory*>::iterator it = this->local_segments.find(addr);
                 LogAssert(it != local_segments.end(), "memory not allocated");
-                int64_t client_id = it->second->application_id;
-                this->coordinator.updateSegmentDestination(client_id, it->second->pair);                
             #else
                 std::unordered_map<void*, RDMAMemory*>::iterator it = this->memory_map.find(addr);
                 LogAssert(it != memory_map.end(), "memory not allocated");            
             #endif
-            this->incoming_accepts.enqueue(it->second);
+            this->on_accept(it->second);
         } else if(message->type == RDMAMessage::Type::DECLINE) {
-            this->deregister_memory(addr, size, source);
+            this->on_decline(addr, size, source);
             //maybe add notification to top
         } else if(message->type == RDMAMessage::Type::TRANSFER) {
-            this->on_transfer(addr, size, source);
+            // a segment that failed still goes to the application, Invalid, so that nobody waits for it forever
+            if (message->rejected) {
+                this->UpdateState(addr, RDMAMemory::State::Invalid);
+            } else {
+                this->on_transfer(addr, size, source, message->used, message->page_size,
+                    message->has_policy ? &message->policy : nullptr, message->has_touched ? &message->touched : nullptr, message->has_hot ? &message->hot : nullptr,
+                    message->has_image ? &message->image : nullptr, message->has_generation ? &message->generation : nullptr,
+                    message->has_checksums ? &message->checksums : nullptr);
+            }
             #if FAULT_TOLERANT
                 std::unordered_map<void*, RDMAMemory*>::iterator it = this->local_segments.find(addr);
                 LogAssert(it != local_segments.end(), "memory not allocated");
@@ -763,6 +2138,23 @@ void RDMAMemoryManager::poller_thread_method() {
             #endif
 
             this->incoming_transfers.enqueue(it->second);
+        } else if(message->type == RDMAMessage::Type::PREPARE_BATCH) {
+            this->accept_many(message->entries, source);
+        } else if(message->type == RDMAMessage::Type::ACCEPT_BATCH) {
+            for (const rdma_batch_entry& entry : message->entries) {
+                RDMAMemory* memory = this->getRDMAMemory(entry.region.addr);
+                LogAssert(memory != nullptr, "memory not allocated");
+                this->on_accept(memory);
+            }
+        } else if(message->type == RDMAMessage::Type::TRANSFER_BATCH) {
+            for (const rdma_batch_entry& entry : message->entries) {
+                MigrationPolicy policy = MigrationPolicy::decode(entry.policy);
+                this->on_transfer(entry.region.addr, entry.region.length, source, entry.used, entry.page_size,
+                    &policy, nullptr, nullptr, nullptr, nullptr, nullptr);
+                RDMAMemory* memory = this->getRDMAMemory(entry.region.addr);
+                LogAssert(memory != nullptr, "memory not allocated");
+                this->incoming_transfers.enqueue(memory);
+            }
         } else if(message->type == RDMAMessage::Type::DONE) {
             this->on_close(addr, size, source);
         } else if(message->type == RDMAMessage::Type::GETPARTITIONS) {
@@ -808,11 +2200,26 @@ RDMAMemory* RDMAMemoryManager::PollForAccept() {
     return incoming_accepts.dequeue(); 
 }
 
+inline
+RDMAMemory* RDMAMemoryManager::WaitForAccept() {
+    return incoming_accepts.dequeue();
+}
+
 inline
 RDMAMemory* RDMAMemoryManager::PeekAccept() {
     return incoming_accepts.peek(); 
 }
 
+inline
+size_t RDMAMemoryManager::PollForAccepts(std::vector<RDMAMemory*>& memories, size_t max) {
+    size_t count = 0;
+    while(count < max && !incoming_accepts.empty()) {
+        memories.push_back(incoming_accepts.dequeue());
+        count++;
+    }
+    return count;
+}
+
 inline
 RDMAMemory* RDMAMemoryManager::PollForTransfer() {
     if(incoming_transfers.empty())
@@ -820,6 +2227,21 @@ RDMAMemory* RDMAMemoryManager::PollForTransfer() {
     return incoming_transfers.dequeue();
 }
 
+inline
+RDMAMemory* RDMAMemoryManager::WaitForTransfer() {
+    return incoming_transfers.dequeue();
+}
+
+inline
+size_t RDMAMemoryManager::PollForTransfers(std::vector<RDMAMemory*>& memories, size_t max) {
+    size_t count = 0;
+    while(count < max && !incoming_transfers.empty()) {
+        memories.push_back(incoming_transfers.dequeue());
+        count++;
+    }
+    return count;
+}
+
 inline
 RDMAMemory* RDMAMemoryManager::PollForClose() {
     if(incoming_dones.empty())
@@ -827,36 +2249,96 @@ RDMAMemory* RDMAMemoryManager::PollForClose() {
     return incoming_dones.dequeue();
 }
 
+inline
+RDMAMemory* RDMAMemoryManager::WaitForClose() {
+    return incoming_dones.dequeue();
+}
+
 inline
 RDMAMemory* RDMAMemoryManager::PeekClose() {
     return incoming_dones.peek(); 
 }
 
+/*
+    called from the sigsegv handler, the index lookup does not lock or allocate
+*/
 inline
 RDMAMemory* RDMAMemoryManager::getRDMAMemory(void* address) {
-    //TODO change to binary search, but for that we'll have to change the underlying data structure
-    std::unordered_map<void*,RDMAMemory*>::iterator it;
-    for (it = memory_map.begin(); it != memory_map.end(); it++ ) {
-        void* addr1 = it->first;
-        RDMAMemory* memory = it->second;
-        void* addr2 = (void*) ((char*)memory->vaddr + memory->size);
-        if(address >= addr1 && address < addr2)
-            return memory;
+    return segment_index.find(address);
+}
+
+inline
+int RDMAMemoryManager::SetPolicy(void* address, const MigrationPolicy& policy){
+    RDMAMemory* memory = this->getRDMAMemory(address);
+    if (memory == nullptr) {
+        LogError("no segment at %p to set the policy of", address);
+        return -1;
     }
-    return nullptr;
+    #if !PAGING
+    if (policy.paging) {
+        LogError("segment %p asks for paging, build with PAGING to page segments in", address);
+        return -1;
+    }
+    #endif
+    memory->policy = policy;
+    return 0;
+}
+
+inline
+int RDMAMemoryManager::SetNumaNode(void* address, int node){
+    RDMAMemory* memory = this->getRDMAMemory(address);
+    if (memory == nullptr) {
+        LogError("no segment at %p to place", address);
+        return -1;
+    }
+    if (node == NumaNode::UNKNOWN) {
+        memory->numa_node = node;
+        this->PlaceSegment(memory->vaddr, memory->size, node);
+        return 0;
+    }
+    if (NumaNode::bind(memory->vaddr, memory->size, node) != 0) {
+        LogError("could not bind %p to NUMA node %d because %s", memory->vaddr, node, strerror(errno));
+        return -1;
+    }
+    memory->numa_node = node;
+    return 0;
+}
+
+inline
+void RDMAMemoryManager::PlaceSegment(void* address, size_t size, int node){
+    #if NUMA_PLACEMENT
+        if (node == NumaNode::UNKNOWN)
+            node = this->nic_node;
+    #endif
+    if (node != NumaNode::UNKNOWN && NumaNode::bind(address, size, node) != 0)
+        LogError("could not bind %p to NUMA node %d because %s", address, node, strerror(errno));
+}
+
+inline
+void RDMAMemoryManager::PinThread(){
+    #if NUMA_PLACEMENT
+        NumaNode::pinThread(this->nic_node);
+    #endif
 }
 
 inline
-void RDMAMemoryManager::SetPageSize(void* address, size_t page_size){
+int RDMAMemoryManager::SetPageSize(void* address, size_t page_size){
     auto x = memory_map.find(address);
     LogAssert(x != memory_map.end(), "address not found");
     RDMAMemory* memory = x->second;
-    memory->pages.setPageSize(page_size);
+    if (page_size == RDMAMemory::AUTO_PAGE_SIZE) {
+        memory->auto_page_size = true;
+        return 0;
+    }
+    if (!memory->pages.setPageSize(page_size))
+        return -1;
+    memory->auto_page_size = false;
+    return 0;
 }
 
 inline 
 void RDMAMemoryManager::MarkPageLocal(RDMAMemory* memory, void* address, size_t size) {
-    if(mprotect(address, size, PROT_READ | PROT_WRITE)) {
+    if(mprotect(address, size, LOCAL_PAGE_PROTECTION)) {
         perror("couldnt mprotect in pull all pages");
         exit(errno);
     }    
@@ -864,6 +2346,267 @@ void RDMAMemoryManager::MarkPageLocal(RDMAMemory* memory, void* address, size_t
     memory->pages.setPageState(address, PageState::Local);
 }
 
+inline
+int RDMAMemoryManager::FetchPage(RDMAMemory* memory, void* address, size_t size, bool batched) {
+    int source = memory->pair;
+    int64_t start = LatencyHistogram::now();
+    #if PAGING && USERFAULTFD
+        std::lock_guard<std::mutex> guard(staging_mutex);
+        uintptr_t conn_id = this->coordinator.connections[source];
+        for (size_t offset = 0; offset < size; offset += STAGING_SIZE) {
+            size_t chunk = std::min(STAGING_SIZE, size - offset);
+            void* page = (void*)((char*)address + offset);
+            if (this->coordinator.getServer(source, conn_id)->rdma_read(conn_id, staging, page, chunk) != 0) {
+                LogError("could not read page at %p into the staging buffer", page);
+                this->FailPage(memory, address, size);
+                return -1;
+            }
+            this->pulled_bytes.fetch_add(chunk, std::memory_order_relaxed);
+            // the page is only mapped by the copy, a bad read is caught before anyone sees it
+            for (int attempt = 1; !memory->checksums.verify(page, chunk, staging); attempt++) {
+                if (attempt > TRANSFER_CHECKSUM_RETRIES) {
+                    LogError("page at %p still does not match its checksum after %d reads", page, attempt);
+                    this->FailPage(memory, address, size);
+                    return -1;
+                }
+                LogError("page at %p does not match its checksum, reading it again", page);
+                if (this->coordinator.getServer(source, conn_id)->rdma_read(conn_id, staging, page, chunk) != 0) {
+                    this->FailPage(memory, address, size);
+                    return -1;
+                }
+                this->pulled_bytes.fetch_add(chunk, std::memory_order_relaxed);
+            }
+            // copying also wakes every thread blocked on the range
+            struct uffdio_copy copy;
+            copy.dst = (uintptr_t)page;
+            copy.src = (uintptr_t)staging;
+            copy.len = chunk;
+            copy.mode = 0;
+            copy.copy = 0;
+            if (ioctl(this->uffd, UFFDIO_COPY, &copy) != 0 && errno != EEXIST) {
+                LogError("UFFDIO_COPY failed at %p because %s", page, strerror(errno));
+                this->FailPage(memory, address, size);
+                return -1;
+            }
+        }
+        memory->stats.pulls.record(LatencyHistogram::now() - start);
+        memory->pages.setPageState(address, PageState::Local);
+    #else
+        if (this->Pull(address, size, source) != 0 || this->VerifyPulled(memory, address, size) != 0) {
+            this->FailPage(memory, address, size);
+            return -1;
+        }
+        memory->stats.pulls.record(LatencyHistogram::now() - start);
+        if (batched)
+            memory->resolved.add(memory->pages, address);
+        else
+            this->MarkPageLocal(memory, address, size);
+    #endif
+    return 0;
+}
+
+/*
+    the segment's state is written directly, UpdateState looks the segment up in a map
+    only the poller thread may touch
+*/
+inline
+void RDMAMemoryManager::FailPage(RDMAMemory* memory, void* address, size_t size) {
+    LogError("page at %p could not be read intact, segment %p is Invalid", address, memory->vaddr);
+    memory->state = RDMAMemory::State::Invalid;
+    memory->pages.setPageState(address, PageState::Remote);
+    #if PAGING && USERFAULTFD
+        // faulters the fault thread left to this read sleep in the kernel, woken they fault again
+        struct uffdio_range range;
+        range.start = (uintptr_t)address;
+        range.len = size;
+        ioctl(this->uffd, UFFDIO_WAKE, &range);
+    #endif
+}
+
+inline
+int RDMAMemoryManager::VerifyPulled(RDMAMemory* memory, void* address, size_t size, bool readable) {
+    for (int attempt = 1; !memory->checksums.verify(address, size, readable ? address : nullptr); attempt++) {
+        if (attempt > TRANSFER_CHECKSUM_RETRIES) {
+            LogError("%zu bytes at %p still do not match their checksums after %d reads", size, address, attempt);
+            return -1;
+        }
+        LogError("%zu bytes at %p do not match their checksums, reading them again", size, address);
+        if (this->Pull(address, size, memory->pair) != 0)
+            return -1;
+    }
+    return 0;
+}
+
+inline
+int RDMAMemoryManager::PrefetchAfterFault(RDMAMemory* memory, void* address) {
+    #if PAGING
+        if (!memory->policy.stride_prefetch)
+            return 0;
+        size_t page_size = memory->pages.getPageSize();
+        int page_id = ((uintptr_t)address - (uintptr_t)memory->vaddr) / page_size;
+        int first = 0;
+        int stride = 0;
+        int count = memory->prefetcher.onFault(page_id, memory->pages.num_pages, &first, &stride);
+
+        for (int i=0; i<count; i++) {
+            // readahead is background work, it stops as soon as a fault is waiting
+            if (!this->scheduler.tryAcquire())
+                break;
+            int id = first + i * stride;
+            void* addr = memory->pages.getPageAddress(id);
+            size_t pagesize = memory->pages.getPageSize(id);
+            if(!memory->pages.setPageStateCAS(addr, PageState::Remote, PageState::InFlight)) {
+                this->scheduler.release();
+                continue;
+            }
+            memory->prefetcher.issued++;
+
+            #if USERFAULTFD
+                // the fault thread has already woken the faulter, it can afford to wait here
+                int result = this->FetchPage(memory, addr, pagesize);
+                this->scheduler.release();
+                if (result != 0)
+                    return -1;
+            #else
+                this->PullPageAsync(memory, addr, pagesize, &this->scheduler.in_flight);
+            #endif
+        }
+    #endif
+    return 0;
+}
+
+inline
+void RDMAMemoryManager::DumpStats(FILE* out) {
+    fprintf(out, "{\"server\":%d,\"time_ns\":%ld,\"pulled_bytes\":%lu,\"pushed_bytes\":%lu,"
+        "\"depth\":%d,\"floor_ns\":%ld,\"slow_faults\":%lu}\n",
+        this->server_id, (long)LatencyHistogram::now(), (unsigned long)this->pulled_bytes.load(),
+        (unsigned long)this->pushed_bytes.load(), this->scheduler.getDepth(),
+        (long)this->scheduler.getFloor(), (unsigned long)this->scheduler.getSlowFaults());
+
+    // segment objects are never freed, only dropped from the index, so the list stays valid
+    std::vector<RDMAMemory*> memories;
+    this->segment_index.list(memories);
+    for (RDMAMemory* memory : memories) {
+        fprintf(out, "{\"segment\":\"%p\",\"size\":%zu,\"pair\":%d,\"page_size\":%zu,\"num_pages\":%d,"
+            "\"local_pages\":%d,\"demand_faults\":%lu,\"prefetch_issued\":%lu,\"prefetch_hits\":%lu,",
+            memory->vaddr, memory->size, memory->pair, memory->pages.getPageSize(), memory->pages.num_pages,
+            memory->pages.local_pages.load(), (unsigned long)memory->demand_faults.load(),
+            (unsigned long)memory->prefetcher.issued.load(), (unsigned long)memory->prefetcher.hits.load());
+        memory->stats.write(out);
+        fprintf(out, "}\n");
+    }
+    fflush(out);
+}
+
+inline
+int RDMAMemoryManager::DumpStats(const std::string& path) {
+    if (path.empty()) {
+        this->DumpStats(stderr);
+        return 0;
+    }
+    FILE* out = fopen(path.c_str(), "a");
+    if (out == nullptr) {
+        LogError("could not open %s for stats because %s", path.c_str(), strerror(errno));
+        return -1;
+    }
+    this->DumpStats(out);
+    fclose(out);
+    return 0;
+}
+
+inline
+void RDMAMemoryManager::DumpStatsOnSignal(const std::string& path, int signum) {
+    this->stats_path = path;
+    struct sigaction request;
+    memset(&request, 0, sizeof(request));
+    request.sa_handler = request_stats;
+    sigaction(signum, &request, NULL);
+}
+
+#if PAGING && USERFAULTFD
+inline
+void RDMAMemoryManager::start_userfault() {
+    this->uffd = (int)syscall(__NR_userfaultfd, O_CLOEXEC | O_NONBLOCK);
+    if (this->uffd == -1) {
+        LogError("could not open userfaultfd because %s", strerror(errno));
+        exit(errno);
+    }
+
+    struct uffdio_api api;
+    api.api = UFFD_API;
+    api.features = 0;
+    if (ioctl(this->uffd, UFFDIO_API, &api) != 0) {
+        LogError("userfaultfd api handshake failed because %s", strerror(errno));
+        exit(errno);
+    }
+
+    this->staging = aligned_alloc(4096, STAGING_SIZE);
+    LogAssert(this->staging != nullptr, "could not allocate the staging buffer");
+    for (int i=0; i<this->coordinator.cfg.getNumServers(); i++) {
+        if(this->server_id == i) continue;
+        uintptr_t conn_id = this->coordinator.connections[i];
+        this->coordinator.getServer(i, conn_id)->register_memory(conn_id, staging, STAGING_SIZE, false);
+    }
+
+    this->fault_thread = std::thread(&RDMAMemoryManager::fault_thread_method, this);
+    this->fault_thread.detach();
+}
+
+/*
+    the faulting thread sleeps in the kernel until the page is copied in,
+    nothing here runs in signal context so it is free to block and lock
+*/
+inline
+void RDMAMemoryManager::fault_thread_method() {
+    this->PinThread();
+    struct pollfd pfd;
+    pfd.fd = this->uffd;
+    pfd.events = POLLIN;
+    while(run) {
+        if (poll(&pfd, 1, 100) <= 0)
+            continue;
+
+        struct uffd_msg msg;
+        if (read(this->uffd, &msg, sizeof(msg)) != sizeof(msg))
+            continue;
+        if (msg.event != UFFD_EVENT_PAGEFAULT)
+            continue;
+
+        void* addr = (void*)(uintptr_t)msg.arg.pagefault.address;
+        RDMAMemory* memory = this->getRDMAMemory(addr);
+        if (memory == nullptr) {
+            LogError("userfault at %p outside of any segment", addr);
+            continue;
+        }
+        addr = memory->pages.getPageAddress(addr);
+        size_t page_size = memory->pages.getPageSize(addr);
+
+        if(!memory->pages.setPageStateCAS(addr, PageState::Remote, PageState::InFlight)) {
+            // a prefetch is bringing it in and its copy wakes the faulter, unless it already has
+            if (memory->pages.getPageState(addr) == PageState::Local) {
+                struct uffdio_range range;
+                range.start = (uintptr_t)addr;
+                range.len = page_size;
+                ioctl(this->uffd, UFFDIO_WAKE, &range);
+            }
+            memory->stats.retries.fetch_add(1, std::memory_order_relaxed);
+            continue;
+        }
+
+        int64_t start = this->scheduler.demandBegin();
+        if (this->FetchPage(memory, addr, page_size) != 0) {
+            LogError("could not resolve userfault at %p", addr);
+            exit(1);
+        }
+        memory->demand_faults.fetch_add(1, std::memory_order_relaxed);
+        memory->accesses.record(memory->pages.getPageId(addr));
+        memory->stats.faults.record(this->scheduler.demandEnd(start, true));
+        // a readahead page that failed left the segment Invalid, the fault itself was served
+        this->PrefetchAfterFault(memory, addr);
+    }
+}
+#endif
+
 inline 
 void MarkPageLocalCB(void* data) {
     void* data_ = data;
@@ -873,39 +2616,69 @@ void MarkPageLocalCB(void* data) {
     void* address = *((void**)data);
     data = (void*)((char*)data + sizeof(void*));
      
-    size_t size = *((size_t*)data);
     data = (void*)((char*)data + sizeof(size_t));    
-    if(mprotect(address, size, PROT_READ | PROT_WRITE)) {
-        perror("couldnt mprotect in pull all pages");
-        exit(errno);
-    }    
     
     std::atomic<int64_t>* x = (std::atomic<int64_t>*)*((void**)data);
         
     (*x).fetch_sub(1);
 
-    memory->pages.setPageState(address, PageState::Local);
+    // this is the completion thread, a read posted from here could never complete, the page is read again later,
+    // as often as a page read synchronously, after that the segment is given up on
+    size_t size = memory->pages.getPageSize(address);
+    if (!memory->checksums.verify(address, size)) {
+        int failures = memory->checksums.getFailures(address, size);
+        if (failures > TRANSFER_CHECKSUM_RETRIES) {
+            LogError("page at %p still does not match its checksum after %d reads, segment %p is Invalid",
+                address, failures, memory->vaddr);
+            memory->state = RDMAMemory::State::Invalid;
+        } else {
+            LogError("page at %p does not match its checksum, it goes back to Remote", address);
+        }
+        memory->resolved.abandon(memory->pages, address);
+        free(data_);
+        return;
+    }
+    // unprotected together with its neighbours, the page turns Local when the run is resolved
+    memory->resolved.complete(memory->pages, address);
     free(data_);
 }
 
 inline
-void RDMAMemoryManager::PullAllPagesWithoutCloseAsync(RDMAMemory* memory){
+void RDMAMemoryManager::PullPageAsync(RDMAMemory* memory, void* address, size_t size, std::atomic<int64_t>* limiter) {
+    void* data_ = (void*)malloc(sizeof(RDMAMemory*) + sizeof(void*) + sizeof(size_t) + sizeof(std::atomic<int64_t>*));
+    void* data = data_;
+
+    *((void**)data) = (void*)memory;
+    data = (void*)((char*)data + sizeof(RDMAMemory*));
+
+    *((void**)data) = address;
+    data = (void*)((char*)data + sizeof(void*));
+    memcpy(data, &size, sizeof(size));
+    
+    data = (void*)((char*)data + sizeof(size));
+    
+    *((void**)data) = (void*)limiter;
+
+    memory->resolved.expect();
+    this->PullAsync(address, size, memory->pair, MarkPageLocalCB, data_);
+}
+
+inline
+int RDMAMemoryManager::PullAllPagesWithoutCloseAsync(RDMAMemory* memory){
     // auto x = memory_map.find(address);
     // RDMAMemory* memory = x->second;
-    unsigned int id = 0;
     int source = memory->pair;
-    std::atomic<int64_t>* rate_limiter = (std::atomic<int64_t>*) malloc(sizeof(std::atomic<int64_t>));
+    std::atomic<int64_t>* rate_limiter = &this->scheduler.in_flight;
 
     LogAssert(source != -1, "source not set");
 
-    vector<Page> p = memory->pages.pages;
-    for (; id<p.size(); id++) {
-        if(p.at(id).ps == PageState::Local)
-            continue;
-
-        while (*rate_limiter > max_async_pending){}
-
-        (*rate_limiter).fetch_add(1);
+    int num_pages = memory->pages.num_pages;
+    for (int id = memory->pages.find_next_remote(0); id < num_pages; id = memory->pages.find_next_remote(id + 1)) {
+        // a page that failed for good, here or in a completion, ends the sweep
+        if (memory->state == RDMAMemory::State::Invalid)
+            return -1;
+        // take the slot before owning the page, a fault on it would otherwise wait on us while we wait on it
+        this->scheduler.acquire();
 
         void* addr = memory->pages.getPageAddress(id);
         size_t pagesize = memory->pages.getPageSize(id);
@@ -913,43 +2686,42 @@ void RDMAMemoryManager::PullAllPagesWithoutCloseAsync(RDMAMemory* memory){
         if(!memory->pages.setPageStateCAS(addr, PageState::Remote, PageState::InFlight)) {
             //page was not set to remote, so its either a inflight or local
             //either way, we do not need to do any operations, just continue
+            this->scheduler.release();
             continue;
         }
 
-        void* data_ = (void*)malloc(sizeof(RDMAMemory*) + sizeof(void*) + sizeof(size_t) + sizeof(std::atomic<int64_t>*));
-        void* data = data_;
-
-        *((void**)data) = (void*)memory;
-        data = (void*)((char*)data + sizeof(RDMAMemory*));
-
-        *((void**)data) = addr;
-        data = (void*)((char*)data + sizeof(void*));
-        memcpy(data, &pagesize, sizeof(pagesize));
-        
-        data = (void*)((char*)data + sizeof(pagesize));
-        
-        *((void**)data) = (void*)rate_limiter;
+        #if PAGING && USERFAULTFD
+            // the segment is not registered with the NIC, pages go through the staging buffer
+            int result = this->FetchPage(memory, addr, pagesize);
+            this->scheduler.release();
+            if (result != 0)
+                return -1;
+            continue;
+        #endif
 
-        void(*callback)(void*);
-        callback = MarkPageLocalCB;
-        this->PullAsync(addr, pagesize, source, callback, data_);
+        this->PullPageAsync(memory, addr, pagesize, rate_limiter);
     } 
+    return 0;
 }
 
 inline
-void RDMAMemoryManager::PullAllPagesWithoutClose(RDMAMemory* memory){
+int RDMAMemoryManager::PullAllPagesWithoutClose(RDMAMemory* memory){
     // auto x = memory_map.find(address);
     // RDMAMemory* memory = x->second;
-    unsigned int id = 0;
     int source = memory->pair;
 
     // LogAssert(x != memory_map.end(), "cannot find memory");
     LogAssert(source != -1, "source not set");
 
-    vector<Page> p = memory->pages.pages;
-    for (; id<p.size(); id++) {
-        if(p.at(id).ps == PageState::Local)
-            continue;
+    int num_pages = memory->pages.num_pages;
+    int result = 0;
+    for (int id = memory->pages.find_next_remote(0); id < num_pages; id = memory->pages.find_next_remote(id + 1)) {
+        // a page that failed for good, here or in a completion, ends the sweep
+        if (memory->state == RDMAMemory::State::Invalid) {
+            result = -1;
+            break;
+        }
+        this->scheduler.yieldToDemand();
 
         void* addr = memory->pages.getPageAddress(id);
         size_t pagesize = memory->pages.getPageSize(id);
@@ -960,23 +2732,114 @@ void RDMAMemoryManager::PullAllPagesWithoutClose(RDMAMemory* memory){
             continue;
         }
 
-        this->Pull(addr, pagesize, source);
-        this->MarkPageLocal(memory, addr, pagesize);
+        result = this->FetchPage(memory, addr, pagesize, true);
+        if (result != 0)
+            break;
     }
+    // the pages read before a failure are good, they still turn Local
+    memory->resolved.flush(memory->pages);
+    return result;
 }
 
 inline
-void RDMAMemoryManager::PullAllPages(RDMAMemory* memory){
+int RDMAMemoryManager::PullAllPagesParallel(RDMAMemory* memory, int workers){
+    LogAssert(memory->pair != -1, "source not set");
+    #if PAGING && USERFAULTFD
+        // every read lands in the one staging buffer, more workers would only queue on its lock
+        return this->PullAllPagesWithoutClose(memory);
+    #endif
+
+    PullJob job(memory->pages, memory->stats, memory->checksums);
+    std::vector<std::thread> threads;
+    for (int i=1; i<workers; i++) {
+        // the caller stays where it is, the workers started here run next to the device
+        threads.push_back(std::thread([this, memory, &job]() {
+            this->PinThread();
+            this->pull_worker(memory, &job);
+        }));
+    }
+    this->pull_worker(memory, &job);
+    for (std::thread& thread : threads) {
+        thread.join();
+    }
+    // pages that did not match went back to Remote, they are read again one at a time and checked
+    if (memory->checksums.active())
+        return this->PullAllPagesWithoutClose(memory);
+    return 0;
+}
+
+inline
+void RDMAMemoryManager::pull_worker(RDMAMemory* memory, PullJob* job){
+    std::atomic<int> window(0);
+    int first = 0;
+    int last = 0;
+    while (job->next(&first, &last)) {
+        int id = memory->pages.find_next_remote(first);
+        while (id < last) {
+            while (window.load() >= PullJob::WINDOW) {
+                std::this_thread::yield();
+            }
+            // take the slot before owning the pages, a fault on them would otherwise wait on us while we wait on it
+            this->scheduler.acquire();
+            int count = job->claim(id, last);
+            if (count == 0) {
+                // a fault or another sweep got there first
+                this->scheduler.release();
+                id = memory->pages.find_next_remote(id + 1);
+                continue;
+            }
+
+            window.fetch_add(1);
+            PullJob::Read* read = new PullJob::Read();
+            read->job = job;
+            read->first = id;
+            read->count = count;
+            read->start = LatencyHistogram::now();
+            read->window = &window;
+            read->slots = &this->scheduler.in_flight;
+            this->PullAsync(memory->pages.getPageAddress(id), job->runBytes(id, count), memory->pair, PullJob::complete, read);
+            id = memory->pages.find_next_remote(id + count);
+        }
+    }
+    // the completions still point at window
+    while (window.load() > 0) {
+        std::this_thread::yield();
+    }
+}
+
+inline
+void RDMAMemoryManager::prefetch_thread_method(RDMAMemory* segment){
+    this->PinThread();
+    int result = 0;
+    if (segment->policy.async_prefetch)
+        result = this->PullAllPagesWithoutCloseAsync(segment);
+    else if (PULL_WORKERS > 1)
+        result = this->PullAllPagesParallel(segment, PULL_WORKERS);
+    else
+        result = this->PullAllPagesWithoutClose(segment);
+    if (result != 0)
+        LogError("prefetch of segment %p stopped, the segment is Invalid", segment->vaddr);
+}
+
+inline
+int RDMAMemoryManager::PullAllPages(RDMAMemory* memory){
     check_pages_again:
-    this->PullAllPagesWithoutClose(memory);
+    // a segment that failed keeps its source, it is not closed
+    if (this->PullAllPagesWithoutClose(memory) != 0) {
+        LogError("could not pull all pages of %p, it is not closed", memory->vaddr);
+        return -1;
+    }
     int check_local_pages = memory->pages.local_pages.load();
     if(check_local_pages < memory->pages.num_pages) {
+        // pages in flight on other threads, give them the cpu
         LogInfo("did not have all pages, trying again");
+        std::this_thread::yield();
         goto check_pages_again;
     }   
     int source = memory->pair;
     this->UpdateState(memory->vaddr, RDMAMemory::State::Clean);
     this->close(memory->vaddr, memory->size, source);
+    return 0;
 }
 
 inline
@@ -984,19 +2847,21 @@ int RDMAMemoryManager::PullPagesAsync(void* v_addr, size_t size, int source, int
     auto x = memory_map.find(v_addr);
     RDMAMemory* memory = x->second;
     
-    std::atomic<int64_t>* rate_limiter = (std::atomic<int64_t>*) malloc(sizeof(std::atomic<int64_t>));
+    std::atomic<int64_t>* rate_limiter = new std::atomic<int64_t>(0);
 
     size_t page_size = memory->pages.getPageSize();    
     uintptr_t segment_pull = (uintptr_t)v_addr;
     uintptr_t end_segment_pull = (uintptr_t)v_addr + size;
 
     for (;segment_pull<end_segment_pull; segment_pull+=page_size) {
-        if(memory->pages.getPageState(segment_pull) == PageState::Local) {
+        if(memory->pages.getPageState((void*)segment_pull) == PageState::Local) {
             continue;
         }
-        while (*rate_limiter > max_async_limit){}
-
-        (*rate_limiter).fetch_add(1);
+        // a page that failed for good, here or in a completion, ends the pull
+        if (memory->state == RDMAMemory::State::Invalid)
+            break;
+        while (*rate_limiter >= max_async_limit){}
+        this->scheduler.yieldToDemand();
 
         void* addr = memory->pages.getPageAddress((void*)segment_pull);
         size_t pagesize = memory->pages.getPageSize((void*)segment_pull);
@@ -1007,28 +2872,24 @@ int RDMAMemoryManager::PullPagesAsync(void* v_addr, size_t size, int source, int
             continue;
         }
 
-        void* data_ = (void*)malloc(sizeof(RDMAMemory*) + sizeof(void*) + sizeof(size_t) + sizeof(std::atomic<int64_t>*));
-        void* data = data_;
-
-        *((void**)data) = (void*)memory;
-        data = (void*)((char*)data + sizeof(RDMAMemory*));
+        (*rate_limiter).fetch_add(1);
 
-        *((void**)data) = addr;
-        data = (void*)((char*)data + sizeof(void*));
-        memcpy(data, &pagesize, sizeof(pagesize));
-        
-        data = (void*)((char*)data + sizeof(pagesize));
-        
-        *((void**)data) = (void*)rate_limiter;
+        #if PAGING && USERFAULTFD
+            // the segment is not registered with the NIC, pages go through the staging buffer
+            int result = this->FetchPage(memory, addr, pagesize);
+            (*rate_limiter).fetch_sub(1);
+            if (result != 0)
+                break;
+            continue;
+        #endif
 
-        void(*callback)(void*);
-        callback = MarkPageLocalCB;
-        this->PullAsync(addr, pagesize, source, callback, data_);
+        this->PullPageAsync(memory, addr, pagesize, rate_limiter);
     }
 
+    // the completions still point at rate_limiter
     while((*rate_limiter) > 0);
-    free(rate_limiter);
-    return 0;
+    delete rate_limiter;
+    return memory->state == RDMAMemory::State::Invalid ? -1 : 0;
 }
 
 inline
@@ -1041,10 +2902,12 @@ int RDMAMemoryManager::PullPagesSync(void* v_addr, size_t size, int source) {
     uintptr_t end_segment_pull = (uintptr_t)v_addr + size;
 
     for (;segment_pull<end_segment_pull; segment_pull+=page_size) {
-        if(memory->pages.getPageState(segment_pull) == PageState::Local) {
+        if(memory->pages.getPageState((void*)segment_pull) == PageState::Local) {
             continue;
         }
 
+        this->scheduler.yieldToDemand();
+
         void* addr = memory->pages.getPageAddress((void*)segment_pull);
         size_t pagesize = memory->pages.getPageSize((void*)segment_pull);
 
@@ -1054,9 +2917,12 @@ int RDMAMemoryManager::PullPagesSync(void* v_addr, size_t size, int source) {
             continue;
         }
 
-        this->Pull(addr, pagesize, source);
-        this->MarkPageLocal(memory, addr, pagesize);
+        if (this->FetchPage(memory, addr, pagesize, true) != 0) {
+            memory->resolved.flush(memory->pages);
+            return -1;
+        }
     }
+    memory->resolved.flush(memory->pages);
     
     return 0;
 }
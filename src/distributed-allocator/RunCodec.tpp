@@ -0,0 +1,156 @@
+// RunCodec.tpp
+
+inline
+bool RunCodec::put_header(char* dst, size_t capacity, size_t* out, Kind kind, uint32_t words) {
+    if (*out + sizeof(uint32_t) > capacity)
+        return false;
+    uint32_t header = (words << KIND_BITS) | kind;
+    memcpy(dst + *out, &header, sizeof(header));
+    *out += sizeof(header);
+    return true;
+}
+
+/*
+    words are loaded with memcpy, segments are page aligned but a sample block or a tail need not be
+*/
+inline
+size_t RunCodec::encode(const void* src, size_t bytes, void* dst, size_t capacity) {
+    // nothing to code, src may be null
+    if (bytes == 0)
+        return 0;
+    const char* in = (const char*)src;
+    char* out = (char*)dst;
+    size_t num_words = bytes / sizeof(uint64_t);
+    size_t written = 0;
+
+    size_t literal_start = 0;
+    size_t literal_words = 0;
+    size_t i = 0;
+    while (i <= num_words) {
+        uint64_t word = 0;
+        size_t run = 0;
+        if (i < num_words) {
+            memcpy(&word, in + i * sizeof(uint64_t), sizeof(word));
+            run = 1;
+            while (i + run < num_words && run < MAX_WORDS) {
+                uint64_t next;
+                memcpy(&next, in + (i + run) * sizeof(uint64_t), sizeof(next));
+                if (next != word)
+                    break;
+                run++;
+            }
+        }
+
+        bool ends_literal = i == num_words || word == 0 || run >= MIN_REPEAT || literal_words + run > MAX_WORDS;
+        if (ends_literal && literal_words > 0) {
+            size_t payload = literal_words * sizeof(uint64_t);
+            if (!put_header(out, capacity, &written, LITERAL, literal_words) || written + payload > capacity)
+                return NO_FIT;
+            memcpy(out + written, in + literal_start * sizeof(uint64_t), payload);
+            written += payload;
+            literal_words = 0;
+        }
+        if (i == num_words)
+            break;
+
+        if (word == 0) {
+            if (!put_header(out, capacity, &written, ZERO, run))
+                return NO_FIT;
+            i += run;
+        } else if (run >= MIN_REPEAT) {
+            if (!put_header(out, capacity, &written, REPEAT, run) || written + sizeof(word) > capacity)
+                return NO_FIT;
+            memcpy(out + written, &word, sizeof(word));
+            written += sizeof(word);
+            i += run;
+        } else {
+            if (literal_words == 0)
+                literal_start = i;
+            literal_words += run;
+            i += run;
+        }
+    }
+
+    size_t tail = bytes - num_words * sizeof(uint64_t);
+    if (written + tail > capacity)
+        return NO_FIT;
+    memcpy(out + written, in + num_words * sizeof(uint64_t), tail);
+    written += tail;
+    return written;
+}
+
+inline
+bool RunCodec::decode(const void* src, size_t coded, void* dst, size_t bytes) {
+    const char* in = (const char*)src;
+    char* out = (char*)dst;
+    size_t num_words = bytes / sizeof(uint64_t);
+    size_t tail = bytes - num_words * sizeof(uint64_t);
+    size_t read = 0;
+    size_t done = 0;
+
+    while (done < num_words) {
+        uint32_t header;
+        if (read + sizeof(header) > coded)
+            return false;
+        memcpy(&header, in + read, sizeof(header));
+        read += sizeof(header);
+        size_t words = header >> KIND_BITS;
+        if (words == 0 || done + words > num_words)
+            return false;
+
+        switch (header & ((1 << KIND_BITS) - 1)) {
+        case ZERO:
+            memset(out + done * sizeof(uint64_t), 0, words * sizeof(uint64_t));
+            break;
+        case REPEAT: {
+            uint64_t word;
+            if (read + sizeof(word) > coded)
+                return false;
+            memcpy(&word, in + read, sizeof(word));
+            read += sizeof(word);
+            for (size_t w = 0; w < words; w++) {
+                memcpy(out + (done + w) * sizeof(uint64_t), &word, sizeof(word));
+            }
+            break;
+        }
+        case LITERAL:
+            if (read + words * sizeof(uint64_t) > coded)
+                return false;
+            memcpy(out + done * sizeof(uint64_t), in + read, words * sizeof(uint64_t));
+            read += words * sizeof(uint64_t);
+            break;
+        default:
+            return false;
+        }
+        done += words;
+    }
+
+    if (read + tail != coded)
+        return false;
+    if (tail > 0)
+        memcpy(out + num_words * sizeof(uint64_t), in + read, tail);
+    return true;
+}
+
+/*
+    a literal block codes to its size plus one header, the scratch buffer leaves room for that
+*/
+inline
+double RunCodec::sample(const void* src, size_t bytes) {
+    if (bytes == 0)
+        return 1.0;
+    char scratch[SAMPLE_BLOCK + 64];
+    size_t blocks = (bytes + SAMPLE_BLOCK - 1) / SAMPLE_BLOCK;
+    size_t step = blocks > SAMPLE_BLOCKS ? blocks / SAMPLE_BLOCKS : 1;
+
+    size_t raw = 0;
+    size_t coded = 0;
+    for (size_t block = 0; block < blocks; block += step) {
+        size_t offset = block * SAMPLE_BLOCK;
+        size_t length = bytes - offset < SAMPLE_BLOCK ? bytes - offset : SAMPLE_BLOCK;
+        size_t size = encode((const char*)src + offset, length, scratch, sizeof(scratch));
+        raw += length;
+        coded += size == NO_FIT ? length : size;
+    }
+    return (double)coded / raw;
+}
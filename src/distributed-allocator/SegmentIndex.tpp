@@ -0,0 +1,112 @@
+// SegmentIndex.tpp
+
+inline
+SegmentIndex::SegmentIndex() : snapshot(nullptr), phase(0) {
+    readers[0] = 0;
+    readers[1] = 0;
+    publish();
+}
+
+inline
+SegmentIndex::~SegmentIndex() {
+    free(snapshot.load());
+}
+
+inline
+void SegmentIndex::insert(void* address, size_t size, RDMAMemory* memory) {
+    std::lock_guard<std::mutex> guard(writer_mutex);
+    Entry entry;
+    entry.start = (uintptr_t)address;
+    entry.end = (uintptr_t)address + size;
+    entry.memory = memory;
+    segments[entry.start] = entry;
+    publish();
+}
+
+inline
+void SegmentIndex::remove(void* address) {
+    std::lock_guard<std::mutex> guard(writer_mutex);
+    if (segments.erase((uintptr_t)address) == 0)
+        return;
+    publish();
+}
+
+inline
+size_t SegmentIndex::size() {
+    std::lock_guard<std::mutex> guard(writer_mutex);
+    return segments.size();
+}
+
+inline
+void SegmentIndex::list(std::vector<RDMAMemory*>& memories) {
+    std::lock_guard<std::mutex> guard(writer_mutex);
+    memories.clear();
+    for (auto it = segments.begin(); it != segments.end(); it++) {
+        memories.push_back(it->second.memory);
+    }
+}
+
+inline
+RDMAMemory* SegmentIndex::find(void* address) {
+    uintptr_t addr = (uintptr_t)address;
+    RDMAMemory* result = nullptr;
+
+    // a reader that raced a flip backs off and counts itself in the new phase,
+    // otherwise a writer waiting on the other phase could free the array under it
+    std::atomic<int>* counter = nullptr;
+    while (true) {
+        uint64_t entered = phase.load();
+        counter = &readers[entered & 1];
+        counter->fetch_add(1);
+        if (phase.load() == entered)
+            break;
+        counter->fetch_sub(1);
+    }
+    Snapshot* s = snapshot.load();
+
+    // upper_bound on start, the candidate is the entry just before it
+    size_t lo = 0;
+    size_t hi = s->count;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (s->entries[mid].start <= addr)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    if (lo > 0 && addr < s->entries[lo - 1].end)
+        result = s->entries[lo - 1].memory;
+
+    counter->fetch_sub(1);
+    return result;
+}
+
+/*
+    must be called with writer_mutex held
+*/
+inline
+void SegmentIndex::publish() {
+    size_t count = segments.size();
+    // entries[1] is already part of the struct
+    size_t bytes = sizeof(Snapshot) + (count > 0 ? count - 1 : 0) * sizeof(Entry);
+    Snapshot* fresh = (Snapshot*)malloc(bytes);
+    LogAssert(fresh != nullptr, "could not allocate segment index snapshot");
+
+    fresh->count = count;
+    size_t i = 0;
+    for (auto it = segments.begin(); it != segments.end(); it++) {
+        fresh->entries[i++] = it->second;
+    }
+
+    Snapshot* old = snapshot.exchange(fresh);
+    if (old == nullptr)
+        return;
+
+    // grace period, a reader that saw old has registered itself in the phase before the flip,
+    // readers that come after the flip go to the other counter and are not waited for
+    uint64_t retired = phase.fetch_add(1);
+    while (readers[retired & 1].load() != 0) {
+        std::this_thread::yield();
+    }
+    free(old);
+}
@@ -0,0 +1,204 @@
+// magazine.tpp
+
+/*
+    function local so the header can be included from several translation units
+*/
+inline
+MagazineCache::Cache& MagazineCache::thread_cache() noexcept {
+    static thread_local Cache cache = Cache();
+    return cache;
+}
+
+/*
+    never destroyed, threads may still exit after static destructors have run
+*/
+inline
+MagazineCache::Registry& MagazineCache::registry() noexcept {
+    static Registry* registry = new Registry();
+    return *registry;
+}
+
+/*
+    the pool may be gone by the time the thread exits, only pools still registered at the
+    epoch the entry was filled in get their blocks back. The registry lock is held while
+    flushing so retire cannot return (and the pool be unmapped) in the middle of it
+*/
+inline
+MagazineCache::Cache::~Cache() {
+    Registry& live = registry();
+    std::lock_guard<std::mutex> guard(live.lock);
+    for (int i=0; i<MAX_POOLS; i++) {
+        Entry* entry = &entries[i];
+        if (entry->pool == nullptr)
+            continue;
+        auto it = live.live.find(entry->pool);
+        if (it != live.live.end() && it->second == entry->epoch)
+            flush(entry);
+    }
+}
+
+inline
+void MagazineCache::retire(MemoryPool* pool) noexcept {
+    Registry& live = registry();
+    std::lock_guard<std::mutex> guard(live.lock);
+    live.live.erase(pool);
+    pool->retire_caches();
+}
+
+inline
+void MagazineCache::reset(Entry* entry, MemoryPool* pool) noexcept {
+    entry->pool = pool;
+    entry->epoch = pool == nullptr ? 0 : pool->cache_epoch();
+    if (pool != nullptr) {
+        Registry& live = registry();
+        std::lock_guard<std::mutex> guard(live.lock);
+        live.live[pool] = entry->epoch;
+    }
+    for (int i=0; i<MemoryPool::NUM_SIZE_CLASSES; i++) {
+        entry->loaded[i].head = 0;
+        entry->loaded[i].count = 0;
+        entry->spare[i].head = 0;
+        entry->spare[i].count = 0;
+    }
+}
+
+/*
+    finds or claims the entry for pool, an entry from an older epoch is dropped
+    since its blocks may belong to somebody else by now
+*/
+inline
+MagazineCache::Entry* MagazineCache::lookup(MemoryPool* pool) noexcept {
+    Cache& cache = thread_cache();
+    Entry* entry = &cache.entries[cache.last];
+    if (entry->pool != pool) {
+        entry = nullptr;
+        for (int i=0; i<MAX_POOLS; i++) {
+            if (cache.entries[i].pool == pool) {
+                cache.last = i;
+                entry = &cache.entries[i];
+                break;
+            }
+        }
+        if (entry == nullptr) {
+            int victim = cache.next_victim;
+            cache.next_victim = (victim + 1) % MAX_POOLS;
+            entry = &cache.entries[victim];
+            if (entry->pool != nullptr)
+                flush(entry);
+            reset(entry, pool);
+            cache.last = victim;
+            return entry;
+        }
+    }
+
+    if (entry->epoch != pool->cache_epoch())
+        reset(entry, pool);
+    return entry;
+}
+
+inline
+void* MagazineCache::allocate(MemoryPool* pool, size_t bytes) noexcept {
+    if (bytes > MemoryPool::MAX_SMALL_SIZE)
+        return pool->allocate(bytes);
+
+    int c = MemoryPool::size_class(bytes);
+    Entry* entry = lookup(pool);
+    Magazine& loaded = entry->loaded[c];
+
+    if (loaded.count == 0) {
+        Magazine& spare = entry->spare[c];
+        if (spare.count > 0) {
+            loaded = spare;
+            spare.head = 0;
+            spare.count = 0;
+        } else {
+            loaded.head = pool->pop_magazine(c);
+            if (loaded.head != 0) {
+                loaded.count = MemoryPool::magazine_size(c);
+            } else {
+                loaded.head = pool->fill_magazine(c, &loaded.count);
+                if (loaded.count == 0)
+                    return nullptr;
+            }
+        }
+    }
+
+    void* result = pool->from_offset(loaded.head);
+    loaded.head = *((uint64_t*)result);
+    loaded.count--;
+    return result;
+}
+
+inline
+void MagazineCache::deallocate(MemoryPool* pool, void* address, size_t bytes) noexcept {
+    if (address == nullptr)
+        return;
+    if (bytes > MemoryPool::MAX_SMALL_SIZE) {
+        pool->deallocate(address, bytes);
+        return;
+    }
+
+    int c = MemoryPool::size_class(bytes);
+    Entry* entry = lookup(pool);
+    Magazine& loaded = entry->loaded[c];
+
+    if (loaded.count == MemoryPool::magazine_size(c)) {
+        Magazine& spare = entry->spare[c];
+        if (spare.count > 0)
+            give_back(pool, c, &spare);
+        spare = loaded;
+        loaded.head = 0;
+        loaded.count = 0;
+    }
+
+    *((uint64_t*)address) = loaded.head;
+    loaded.head = pool->to_offset(address);
+    loaded.count++;
+}
+
+inline
+void MagazineCache::give_back(MemoryPool* pool, int size_class, Magazine* magazine) noexcept {
+    if (magazine->count == MemoryPool::magazine_size(size_class) && pool->push_magazine(size_class, magazine->head)) {
+        magazine->head = 0;
+        magazine->count = 0;
+        return;
+    }
+    uint64_t block = magazine->head;
+    while (magazine->count > 0) {
+        void* address = pool->from_offset(block);
+        block = *((uint64_t*)address);
+        pool->deallocate(address, MemoryPool::class_size(size_class));
+        magazine->count--;
+    }
+    magazine->head = 0;
+}
+
+inline
+void MagazineCache::flush(Entry* entry) noexcept {
+    MemoryPool* pool = entry->pool;
+    if (entry->epoch == pool->cache_epoch()) {
+        for (int c=0; c<MemoryPool::NUM_SIZE_CLASSES; c++) {
+            give_back(pool, c, &entry->loaded[c]);
+            give_back(pool, c, &entry->spare[c]);
+        }
+    }
+    reset(entry, nullptr);
+}
+
+inline
+void MagazineCache::flush(MemoryPool* pool) noexcept {
+    Cache& cache = thread_cache();
+    for (int i=0; i<MAX_POOLS; i++) {
+        if (cache.entries[i].pool == pool)
+            flush(&cache.entries[i]);
+    }
+}
+
+inline
+void MagazineCache::forget(MemoryPool* pool) noexcept {
+    Cache& cache = thread_cache();
+    for (int i=0; i<MAX_POOLS; i++) {
+        if (cache.entries[i].pool == pool)
+            reset(&cache.entries[i], nullptr);
+    }
+}
@@ -1,34 +1,408 @@
 // mempool.tpp
 
+#include <chrono>
 #include <string>
+#include <thread>
+#include <unistd.h>
 
 inline
 MemoryPool::MemoryPool(void* pool_addr, size_t pool_size)
-: pool_addr(pool_addr), pool_size(pool_size), unused_past(pool_addr) {
+: pool_addr(pool_addr), pool_size(pool_size), unused_past(pool_addr),
+  addr(nullptr), size(0), large_free(0), used(0),
+  num_segments(0), reserved(0), grow_hook(nullptr), grow_context(nullptr),
+  pool_lock(0), epoch(fresh_epoch()) {
+    for (int i=0; i<NUM_SIZE_CLASSES; i++) {
+        free_lists[i] = 0;
+        for (int j=0; j<DEPOT_SLOTS; j++) {
+            depot[i][j] = 0;
+        }
+    }
+}
+
+inline
+MemoryPool::Guard::Guard(std::atomic<int>& lock) noexcept : lock(lock) {
+    while (lock.exchange(1, std::memory_order_acquire) != 0) {
+        std::this_thread::yield();
+    }
+}
+
+inline
+MemoryPool::Guard::~Guard() noexcept {
+    lock.store(0, std::memory_order_release);
+}
+
+inline
+uint64_t MemoryPool::fresh_epoch() noexcept {
+    static std::atomic<uint64_t> counter(0);
+    uint64_t now = (uint64_t)std::chrono::high_resolution_clock::now().time_since_epoch().count();
+    return (now << 8) ^ counter.fetch_add(1);
+}
+
+inline
+void MemoryPool::set_chain(size_t first_segment, size_t reserved) noexcept {
+    this->num_segments = 1;
+    this->segment_sizes[0] = first_segment;
+    this->reserved = reserved > first_segment ? reserved : first_segment;
+}
+
+inline
+void MemoryPool::set_grow_hook(GrowHook hook, void* context) noexcept {
+    this->grow_hook = hook;
+    this->grow_context = context;
+}
+
+inline
+int MemoryPool::segment_count() const noexcept {
+    return num_segments;
+}
+
+inline
+void* MemoryPool::segment_address(int segment) const noexcept {
+    char* address = (char*)addr;
+    for (int i=0; i<segment; i++) {
+        address += segment_sizes[i];
+    }
+    return (void*)address;
+}
+
+inline
+size_t MemoryPool::segment_size(int segment) const noexcept {
+    return segment_sizes[segment];
+}
+
+inline
+int MemoryPool::size_class(size_t bytes) noexcept {
+    if (bytes <= 256)
+        return bytes == 0 ? 0 : (int)((bytes + ALIGNMENT - 1) / ALIGNMENT) - 1;
+    // 384, 512, 768, 1024, 1536, 2048, 3072, 4096
+    int c = 16;
+    size_t class_bytes = 384;
+    while (class_bytes < bytes) {
+        c++;
+        class_bytes = class_size(c);
+    }
+    return c;
+}
+
+inline
+size_t MemoryPool::class_size(int size_class) noexcept {
+    if (size_class < 16)
+        return (size_t)(size_class + 1) * ALIGNMENT;
+    int step = size_class - 16;
+    size_t base = (size_t)256 << (step / 2);
+    return (step % 2 == 0) ? base + base / 2 : base * 2;
+}
+
+inline
+uint64_t MemoryPool::to_offset(void* address) const noexcept {
+    return (uint64_t)((uintptr_t)address - (uintptr_t)this);
+}
+
+inline
+void* MemoryPool::from_offset(uint64_t offset) const noexcept {
+    return (void*)((uintptr_t)this + offset);
+}
+
+inline
+void* MemoryPool::bump(size_t bytes) noexcept {
+    uintptr_t end = (uintptr_t)pool_addr + pool_size;
+    if ((uintptr_t)unused_past + bytes > end && !grow((uintptr_t)unused_past + bytes - end)) {
+        LogAssertionError("OUT OF MEMORY");
+        return nullptr;
+    }
+    void* result = unused_past;
+    unused_past = (void*) ((char*)unused_past + bytes);
+    return result;
+}
+
+/*
+    maps a segment right after the chain, at least bytes long and otherwise as big as the
+    pool so far (capped at MAX_SEGMENT_SIZE), the new memory extends the block area in place
+*/
+inline
+bool MemoryPool::grow(size_t bytes) noexcept {
+    if (grow_hook == nullptr || num_segments == 0 || num_segments == MAX_SEGMENTS)
+        return false;
+
+    size_t page = sysconf(_SC_PAGESIZE);
+    size_t segment = size < MAX_SEGMENT_SIZE ? size : MAX_SEGMENT_SIZE;
+    bytes = (bytes + page - 1) & ~(page - 1);
+    if (segment < bytes)
+        segment = bytes;
+    // shrink to whatever is left of the reservation
+    if (size + segment > reserved)
+        segment = reserved - size;
+    if (segment < bytes)
+        return false;
+
+    void* address = (char*)addr + size;
+    if (grow_hook(grow_context, address, segment) != address) {
+        LogError("could not map pool segment at %p", address);
+        return false;
+    }
+
+    segment_sizes[num_segments++] = segment;
+    size += segment;
+    pool_size += segment;
+    return true;
 }
 
 inline
 void* MemoryPool::allocate(size_t bytes) noexcept {
+    Guard guard(pool_lock);
+    return allocate_unlocked(bytes);
+}
+
+inline
+void* MemoryPool::allocate_unlocked(size_t bytes) noexcept {
     
     // LogInfo("allocate(bytes = %p) called on %p", (void*) bytes, this);
+    void* result = nullptr;
+    if (bytes <= MAX_SMALL_SIZE) {
+        int c = size_class(bytes);
+        size_t csize = class_size(c);
+        if (free_lists[c] != 0) {
+            result = from_offset(free_lists[c]);
+            free_lists[c] = *((uint64_t*)result);
+        } else {
+            // carve from a free large block before growing the watermark
+            result = allocate_large(csize);
+        }
+        if (result != nullptr)
+            used += csize;
+        return result;
+    }
 
-    // For now, we'll use the next free address.
-    void* result = unused_past;
-    // But before we return, update the next free address.
-    unused_past = (void*) ((char*)unused_past + bytes);
-    LogAssert((uintptr_t)unused_past < (uintptr_t)((char*)addr + size), "OUT OF MEMORY");
+    bytes = (bytes + ALIGNMENT - 1) & ~(ALIGNMENT - 1);
+    result = allocate_large(bytes);
+    if (result != nullptr)
+        used += bytes;
     return result;
 }
 
 inline
 void MemoryPool::deallocate(void* addr, size_t bytes) noexcept {
-    LogInfo("deallocate(addr = %p, bytes = %p)",addr, (void*) bytes);
+    if (addr == nullptr)
+        return;
+
+    Guard guard(pool_lock);
+    if (bytes <= MAX_SMALL_SIZE) {
+        int c = size_class(bytes);
+        *((uint64_t*)addr) = free_lists[c];
+        free_lists[c] = to_offset(addr);
+        used -= class_size(c);
+        return;
+    }
+
+    bytes = (bytes + ALIGNMENT - 1) & ~(ALIGNMENT - 1);
+    deallocate_large(addr, bytes);
+    used -= bytes;
+}
+
+/*
+    best fit over the address sorted large list, the tail of a split block stays on the list
+*/
+inline
+void* MemoryPool::allocate_large(size_t bytes) noexcept {
+    uint64_t* best_link = nullptr;
+    FreeBlock* best = nullptr;
+
+    uint64_t* link = &large_free;
+    while (*link != 0) {
+        FreeBlock* block = (FreeBlock*)from_offset(*link);
+        if (block->size >= bytes && (best == nullptr || block->size < best->size)) {
+            best = block;
+            best_link = link;
+            if (block->size == bytes)
+                break;
+        }
+        link = &block->next;
+    }
+
+    if (best == nullptr)
+        return bump(bytes);
+
+    size_t remainder = best->size - bytes;
+    if (remainder >= sizeof(FreeBlock)) {
+        FreeBlock* tail = (FreeBlock*)((char*)best + bytes);
+        tail->size = remainder;
+        tail->next = best->next;
+        *best_link = to_offset(tail);
+    } else {
+        // the slack is too small to track, hand it out with the block
+        *best_link = best->next;
+    }
+    return (void*)best;
+}
+
+inline
+void MemoryPool::deallocate_large(void* address, size_t bytes) noexcept {
+    FreeBlock* block = (FreeBlock*)address;
+    block->size = bytes;
+
+    // find the neighbours on the address sorted list
+    FreeBlock* prev = nullptr;
+    uint64_t* link = &large_free;
+    while (*link != 0 && (uintptr_t)from_offset(*link) < (uintptr_t)address) {
+        prev = (FreeBlock*)from_offset(*link);
+        link = &prev->next;
+    }
+    block->next = *link;
+    *link = to_offset(block);
+
+    // merge with the following block
+    if (block->next != 0 && (char*)block + block->size == (char*)from_offset(block->next)) {
+        FreeBlock* next = (FreeBlock*)from_offset(block->next);
+        block->size += next->size;
+        block->next = next->next;
+    }
+
+    // merge with the preceding block
+    if (prev != nullptr && (char*)prev + prev->size == (char*)block) {
+        prev->size += block->size;
+        prev->next = block->next;
+        block = prev;
+    }
+
+    // a free block at the top of the pool lowers the watermark, so transfers ship less
+    if ((char*)block + block->size == (char*)unused_past && block->next == 0) {
+        uint64_t* unlink = &large_free;
+        while (*unlink != to_offset(block)) {
+            unlink = &((FreeBlock*)from_offset(*unlink))->next;
+        }
+        *unlink = 0;
+        unused_past = (void*)block;
+    }
+}
+
+/*
+    rebuilds the large list from itself and the size class lists in address order,
+    touching neighbours merge and a block that ends at the watermark is given back to it
+*/
+inline
+size_t MemoryPool::trim() {
+    Guard guard(pool_lock);
+    std::vector<std::pair<uintptr_t, size_t>> blocks;
+    for (uint64_t link = large_free; link != 0; ) {
+        FreeBlock* block = (FreeBlock*)from_offset(link);
+        blocks.push_back(std::make_pair((uintptr_t)block, block->size));
+        link = block->next;
+    }
+    for (int c=0; c<NUM_SIZE_CLASSES; c++) {
+        for (uint64_t link = free_lists[c]; link != 0; ) {
+            void* block = from_offset(link);
+            blocks.push_back(std::make_pair((uintptr_t)block, class_size(c)));
+            link = *((uint64_t*)block);
+        }
+        free_lists[c] = 0;
+    }
+    std::sort(blocks.begin(), blocks.end());
+
+    // merge runs in place, then lower the watermark over the last one
+    size_t runs = 0;
+    for (size_t i=0; i<blocks.size(); i++) {
+        if (runs > 0 && blocks[runs - 1].first + blocks[runs - 1].second == blocks[i].first) {
+            blocks[runs - 1].second += blocks[i].second;
+        } else {
+            blocks[runs++] = blocks[i];
+        }
+    }
+    uintptr_t watermark = (uintptr_t)unused_past;
+    if (runs > 0 && blocks[runs - 1].first + blocks[runs - 1].second == watermark) {
+        unused_past = (void*)blocks[runs - 1].first;
+        runs--;
+    }
+
+    uint64_t* link = &large_free;
+    for (size_t i=0; i<runs; i++) {
+        FreeBlock* block = (FreeBlock*)blocks[i].first;
+        block->size = blocks[i].second;
+        *link = to_offset(block);
+        link = &block->next;
+    }
+    *link = 0;
+    return watermark - (uintptr_t)unused_past;
+}
+
+/*
+    magazines hold fewer blocks for the bigger classes, 64 x 16 bytes down to 4 x 4 KB
+*/
+inline
+int MemoryPool::magazine_size(int size_class) noexcept {
+    size_t blocks = 8192 / class_size(size_class);
+    if (blocks < 4)
+        return 4;
+    if (blocks > 64)
+        return 64;
+    return (int)blocks;
+}
+
+/*
+    a slot is only ever read, never the magazine behind it, so a slot that was emptied and
+    refilled with the same magazine in between is still a full magazine
+*/
+inline
+uint64_t MemoryPool::pop_magazine(int size_class) noexcept {
+    for (int i=0; i<DEPOT_SLOTS; i++) {
+        std::atomic<uint64_t>& slot = depot[size_class][i];
+        uint64_t magazine = slot.load(std::memory_order_relaxed);
+        if (magazine != 0 && slot.compare_exchange_strong(magazine, 0,
+                std::memory_order_acquire, std::memory_order_relaxed))
+            return magazine;
+    }
+    return 0;
+}
+
+inline
+bool MemoryPool::push_magazine(int size_class, uint64_t magazine) noexcept {
+    for (int i=0; i<DEPOT_SLOTS; i++) {
+        std::atomic<uint64_t>& slot = depot[size_class][i];
+        uint64_t empty = 0;
+        if (slot.load(std::memory_order_relaxed) == 0 && slot.compare_exchange_strong(empty, magazine,
+                std::memory_order_release, std::memory_order_relaxed))
+            return true;
+    }
+    return false;
+}
+
+inline
+uint64_t MemoryPool::fill_magazine(int size_class, int* count) noexcept {
+    Guard guard(pool_lock);
+    size_t csize = class_size(size_class);
+    uint64_t magazine = 0;
+    int n = 0;
+    for (; n<magazine_size(size_class); n++) {
+        void* block = allocate_unlocked(csize);
+        if (block == nullptr)
+            break;
+        *((uint64_t*)block) = magazine;
+        magazine = to_offset(block);
+    }
+    *count = n;
+    return magazine;
+}
+
+inline
+uint64_t MemoryPool::cache_epoch() const noexcept {
+    return epoch.load(std::memory_order_acquire);
+}
+
+inline
+void MemoryPool::retire_caches() noexcept {
+    epoch.store(fresh_epoch(), std::memory_order_release);
+}
+
+inline
+size_t MemoryPool::in_use() const noexcept {
+    return used;
 }
 
 inline
 std::ostream& operator<<(std::ostream& os, const MemoryPool& pool) {
     os << "MemoryPool(pool_addr = " << pool.pool_addr
        << ", pool_size = " << pool.pool_size
-       << ", unused_past = " << pool.unused_past << ")";
+       << ", unused_past = " << pool.unused_past
+       << ", in_use = " << pool.used
+       << ", segments = " << pool.num_segments << ")";
     return os;
-}
\ No newline at end of file
+}
@@ -0,0 +1,31 @@
+// accesslog.tpp
+
+inline
+PageAccessLog::PageAccessLog() : next(0) {
+    for (int i=0; i<CAPACITY; i++) {
+        entries[i].store(0, std::memory_order_relaxed);
+    }
+}
+
+inline
+void PageAccessLog::record(int page_id) {
+    uint64_t slot = next.fetch_add(1, std::memory_order_relaxed);
+    entries[slot % CAPACITY].store(page_id, std::memory_order_relaxed);
+}
+
+inline
+void PageAccessLog::snapshot(std::vector<int>& pages) {
+    uint64_t recorded = next.load();
+    int count = recorded < (uint64_t)CAPACITY ? (int)recorded : CAPACITY;
+    pages.clear();
+    for (int i=0; i<count; i++) {
+        pages.push_back(entries[i].load(std::memory_order_relaxed));
+    }
+    std::sort(pages.begin(), pages.end());
+    pages.erase(std::unique(pages.begin(), pages.end()), pages.end());
+}
+
+inline
+void PageAccessLog::clear() {
+    next.store(0);
+}
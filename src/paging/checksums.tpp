@@ -0,0 +1,128 @@
+// checksums.tpp
+
+inline
+PageChecksums::PageChecksums() : base(0), used(0), unit(0), memory_fd(-1), mismatches(0) {}
+
+inline
+PageChecksums::~PageChecksums() {
+    if (memory_fd >= 0)
+        close(memory_fd);
+}
+
+inline
+size_t PageChecksums::entries(size_t used, size_t unit) {
+    return (used + unit - 1) / unit;
+}
+
+/*
+    whole units go three at a time, see CRC32C::compute3
+*/
+inline
+void PageChecksums::compute(const void* base, size_t used, size_t unit, uint32_t* table) {
+    const char* bytes = (const char*)base;
+    size_t full = used / unit;
+    size_t i = 0;
+    for (; i + 3 <= full; i += 3) {
+        const void* units[3] = {bytes + i * unit, bytes + (i + 1) * unit, bytes + (i + 2) * unit};
+        CRC32C::compute3(units, unit, table + i);
+    }
+    for (; i < entries(used, unit); i++) {
+        table[i] = CRC32C::compute(bytes + i * unit, std::min(unit, used - i * unit));
+    }
+}
+
+/*
+    the file is opened here, on the thread that handles the transfer, so that verify
+    never has to open it from the sigsegv handler
+*/
+inline
+void PageChecksums::load(void* base, size_t used, size_t unit, std::vector<uint32_t>& table) {
+    if (memory_fd < 0)
+        memory_fd = open("/proc/self/mem", O_RDONLY | O_CLOEXEC);
+    if (memory_fd < 0) {
+        LogError("could not open /proc/self/mem because %s, pages of %p go unchecked", strerror(errno), base);
+        clear();
+        return;
+    }
+    this->base = (uintptr_t)base;
+    this->used = used;
+    this->table.swap(table);
+    std::vector<std::atomic<uint8_t>>(this->table.size()).swap(failures);
+    this->unit = unit;
+}
+
+inline
+void PageChecksums::clear() {
+    unit = 0;
+    used = 0;
+    std::vector<uint32_t>().swap(table);
+    std::vector<std::atomic<uint8_t>>().swap(failures);
+}
+
+inline
+bool PageChecksums::active() const {
+    return unit != 0;
+}
+
+inline
+size_t PageChecksums::getUnit() const {
+    return unit;
+}
+
+inline
+uint64_t PageChecksums::getMismatches() const {
+    return mismatches.load();
+}
+
+inline
+int PageChecksums::getFailures(void* address, size_t bytes) const {
+    if (!active())
+        return 0;
+    size_t start = (uintptr_t)address - base;
+    size_t end = std::min(start + bytes, used);
+    int most = 0;
+    for (size_t offset = start; offset < end; offset += unit) {
+        most = std::max(most, (int)failures[offset / unit].load(std::memory_order_relaxed));
+    }
+    return most;
+}
+
+inline
+bool PageChecksums::verify(void* address, size_t bytes, const void* data) {
+    if (!active())
+        return true;
+    size_t start = (uintptr_t)address - base;
+    size_t end = std::min(start + bytes, used);
+    for (size_t offset = start; offset < end; offset += unit) {
+        size_t length = std::min(unit, used - offset);
+        uint32_t crc = 0;
+        if (data != nullptr) {
+            crc = CRC32C::compute((const char*)data + (offset - start), length);
+        } else if (!read_crc(base + offset, length, &crc)) {
+            LogError("could not read back %zu bytes at %p to check them", length, (void*)(base + offset));
+            return true;
+        }
+        if (crc != table[offset / unit]) {
+            mismatches.fetch_add(1, std::memory_order_relaxed);
+            std::atomic<uint8_t>& failed = failures[offset / unit];
+            if (failed.load(std::memory_order_relaxed) < UINT8_MAX)
+                failed.fetch_add(1, std::memory_order_relaxed);
+            return false;
+        }
+    }
+    return true;
+}
+
+inline
+bool PageChecksums::read_crc(uintptr_t address, size_t bytes, uint32_t* crc) {
+    static thread_local char scratch[SCRATCH_BYTES];
+    *crc = 0;
+    for (size_t done = 0; done < bytes; ) {
+        ssize_t got = pread(memory_fd, scratch, std::min(SCRATCH_BYTES, bytes - done), (off_t)(address + done));
+        if (got <= 0)
+            return false;
+        *crc = CRC32C::extend(*crc, scratch, got);
+        done += got;
+    }
+    return true;
+}
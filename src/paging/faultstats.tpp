@@ -0,0 +1,134 @@
+// faultstats.tpp
+
+inline
+LatencyHistogram::LatencyHistogram() {
+    reset();
+}
+
+inline
+void LatencyHistogram::reset() {
+    for (int i=0; i<NUM_BUCKETS; i++) {
+        buckets[i].store(0, std::memory_order_relaxed);
+    }
+    total.store(0, std::memory_order_relaxed);
+    sum.store(0, std::memory_order_relaxed);
+    max_ns.store(0, std::memory_order_relaxed);
+}
+
+inline
+int64_t LatencyHistogram::now() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+inline
+int LatencyHistogram::bucket(int64_t ns) {
+    if (ns < SUB_BUCKETS)
+        return ns < 0 ? 0 : (int)ns;
+    int msb = 63 - __builtin_clzll((unsigned long long)ns);
+    if (msb >= MAX_BITS)
+        return NUM_BUCKETS - 1;
+    int shift = msb - SUB_BITS;
+    return (shift + 1) * SUB_BUCKETS + (int)((ns >> shift) & (SUB_BUCKETS - 1));
+}
+
+inline
+int64_t LatencyHistogram::bucketUpper(int bucket) {
+    if (bucket < SUB_BUCKETS)
+        return bucket;
+    int shift = bucket / SUB_BUCKETS - 1;
+    int64_t mantissa = SUB_BUCKETS + bucket % SUB_BUCKETS;
+    return ((mantissa + 1) << shift) - 1;
+}
+
+inline
+void LatencyHistogram::record(int64_t ns) {
+    buckets[bucket(ns)].fetch_add(1, std::memory_order_relaxed);
+    total.fetch_add(1, std::memory_order_relaxed);
+    sum.fetch_add(ns < 0 ? 0 : (uint64_t)ns, std::memory_order_relaxed);
+    int64_t seen = max_ns.load(std::memory_order_relaxed);
+    while (ns > seen && !max_ns.compare_exchange_weak(seen, ns, std::memory_order_relaxed)) {}
+}
+
+inline
+uint64_t LatencyHistogram::count() const {
+    return total.load(std::memory_order_relaxed);
+}
+
+inline
+int64_t LatencyHistogram::max() const {
+    return max_ns.load(std::memory_order_relaxed);
+}
+
+inline
+double LatencyHistogram::mean() const {
+    uint64_t n = count();
+    return n == 0 ? 0 : (double)sum.load(std::memory_order_relaxed) / n;
+}
+
+inline
+int64_t LatencyHistogram::percentile(double q) const {
+    // count from the buckets, total may be ahead of them while a record is half done
+    uint64_t n = 0;
+    for (int i=0; i<NUM_BUCKETS; i++) {
+        n += buckets[i].load(std::memory_order_relaxed);
+    }
+    if (n == 0)
+        return 0;
+    uint64_t rank = (uint64_t)(q * n);
+    if (rank >= n)
+        rank = n - 1;
+    uint64_t seen = 0;
+    int i = 0;
+    for (; i<NUM_BUCKETS; i++) {
+        seen += buckets[i].load(std::memory_order_relaxed);
+        if (seen > rank)
+            break;
+    }
+    // the top bucket is wide, never report more than was recorded
+    int64_t upper = bucketUpper(i < NUM_BUCKETS ? i : NUM_BUCKETS - 1);
+    return upper < max() ? upper : max();
+}
+
+inline
+void LatencyHistogram::write(FILE* out) const {
+    fprintf(out, "{\"count\":%lu,\"mean\":%.1f,\"p50\":%ld,\"p90\":%ld,\"p99\":%ld,\"p999\":%ld,\"max\":%ld,\"buckets\":[",
+        (unsigned long)count(), mean(), (long)percentile(0.5), (long)percentile(0.9),
+        (long)percentile(0.99), (long)percentile(0.999), (long)max());
+    bool first = true;
+    for (int i=0; i<NUM_BUCKETS; i++) {
+        uint32_t hits = buckets[i].load(std::memory_order_relaxed);
+        if (hits == 0)
+            continue;
+        fprintf(out, "%s[%ld,%u]", first ? "" : ",", (long)bucketUpper(i), hits);
+        first = false;
+    }
+    fprintf(out, "]}");
+}
+
+inline
+SegmentStats::SegmentStats() : retries(0), write_faults(0) {}
+
+inline
+void SegmentStats::reset() {
+    faults.reset();
+    pulls.reset();
+    pushes.reset();
+    protects.reset();
+    retries.store(0);
+    write_faults.store(0);
+}
+
+inline
+void SegmentStats::write(FILE* out) const {
+    fprintf(out, "\"faults\":");
+    faults.write(out);
+    fprintf(out, ",\"pulls\":");
+    pulls.write(out);
+    fprintf(out, ",\"pushes\":");
+    pushes.write(out);
+    fprintf(out, ",\"protects\":");
+    protects.write(out);
+    fprintf(out, ",\"retries\":%lu,\"write_faults\":%lu",
+        (unsigned long)retries.load(), (unsigned long)write_faults.load());
+}
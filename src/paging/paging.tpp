@@ -1,7 +1,9 @@
 // paging.tpp
 
+static_assert(sizeof(std::atomic<uint32_t>) == sizeof(int), "page state words must be futex words");
+
 inline
-Pages::Pages(uintptr_t start_address, size_t memory_size, size_t page_size) : local_pages(0) {
+Pages::Pages(uintptr_t start_address, size_t memory_size, size_t page_size) : local_pages(0), waiters(0) {
     this->start_address = start_address;
     this->memory_size = memory_size;
     this->end_address = (uintptr_t)((char*) start_address + memory_size);
@@ -9,11 +11,37 @@ Pages::Pages(uintptr_t start_address, size_t memory_size, size_t page_size) : lo
 
     this->num_pages = (memory_size % page_size == 0) ? memory_size/page_size : memory_size/page_size + 1;
 
-    this->pages = vector<Page>(num_pages);
+    this->num_words = (num_pages + PAGES_PER_WORD - 1) / PAGES_PER_WORD;
+    this->states = allocateStates(num_pages, num_words);
+}
+
+inline
+std::atomic<uint32_t>* Pages::allocateStates(int num_pages, int num_words) {
+    std::atomic<uint32_t>* states = new std::atomic<uint32_t>[num_words > 0 ? num_words : 1];
+    for (int i=0; i<num_words; i++) {
+        states[i].store(0, std::memory_order_relaxed);
+    }
+    // the slots past the last page read as Local so remote scans never stop on them
+    for (int id = num_pages; id < num_words * PAGES_PER_WORD; id++) {
+        states[id / PAGES_PER_WORD].fetch_or((uint32_t)PageState::Local << fieldShift(id), std::memory_order_relaxed);
+    }
+    return states;
+}
+
+inline
+Pages::~Pages() {
+    delete[] states;
+}
+
+inline
+int Pages::fieldShift(int page_id) {
+    return (page_id % PAGES_PER_WORD) * 2;
 }
 
 inline
-Pages::~Pages() {}
+uint32_t Pages::fieldMask(int page_id) {
+    return (uint32_t)3 << fieldShift(page_id);
+}
 
 inline
 void* Pages::getPageAddress(int page_id){
@@ -23,7 +51,14 @@ void* Pages::getPageAddress(int page_id){
 
 inline
 void* Pages::getPageAddress(void* address){
-    return (void*) ((uintptr_t)address & ~(page_size - 1));
+    // pages are cut from the start of the segment, which need not be aligned to a large page size
+    uintptr_t offset = ((uintptr_t)address - start_address) & ~(page_size - 1);
+    return (void*)(start_address + offset);
+}
+
+inline
+int Pages::getPageId(void* address){
+    return ((uintptr_t)address - start_address)/page_size;
 }
 
 inline
@@ -35,9 +70,10 @@ size_t Pages::getPageSize(int page_id) {
 
 inline
 size_t Pages::getPageSize(void* address) {
-    uintptr_t end_of_page = (uintptr_t) ((char*)address + page_size);
-    if(end_of_page > end_address )
-        return (end_of_page - end_address);
+    // the last page stops at the end of the segment
+    uintptr_t page_start = (uintptr_t)getPageAddress(address);
+    if(page_start + page_size > end_address)
+        return end_address - page_start;
     return page_size;
 }
 
@@ -46,42 +82,212 @@ size_t Pages::getPageSize() {
     return page_size;
 }
 
+inline
+size_t Pages::stateBytes() {
+    return num_words * sizeof(std::atomic<uint32_t>);
+}
+
+inline
+int Pages::mappingCount() {
+    FILE* maps = fopen("/proc/self/maps", "r");
+    if (maps == nullptr)
+        return -1;
+    int count = 0;
+    char line[512];
+    while (fgets(line, sizeof(line), maps) != nullptr) {
+        uintptr_t low = 0;
+        uintptr_t high = 0;
+        if (sscanf(line, "%lx-%lx", &low, &high) != 2)
+            continue;
+        if (low < end_address && high > start_address)
+            count++;
+    }
+    fclose(maps);
+    return count;
+}
+
 inline
 void Pages::setPageState(int page_id, PageState state){
-    pages.at(page_id).ps.store(state);
-    if(state == PageState::Local)
+    std::atomic<uint32_t>& word = states[page_id / PAGES_PER_WORD];
+    uint32_t mask = fieldMask(page_id);
+    uint32_t value = (uint32_t)state << fieldShift(page_id);
+    uint32_t old_word = word.load();
+    while (!word.compare_exchange_weak(old_word, (old_word & ~mask) | value)) {}
+
+    PageState old_state = (PageState)((old_word & mask) >> fieldShift(page_id));
+    countTransition(old_state, state);
+    if(old_state == PageState::InFlight && state != PageState::InFlight)
+        wakePage(page_id);
+}
+
+// Local and Dirty are both 1x, only a change of that bit moves local_pages
+inline
+void Pages::countTransition(PageState old_state, PageState new_state){
+    bool was_local = ((int)old_state & 2) != 0;
+    bool is_local = ((int)new_state & 2) != 0;
+    if(is_local && !was_local)
         local_pages.fetch_add(1, std::memory_order_relaxed);
+    else if(was_local && !is_local)
+        local_pages.fetch_sub(1, std::memory_order_relaxed);
 }
 
 inline
 void Pages::setPageState(void* address, PageState state){
     int page_id = ((uintptr_t)address - start_address)/page_size;
-    pages.at(page_id).ps.store(state);
-    if(state == PageState::Local)
-        local_pages.fetch_add(1, std::memory_order_relaxed);
+    setPageState(page_id, state);
 }
 
+/*
+    retries only when another page of the same word changed under us,
+    fails as soon as this page is no longer in old_state
+*/
 inline
 bool Pages::setPageStateCAS(void* address, PageState old_state, PageState new_state){
     int page_id = ((uintptr_t)address - start_address)/page_size;
-    bool ret = pages.at(page_id).ps.compare_exchange_weak(old_state, new_state);
-    if(ret && new_state == PageState::Local)
-        local_pages.fetch_add(1, std::memory_order_relaxed);
+    std::atomic<uint32_t>& word = states[page_id / PAGES_PER_WORD];
+    uint32_t mask = fieldMask(page_id);
+    uint32_t expected = (uint32_t)old_state << fieldShift(page_id);
+    uint32_t value = (uint32_t)new_state << fieldShift(page_id);
+
+    uint32_t old_word = word.load();
+    bool ret = false;
+    while ((old_word & mask) == expected) {
+        if (word.compare_exchange_weak(old_word, (old_word & ~mask) | value)) {
+            ret = true;
+            break;
+        }
+    }
+    if(ret)
+        countTransition(old_state, new_state);
+    if(ret && old_state == PageState::InFlight && new_state != PageState::InFlight)
+        wakePage(page_id);
     return ret;
 }
 
+/*
+    the waiter registers before it checks the state and the setter stores the state before
+    it checks for waiters, both sequentially consistent, so one of them always sees the other
+    the futex compares the whole word, any change to a neighbour just makes the wait return early
+*/
+inline
+void Pages::waitForPage(void* address){
+    int page_id = ((uintptr_t)address - start_address)/page_size;
+    std::atomic<uint32_t>& word = states[page_id / PAGES_PER_WORD];
+    uint32_t mask = fieldMask(page_id);
+    uint32_t in_flight = (uint32_t)PageState::InFlight << fieldShift(page_id);
+    waiters.fetch_add(1);
+    uint32_t current;
+    while (((current = word.load()) & mask) == in_flight) {
+        // returns straight away if the word no longer reads current
+        syscall(SYS_futex, (int*)&word, FUTEX_WAIT_PRIVATE, (int)current, NULL, NULL, 0);
+    }
+    waiters.fetch_sub(1);
+}
+
+// wakes every sleeper on the word, those waiting on a neighbour go back to sleep
+inline
+void Pages::wakePage(int page_id){
+    if (waiters.load() == 0)
+        return;
+    syscall(SYS_futex, (int*)&states[page_id / PAGES_PER_WORD], FUTEX_WAKE_PRIVATE, INT_MAX, NULL, NULL, 0);
+}
+
 inline
 PageState Pages::getPageState(int page_id){
-    return pages.at(page_id).ps;
+    uint32_t word = states[page_id / PAGES_PER_WORD].load();
+    return (PageState)((word & fieldMask(page_id)) >> fieldShift(page_id));
 }
 
 inline
 PageState Pages::getPageState(void* address){
     int page_id = ((uintptr_t)address - start_address)/page_size;
-    return pages.at(page_id).ps;
+    return getPageState(page_id);
 }
 
 inline
-void Pages::setPageSize(size_t page_size){
+int Pages::find_next_remote(int start){
+    return find_next(start, PageState::Remote);
+}
+
+inline
+int Pages::find_next(int start, PageState state){
+    if (start < 0)
+        start = 0;
+    if (start >= num_pages)
+        return num_pages;
+
+    // state copied into every field, matching fields xor to 00
+    uint32_t pattern = (uint32_t)state * 0x55555555u;
+    unsigned int w = (unsigned int)start / PAGES_PER_WORD;
+    // pages before start in the first word do not count
+    uint32_t match = ~0u << (((unsigned int)start % PAGES_PER_WORD) * 2);
+    for (; w < (unsigned int)num_words; w++) {
+        uint32_t word = states[w].load(std::memory_order_relaxed) ^ pattern;
+        // low bit of every field whose two bits are both clear
+        match &= ~(word | (word >> 1)) & 0x55555555u;
+        if (match != 0) {
+            int id = w * PAGES_PER_WORD + __builtin_ctz(match) / 2;
+            return id < num_pages ? id : num_pages;
+        }
+        match = ~0u;
+    }
+    return num_pages;
+}
+
+inline
+bool Pages::validPageSize(size_t page_size){
+    return page_size >= MIN_PAGE_SIZE && page_size <= MAX_PAGE_SIZE && (page_size & (page_size - 1)) == 0;
+}
+
+inline
+bool Pages::setPageSize(size_t page_size){
+    if (!validPageSize(page_size)) {
+        LogError("page size %zu is not a power of two between %zu and %zu", page_size, MIN_PAGE_SIZE, MAX_PAGE_SIZE);
+        return false;
+    }
+    if (page_size == this->page_size)
+        return true;
+
+    int new_pages = (memory_size % page_size == 0) ? memory_size/page_size : memory_size/page_size + 1;
+    int new_words = (new_pages + PAGES_PER_WORD - 1) / PAGES_PER_WORD;
+    std::atomic<uint32_t>* new_states = allocateStates(new_pages, new_words);
+
+    int new_local = 0;
+    for (int id = 0; id < new_pages; id++) {
+        uintptr_t offset = (uintptr_t)id * page_size;
+        size_t bytes = (offset + page_size > memory_size) ? memory_size - offset : page_size;
+        int first = offset / this->page_size;
+        int last = (offset + bytes - 1) / this->page_size;
+        bool any_local = false;
+        bool any_remote = false;
+        for (int old_id = first; old_id <= last; old_id++) {
+            PageState state = getPageState(old_id);
+            if (state == PageState::Local) {
+                any_local = true;
+            } else if (state == PageState::Remote) {
+                any_remote = true;
+            } else {
+                LogError("cannot change the page size while page %d is in flight or dirty", old_id);
+                delete[] new_states;
+                return false;
+            }
+        }
+        if (any_local && any_remote) {
+            LogError("page %d of %zu bytes would cover local and remote bytes", id, page_size);
+            delete[] new_states;
+            return false;
+        }
+        if (any_local) {
+            new_states[id / PAGES_PER_WORD].fetch_or((uint32_t)PageState::Local << fieldShift(id), std::memory_order_relaxed);
+            new_local++;
+        }
+    }
+
+    delete[] states;
+    this->states = new_states;
+    this->num_pages = new_pages;
+    this->num_words = new_words;
     this->page_size = page_size;
+    local_pages.store(new_local);
+    return true;
 }
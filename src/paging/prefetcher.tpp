@@ -0,0 +1,60 @@
+// prefetcher.tpp
+
+inline
+FaultPrefetcher::FaultPrefetcher() :
+    faults(0),
+    issued(0),
+    hits(0),
+    busy(false),
+    last_page(0),
+    candidate(0),
+    stride(0),
+    window(0),
+    next_page(0) {}
+
+inline
+int FaultPrefetcher::onFault(int page_id, int num_pages, int* first, int* stride_out) {
+    if (busy.exchange(true, std::memory_order_acquire))
+        return 0;
+    faults++;
+
+    int delta = page_id - last_page;
+    // on the pattern and no further than one step past the readahead
+    bool hit = stride != 0 && delta != 0 && (delta > 0) == (stride > 0) &&
+        delta % stride == 0 && delta / stride <= window + 1;
+
+    if (hit) {
+        hits++;
+        window = window * 2 > MAX_WINDOW ? MAX_WINDOW : window * 2;
+    } else if (delta != 0 && delta == candidate) {
+        stride = delta;
+        window = MIN_WINDOW;
+        next_page = page_id + stride;
+    } else {
+        candidate = delta;
+        window /= 2;
+        if (window == 0)
+            stride = 0;
+    }
+    last_page = page_id;
+
+    int count = 0;
+    if (stride != 0 && window > 0) {
+        // skip pages an earlier readahead already covers
+        int start = page_id + stride;
+        if (hit && (next_page - start) / stride > 0)
+            start = next_page;
+        int end = page_id + stride * (window + 1);
+        for (int page = start; page != end; page += stride) {
+            if (page < 0 || page >= num_pages)
+                break;
+            count++;
+        }
+        *first = start;
+        *stride_out = stride;
+        next_page = end;
+    }
+
+    busy.store(false, std::memory_order_release);
+    return count;
+}
@@ -0,0 +1,92 @@
+// pulljob.tpp
+
+inline
+PullJob::PullJob(Pages& pages, SegmentStats& stats, PageChecksums& checksums)
+    : pages(pages), stats(stats), checksums(checksums), next_chunk(0) {
+    chunk_pages = std::max((size_t)1, CHUNK_BYTES / pages.getPageSize());
+    num_chunks = (pages.num_pages + chunk_pages - 1) / chunk_pages;
+}
+
+inline
+bool PullJob::next(int* first, int* last) {
+    int chunk = next_chunk.fetch_add(1);
+    if (chunk >= num_chunks)
+        return false;
+    *first = chunk * chunk_pages;
+    *last = std::min(*first + chunk_pages, pages.num_pages);
+    return true;
+}
+
+inline
+int PullJob::claim(int first, int last) {
+    int count = 0;
+    size_t bytes = 0;
+    for (int id = first; id < last && bytes < MAX_READ; id++) {
+        if (!pages.setPageStateCAS(pages.getPageAddress(id), PageState::Remote, PageState::InFlight))
+            break;
+        bytes += pages.getPageSize(id);
+        count++;
+    }
+    return count;
+}
+
+inline
+size_t PullJob::runBytes(int first, int count) {
+    int end = first + count - 1;
+    return (uintptr_t)pages.getPageAddress(end) + pages.getPageSize(end) - (uintptr_t)pages.getPageAddress(first);
+}
+
+inline
+void PullJob::complete(void* data) {
+    Read* read = (Read*)data;
+    PullJob* job = read->job;
+
+    if (job->checksums.active()) {
+        resolve_checked(read);
+    } else {
+        // unprotect before publishing Local, woken faulters retry the access straight away
+        if(mprotect(job->pages.getPageAddress(read->first), job->runBytes(read->first, read->count), LOCAL_PAGE_PROTECTION)) {
+            perror("couldnt mprotect a pulled run of pages");
+            exit(errno);
+        }
+        for (int id = read->first; id < read->first + read->count; id++) {
+            job->pages.setPageState(id, PageState::Local);
+        }
+    }
+    job->stats.pulls.record(LatencyHistogram::now() - read->start);
+
+    read->slots->fetch_sub(1);
+    // last, the worker may return as soon as its window is empty
+    read->window->fetch_sub(1);
+    delete read;
+}
+
+/*
+    matching pages are unprotected a stretch at a time, a page that does not match stays
+    protected and turns Remote, which also wakes whoever waits on it to fault it in again
+*/
+inline
+void PullJob::resolve_checked(Read* read) {
+    PullJob* job = read->job;
+    int end = read->first + read->count;
+    int stretch = read->first;
+    for (int id = read->first; id <= end; id++) {
+        bool bad = id < end && !job->checksums.verify(job->pages.getPageAddress(id), job->pages.getPageSize(id));
+        if (id < end && !bad)
+            continue;
+        if (id > stretch) {
+            if(mprotect(job->pages.getPageAddress(stretch), job->runBytes(stretch, id - stretch), LOCAL_PAGE_PROTECTION)) {
+                perror("couldnt mprotect a pulled run of pages");
+                exit(errno);
+            }
+            for (int page = stretch; page < id; page++) {
+                job->pages.setPageState(page, PageState::Local);
+            }
+        }
+        if (bad) {
+            LogError("page %d does not match its checksum, it goes back to Remote", id);
+            job->pages.setPageState(id, PageState::Remote);
+        }
+        stretch = id + 1;
+    }
+}
@@ -0,0 +1,71 @@
+// runbatch.tpp
+
+inline
+PageRunBatch::PageRunBatch() : start(0), end(0), outstanding(0), protect_calls(0) {}
+
+inline
+void PageRunBatch::expect() {
+    outstanding.fetch_add(1);
+}
+
+inline
+void PageRunBatch::complete(Pages& pages, void* address) {
+    std::lock_guard<std::mutex> guard(lock);
+    add_locked(pages, pages.getPageId(address));
+    // nothing else will arrive to extend the run
+    if (outstanding.fetch_sub(1) == 1)
+        flush_locked(pages);
+}
+
+inline
+void PageRunBatch::add(Pages& pages, void* address) {
+    std::lock_guard<std::mutex> guard(lock);
+    add_locked(pages, pages.getPageId(address));
+}
+
+inline
+void PageRunBatch::abandon(Pages& pages, void* address) {
+    std::lock_guard<std::mutex> guard(lock);
+    pages.setPageState(address, PageState::Remote);
+    if (outstanding.fetch_sub(1) == 1)
+        flush_locked(pages);
+}
+
+inline
+void PageRunBatch::flush(Pages& pages) {
+    std::lock_guard<std::mutex> guard(lock);
+    flush_locked(pages);
+}
+
+inline
+uint64_t PageRunBatch::getProtectCalls() const {
+    return protect_calls.load();
+}
+
+inline
+void PageRunBatch::add_locked(Pages& pages, int page_id) {
+    if (start != end && page_id != end)
+        flush_locked(pages);
+    if (start == end)
+        start = page_id;
+    end = page_id + 1;
+    if (end - start >= MAX_RUN)
+        flush_locked(pages);
+}
+
+inline
+void PageRunBatch::flush_locked(Pages& pages) {
+    if (start == end)
+        return;
+    void* first = pages.getPageAddress(start);
+    size_t bytes = (uintptr_t)pages.getPageAddress(end - 1) + pages.getPageSize(end - 1) - (uintptr_t)first;
+    if(mprotect(first, bytes, LOCAL_PAGE_PROTECTION)) {
+        perror("couldnt mprotect a run of pages");
+        exit(errno);
+    }
+    protect_calls++;
+    for (int id = start; id < end; id++) {
+        pages.setPageState(id, PageState::Local);
+    }
+    start = end = 0;
+}
@@ -0,0 +1,110 @@
+// scheduler.tpp
+
+inline
+PrefetchScheduler::PrefetchScheduler() :
+    in_flight(0),
+    demand(0),
+    depth(max_async_pending),
+    credit(0),
+    floor_ns(INT64_MAX),
+    slow_faults(0) {}
+
+inline
+int64_t PrefetchScheduler::now() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+inline
+int64_t PrefetchScheduler::demandBegin() {
+    demand.fetch_add(1);
+    return now();
+}
+
+inline
+int64_t PrefetchScheduler::demandEnd(int64_t start, bool pulled) {
+    int64_t latency = now() - start;
+    if (pulled) {
+        int64_t floor = floor_ns.load();
+        while (latency < floor && !floor_ns.compare_exchange_weak(floor, latency)) {}
+        if (latency >= floor) {
+            // age the floor slowly so a link that got slower for good does not pin depth at 1
+            floor_ns.store(floor + (latency - floor) / 256);
+        }
+
+        if (floor != INT64_MAX && latency > floor * SLOWDOWN) {
+            slow_faults++;
+            int d = depth.load();
+            depth.store(d / 2 > MIN_DEPTH ? d / 2 : MIN_DEPTH);
+            credit.store(0);
+        }
+    }
+    demand.fetch_sub(1);
+    return latency;
+}
+
+inline
+void PrefetchScheduler::admitted() {
+    #if PRIORITY_PREFETCHING
+    int d = depth.load();
+    if (credit.fetch_add(1) + 1 >= d) {
+        credit.store(0);
+        if (d < max_async_pending)
+            depth.store(d + 1);
+    }
+    #endif
+}
+
+inline
+bool PrefetchScheduler::tryAcquire() {
+    #if PRIORITY_PREFETCHING
+    if (demand.load() != 0)
+        return false;
+    int64_t current = in_flight.load();
+    if (current >= depth.load() || !in_flight.compare_exchange_strong(current, current + 1))
+        return false;
+    #else
+    if (in_flight.fetch_add(1) >= max_async_pending) {
+        in_flight.fetch_sub(1);
+        return false;
+    }
+    #endif
+    admitted();
+    return true;
+}
+
+inline
+void PrefetchScheduler::acquire() {
+    while (!tryAcquire()) {
+        std::this_thread::yield();
+    }
+}
+
+inline
+void PrefetchScheduler::release() {
+    in_flight.fetch_sub(1);
+}
+
+inline
+void PrefetchScheduler::yieldToDemand() {
+    #if PRIORITY_PREFETCHING
+    while (demand.load() != 0) {
+        std::this_thread::yield();
+    }
+    #endif
+}
+
+inline
+int PrefetchScheduler::getDepth() const {
+    return depth.load();
+}
+
+inline
+int64_t PrefetchScheduler::getFloor() const {
+    return floor_ns.load();
+}
+
+inline
+uint64_t PrefetchScheduler::getSlowFaults() const {
+    return slow_faults.load();
+}
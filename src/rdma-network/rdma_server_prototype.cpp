@@ -2,6 +2,7 @@
 
 #include <cstring>
 
+#include <algorithm>
 #include <iostream>
 #include <string>
 
@@ -58,12 +59,58 @@ void RDMAServerPrototype::register_memory(
 }
 
 
+void RDMAServerPrototype::register_memory_many(
+    uintptr_t conn_id, const std::vector<std::pair<void*, size_t>>& regions, bool remote_access
+) {
+    std::lock_guard<std::mutex> guard(user_mutex);
+    struct rdma_connection* conn = (struct rdma_connection*)conn_id;
+
+    int access_flags = IBV_ACCESS_LOCAL_WRITE;
+    if (remote_access) access_flags =
+        access_flags | IBV_ACCESS_REMOTE_READ | IBV_ACCESS_REMOTE_WRITE;
+
+    // neighbours have to be next to each other to be merged, whatever order they came in
+    std::vector<std::pair<void*, size_t>> sorted(regions);
+    std::sort(sorted.begin(), sorted.end());
+
+    size_t first = 0;
+    while (first < sorted.size()) {
+        char* start = (char*)sorted[first].first;
+        char* end = start + sorted[first].second;
+        size_t last = first + 1;
+        while (last < sorted.size() && (char*)sorted[last].first == end) {
+            end += sorted[last].second;
+            last++;
+        }
+
+        struct ibv_mr* registration;
+        ASSERT_NONZERO(registration = ibv_reg_mr(resources->protection_domain, start, end - start, access_flags));
+        for (size_t i = first; i < last; i++) {
+            conn->registrations[sorted[i].first] = registration;
+        }
+        conn->shared_registrations[registration] = last - first;
+        first = last;
+    }
+}
+
+
 void RDMAServerPrototype::deregister_memory(uintptr_t conn_id, void* addr) {
     std::lock_guard<std::mutex> guard(user_mutex);
     struct rdma_connection* conn = (struct rdma_connection*)conn_id;
 
-    struct ibv_mr* registration = conn->registrations[addr];
-    conn->registrations.erase(addr);
+    auto it = conn->registrations.find(addr);
+    if (it == conn->registrations.end())
+        return;
+    struct ibv_mr* registration = it->second;
+    conn->registrations.erase(it);
+
+    // a registration shared by a batch stays until its last segment goes
+    auto shared = conn->shared_registrations.find(registration);
+    if (shared != conn->shared_registrations.end()) {
+        if (--shared->second > 0)
+            return;
+        conn->shared_registrations.erase(shared);
+    }
     //ibv_dereg_mr returns an int for success or fail, TODO, add check
     ibv_dereg_mr(registration);
 
@@ -229,6 +276,16 @@ int RDMAServerPrototype::send_accept(
 
 void RDMAServerPrototype::send_transfer(
     uintptr_t conn_id, void* start_addr, size_t len) {
+    send_transfer(conn_id, start_addr, len, len);
+}
+
+void RDMAServerPrototype::send_transfer(
+    uintptr_t conn_id, void* start_addr, size_t len, size_t used) {
+    send_transfer(conn_id, start_addr, len, used, 0);
+}
+
+void RDMAServerPrototype::send_transfer(
+    uintptr_t conn_id, void* start_addr, size_t len, size_t used, size_t page_size) {
     std::lock_guard<std::mutex> guard(user_mutex);
     struct rdma_connection* conn = (struct rdma_connection*)conn_id;
 
@@ -240,13 +297,34 @@ void RDMAServerPrototype::send_transfer(
     rdma_msg.region_info.addr = start_addr;
     rdma_msg.region_info.length = len;
     rdma_msg.region_info.rkey = conn->registrations[start_addr]->rkey;
-    rdma_msg.data_size = 0;
+    memcpy(rdma_msg.data, &used, sizeof(used));
+    memcpy(rdma_msg.data + sizeof(used), &page_size, sizeof(page_size));
+    rdma_msg.data_size = sizeof(used) + sizeof(page_size);
 
     // Send the message.
     post_rdma_send(conn, &rdma_msg, NULL);
     LogInfo("RDMAServerPrototype::send transfer message to client");
 }
 
+void RDMAServerPrototype::send_transfer(
+    uintptr_t conn_id, void* start_addr, size_t len, const char* data, size_t data_size) {
+    std::lock_guard<std::mutex> guard(user_mutex);
+    struct rdma_connection* conn = (struct rdma_connection*)conn_id;
+    LogAssert(data_size <= rdma_message::MAX_DATA_SIZE, "transfer data of %zu bytes exceeds the message", data_size);
+
+    struct rdma_message rdma_msg;
+    memset(&rdma_msg, 0, sizeof(rdma_msg));
+    rdma_msg.message_type = rdma_message::MessageType::MSG_TRANSFER;
+    rdma_msg.region_info.addr = start_addr;
+    rdma_msg.region_info.length = len;
+    rdma_msg.region_info.rkey = conn->registrations[start_addr]->rkey;
+    memcpy(rdma_msg.data, data, data_size);
+    rdma_msg.data_size = data_size;
+
+    post_rdma_send(conn, &rdma_msg, NULL);
+    LogInfo("RDMAServerPrototype::send transfer message to client");
+}
+
 
 void RDMAServerPrototype::send_close(
     uintptr_t conn_id, void* addr, size_t len) {
@@ -266,6 +344,48 @@ void RDMAServerPrototype::send_close(
 }
 
 
+int RDMAServerPrototype::send_prepare_batch(
+    uintptr_t conn_id, const struct rdma_batch_entry* entries, size_t count) {
+    std::lock_guard<std::mutex> guard(user_mutex);
+    struct rdma_connection* conn = (struct rdma_connection*)conn_id;
+
+    struct rdma_message rdma_msg;
+    memset(&rdma_msg, 0, sizeof(rdma_msg));
+    rdma_msg.message_type = rdma_message::MessageType::MSG_PREPARE_BATCH;
+
+    LogInfo("RDMAServerPrototype::send prepare batch of %zu segments to client", count);
+    return post_rdma_batch(conn, &rdma_msg, entries, count, true);
+}
+
+
+int RDMAServerPrototype::send_accept_batch(
+    uintptr_t conn_id, const struct rdma_batch_entry* entries, size_t count) {
+    std::lock_guard<std::mutex> guard(user_mutex);
+    struct rdma_connection* conn = (struct rdma_connection*)conn_id;
+
+    struct rdma_message rdma_msg;
+    memset(&rdma_msg, 0, sizeof(rdma_msg));
+    rdma_msg.message_type = rdma_message::MessageType::MSG_ACCEPT_BATCH;
+
+    LogInfo("RDMAServerPrototype::send accept batch of %zu segments to client", count);
+    return post_rdma_batch(conn, &rdma_msg, entries, count, false);
+}
+
+
+int RDMAServerPrototype::send_transfer_batch(
+    uintptr_t conn_id, const struct rdma_batch_entry* entries, size_t count) {
+    std::lock_guard<std::mutex> guard(user_mutex);
+    struct rdma_connection* conn = (struct rdma_connection*)conn_id;
+
+    struct rdma_message rdma_msg;
+    memset(&rdma_msg, 0, sizeof(rdma_msg));
+    rdma_msg.message_type = rdma_message::MessageType::MSG_TRANSFER_BATCH;
+
+    LogInfo("RDMAServerPrototype::send transfer batch of %zu segments to client", count);
+    return post_rdma_batch(conn, &rdma_msg, entries, count, true);
+}
+
+
 std::pair<void*, size_t> RDMAServerPrototype::receive(uintptr_t conn_id) {
     std::lock_guard<std::mutex> guard(user_mutex);
     struct rdma_connection* conn = (struct rdma_connection*)conn_id;
@@ -298,38 +418,14 @@ void RDMAServerPrototype::rdma_read_async(
     // from our registration information.
     // Since we can, we'll do a lot of error checking here,
     // and make sure that the region is indeed registered.
-    // Also, I know this is runs in time linear wrt number of registrations,
-    // but we expect that number to be very small :)
     uint32_t lkey = 0;
-    bool lkey_found = false;
-    void* local_addr_end = (void*) ((char*)local_addr + len);
-    for (const auto& it : conn->registrations) {
-        void* addr = it.first;
-        void* end_addr = (void*) ((char*)addr + it.second->length);
-        if (local_addr >= addr and local_addr_end <= end_addr) {
-            lkey_found = true;
-            lkey = it.second->lkey;
-            break;
-        }
-    }
-    if (not lkey_found) {
+    if (not find_lkey(conn, local_addr, len, &lkey)) {
         throw std::logic_error(
             "rdma_read called on locally unregistered memory!");
     }
 
     uint32_t rkey = 0;
-    bool rkey_found = false;
-    void* remote_addr_end = (void*) ((char*)remote_addr + len);
-    for (const auto& it : conn->remote_registrations) {
-        void* addr = it.first;
-        void* end_addr = (void*) ((char*)addr + it.second.length);
-        if (remote_addr >= addr and remote_addr_end <= end_addr) {
-            rkey_found = true;
-            rkey = it.second.rkey;
-            break;
-        }
-    }
-    if (not rkey_found) {
+    if (not find_rkey(conn, remote_addr, len, &rkey)) {
         throw std::logic_error(
             "rdma_read called on remotely unregistered memory!");
     }
@@ -354,39 +450,15 @@ int RDMAServerPrototype::rdma_read(
     // from our registration information.
     // Since we can, we'll do a lot of error checking here,
     // and make sure that the region is indeed registered.
-    // Also, I know this is runs in time linear wrt number of registrations,
-    // but we expect that number to be very small :)
     uint32_t lkey = 0;
-    bool lkey_found = false;
-    void* local_addr_end = (void*) ((char*)local_addr + len);
-    for (const auto& it : conn->registrations) {
-        void* addr = it.first;
-        void* end_addr = (void*) ((char*)addr + it.second->length);
-        if (local_addr >= addr and local_addr_end <= end_addr) {
-            lkey_found = true;
-            lkey = it.second->lkey;
-            break;
-        }
-    }
-    if (not lkey_found) {
+    if (not find_lkey(conn, local_addr, len, &lkey)) {
         return -1;
         // throw std::logic_error(
         //     "rdma_read called on locally unregistered memory!");
     }
 
     uint32_t rkey = 0;
-    bool rkey_found = false;
-    void* remote_addr_end = (void*) ((char*)remote_addr + len);
-    for (const auto& it : conn->remote_registrations) {
-        void* addr = it.first;
-        void* end_addr = (void*) ((char*)addr + it.second.length);
-        if (remote_addr >= addr and remote_addr_end <= end_addr) {
-            rkey_found = true;
-            rkey = it.second.rkey;
-            break;
-        }
-    }
-    if (not rkey_found) {
+    if (not find_rkey(conn, remote_addr, len, &rkey)) {
         return -1;
         // throw std::logic_error(
         //     "rdma_read called on remotely unregistered memory!");
@@ -408,35 +480,36 @@ int RDMAServerPrototype::rdma_read(
 }
 
 
-void RDMAServerPrototype::rdma_write(
+int RDMAServerPrototype::rdma_write(
     uintptr_t conn_id, void* local_addr, void* remote_addr, size_t len
 ) {
     std::lock_guard<std::mutex> guard(user_mutex);
     struct rdma_connection* conn = (struct rdma_connection*) conn_id;
 
+    // Same lookups as rdma_read, so that a write can cover any part of a registration.
     uint32_t lkey = 0;
-    ibv_mr* mr_local = conn->registrations[local_addr];
-    lkey = mr_local->lkey;
-
-
+    if (not find_lkey(conn, local_addr, len, &lkey)) {
+        return -1;
+    }
 
     uint32_t rkey = 0;
-    remote_region mr_remote = conn->remote_registrations[remote_addr];
-    rkey = mr_remote.rkey;
+    if (not find_rkey(conn, remote_addr, len, &rkey)) {
+        return -1;
+    }
 
-    // Now we can actually execute the read.
+    // Now we can actually execute the write.
     // Create the semaphore to block on.
     sem_t sem;
     ASSERT_ZERO(sem_init(&sem, 0, 0));
 
-    // Do the read.
+    // Do the write.
     post_rdma_write(conn, local_addr, lkey, remote_addr, rkey, len, &sem);
 
-    // And wait for the read to finish.
+    // And wait for the write to finish.
     sem_wait(&sem);
     sem_destroy(&sem);
 
-    return;
+    return 0;
 }
 
 
@@ -619,8 +692,11 @@ int RDMAServerPrototype::on_disconnect(struct rdma_cm_id* rdma_socket) {
     // Destroy the queue pair.
     rdma_destroy_qp(rdma_socket);
 
-    // Deregister all memory regions.
+    // Deregister all memory regions, the ones shared by a batch only once.
     for (const auto& it : conn->registrations) {
+        auto shared = conn->shared_registrations.find(it.second);
+        if (shared != conn->shared_registrations.end() && --shared->second > 0)
+            continue;
         ibv_dereg_mr(it.second);
     }
 
@@ -643,6 +719,11 @@ void* RDMAServerPrototype::poll_cq() {
     struct ibv_cq *cq;
     struct ibv_wc wc;
     void* cq_context;
+    #if NUMA_PLACEMENT
+        // completions touch the buffers of the reads they finish, stay next to the device
+        if (NumaNode::pinThread(device_numa_node()) != 0)
+            LogInfo("completion thread left unpinned, the device has no known NUMA node");
+    #endif
     while (run) {
         // Wait until the completion channel notifies us.
         // It will fill in the completion queue and context.
@@ -663,6 +744,13 @@ void* RDMAServerPrototype::poll_cq() {
 }
 
 
+int RDMAServerPrototype::device_numa_node() {
+    if (resources == NULL)
+        return NumaNode::UNKNOWN;
+    return NumaNode::ofDevice(ibv_get_device_name(resources->device_context->device));
+}
+
+
 void RDMAServerPrototype::on_completion(struct ibv_wc* work_completion) {
     // TODO: handle this more verbosely. Just for debugging though --
     // we don't intend to allow errors in proper operation.
@@ -847,6 +935,37 @@ void RDMAServerPrototype::on_recv_finish(struct ibv_wc* wc) {
         // // pass it to user to notify the transfer has completed
         // conn->recv_queue.enqueue(
         //     std::pair<void*, size_t>((void*)msg, sizeof(struct rdma_message)));
+    } else if (msg->message_type == msg->MessageType::MSG_PREPARE_BATCH
+        || msg->message_type == msg->MessageType::MSG_ACCEPT_BATCH) {
+        // Rearm the RDMA receive queue as soon as possible.
+        post_rdma_receive(conn);
+        struct rdma_message* msg_for_user = (struct rdma_message*)malloc(sizeof(struct rdma_message));
+        memcpy(msg_for_user, msg, sizeof(struct rdma_message));
+        conn->recv_queue.enqueue(
+            std::pair<void*, size_t>((void*)msg_for_user, sizeof(struct rdma_message)));
+
+    } else if (msg->message_type == msg->MessageType::MSG_TRANSFER_BATCH) {
+        // Rearm the RDMA receive queue as soon as possible.
+        post_rdma_receive(conn);
+        struct rdma_message* msg_for_user = (struct rdma_message*)malloc(sizeof(struct rdma_message));
+        memcpy(msg_for_user, msg, sizeof(struct rdma_message));
+
+        // same as MSG_TRANSFER for every segment in the batch, data_size comes off the wire
+        if (msg_for_user->data_size > MAX_BATCH_ENTRIES * sizeof(struct rdma_batch_entry)) {
+            LogError("batch of %zu bytes is larger than a message, only %zu entries are read",
+                msg_for_user->data_size, MAX_BATCH_ENTRIES);
+            msg_for_user->data_size = MAX_BATCH_ENTRIES * sizeof(struct rdma_batch_entry);
+        }
+        size_t count = msg_for_user->data_size / sizeof(struct rdma_batch_entry);
+        for (size_t i = 0; i < count; i++) {
+            struct rdma_batch_entry entry;
+            memcpy(&entry, msg_for_user->data + i * sizeof(entry), sizeof(entry));
+            conn->remote_registrations[entry.region.addr] = entry.region;
+        }
+
+        conn->recv_queue.enqueue(
+            std::pair<void*, size_t>((void*)msg_for_user, sizeof(struct rdma_message)));
+
     } else if(msg->message_type == msg->MessageType::MSG_DECLINE) {
 
         post_rdma_receive(conn);
@@ -912,6 +1031,12 @@ void RDMAServerPrototype::on_send_finish(struct ibv_wc* wc) {
         LogInfo("completed send on transfer");
     } else if (msg->message_type == msg->MessageType::MSG_DONE_TRANSFER){
         LogInfo("completed send on done");
+    } else if (msg->message_type == msg->MessageType::MSG_PREPARE_BATCH){
+        LogInfo("completed send on prepare batch");
+    } else if (msg->message_type == msg->MessageType::MSG_ACCEPT_BATCH){
+        LogInfo("completed send on accept batch");
+    } else if (msg->message_type == msg->MessageType::MSG_TRANSFER_BATCH){
+        LogInfo("completed send on transfer batch");
     } else if (msg->message_type == msg->MessageType::MSG_GET_PARTITIONS){
         LogInfo("completed send on MSG_GET_PARTITIONS");
     } else if (msg->message_type == msg->MessageType::MSG_SENT_PARTITIONS){
@@ -1060,6 +1185,54 @@ struct ibv_mr* RDMAServerPrototype::register_memory_with_conn(
 }
 
 
+bool RDMAServerPrototype::find_lkey(
+    struct rdma_connection* conn, void* addr, size_t len, uint32_t* lkey
+) {
+    void* end = (void*) ((char*)addr + len);
+    // the registration starting closest below addr covers the range unless registrations
+    // overlap, which is what the scan below is for
+    auto it = conn->registrations.upper_bound(addr);
+    if (it != conn->registrations.begin()) {
+        struct ibv_mr* registration = std::prev(it)->second;
+        if (addr >= registration->addr and end <= (void*) ((char*)registration->addr + registration->length)) {
+            *lkey = registration->lkey;
+            return true;
+        }
+    }
+    for (const auto& it : conn->registrations) {
+        struct ibv_mr* registration = it.second;
+        if (addr >= registration->addr and end <= (void*) ((char*)registration->addr + registration->length)) {
+            *lkey = registration->lkey;
+            return true;
+        }
+    }
+    return false;
+}
+
+
+bool RDMAServerPrototype::find_rkey(
+    struct rdma_connection* conn, void* addr, size_t len, uint32_t* rkey
+) {
+    void* end = (void*) ((char*)addr + len);
+    auto it = conn->remote_registrations.upper_bound(addr);
+    if (it != conn->remote_registrations.begin()) {
+        const struct remote_region& region = std::prev(it)->second;
+        if (addr >= region.addr and end <= (void*) ((char*)region.addr + region.length)) {
+            *rkey = region.rkey;
+            return true;
+        }
+    }
+    for (const auto& it : conn->remote_registrations) {
+        const struct remote_region& region = it.second;
+        if (addr >= region.addr and end <= (void*) ((char*)region.addr + region.length)) {
+            *rkey = region.rkey;
+            return true;
+        }
+    }
+    return false;
+}
+
+
 void RDMAServerPrototype::send_meminfo(
     struct rdma_connection* conn, struct ibv_mr* meminfo
 ) {
@@ -1197,6 +1370,36 @@ void RDMAServerPrototype::post_rdma_read(
 }
 
 
+int RDMAServerPrototype::post_rdma_batch(
+    struct rdma_connection* conn, struct rdma_message* msg,
+    const struct rdma_batch_entry* entries, size_t count, bool with_rkeys
+) {
+    struct rdma_batch_entry packed[MAX_BATCH_ENTRIES];
+    sem_t sem;
+    ASSERT_ZERO(sem_init(&sem, 0, 0));
+
+    int result = 0;
+    for (size_t first = 0; first < count && result == 0; first += MAX_BATCH_ENTRIES) {
+        size_t n = std::min(count - first, MAX_BATCH_ENTRIES);
+        memcpy(packed, entries + first, n * sizeof(struct rdma_batch_entry));
+        for (size_t i = 0; with_rkeys && i < n; i++) {
+            auto it = conn->registrations.find(packed[i].region.addr);
+            packed[i].region.rkey = it != conn->registrations.end() ? it->second->rkey : 0;
+        }
+        memcpy(msg->data, packed, n * sizeof(struct rdma_batch_entry));
+        msg->data_size = n * sizeof(struct rdma_batch_entry);
+
+        // there is one send buffer per connection, the next message can only be copied in once this one is out
+        result = post_rdma_send(conn, msg, &sem);
+        if (result == 0)
+            sem_wait(&sem);
+    }
+
+    sem_destroy(&sem);
+    return result == 0 ? 0 : -1;
+}
+
+
 void RDMAServerPrototype::post_rdma_read(
     struct rdma_connection* conn,
     void* local_addr, uint32_t lkey,
@@ -0,0 +1,146 @@
+#include <stdlib.h>
+
+#include <vector>
+
+#include "distributed-allocator/RunCodec.hpp"
+
+/*
+    local test for the run coding of copied segments, no RDMA connection is needed
+    - an empty input codes to 0 bytes and decodes
+    - zero, repeat and literal runs, and tails shorter than a word, decode to what was coded
+    - a capacity too small for the image gives NO_FIT
+    - a cut or corrupted image, or the wrong raw size, is refused by decode
+    - sample() says zero fill pays and random bytes do not
+*/
+
+static std::vector<char> pattern(size_t bytes) {
+    std::vector<char> data(bytes, 0);
+    size_t third = bytes / 3;
+    // zero run, then a repeated word, then literal words, then zeros up to the tail
+    for (size_t i = third; i < 2 * third; i++) {
+        data[i] = (char)(0x5a + i % 8);
+    }
+    for (size_t i = 2 * third; i < bytes - bytes / 8; i++) {
+        data[i] = (char)rand();
+    }
+    for (size_t i = bytes - bytes % 8; i < bytes; i++) {
+        data[i] = (char)(i + 1);
+    }
+    return data;
+}
+
+static bool round_trip(const std::vector<char>& data) {
+    std::vector<char> coded(data.size() * 2 + 64);
+    size_t size = RunCodec::encode(data.data(), data.size(), coded.data(), coded.size());
+    if (size == RunCodec::NO_FIT) {
+        LogError("%zu bytes did not code into %zu", data.size(), coded.size());
+        return false;
+    }
+    std::vector<char> back(data.size() + 1, 'x');
+    if (!RunCodec::decode(coded.data(), size, back.data(), data.size())) {
+        LogError("%zu bytes coded to %zu do not decode", data.size(), size);
+        return false;
+    }
+    if (memcmp(back.data(), data.data(), data.size()) != 0 || back[data.size()] != 'x') {
+        LogError("%zu bytes coded to %zu decode to something else", data.size(), size);
+        return false;
+    }
+    return true;
+}
+
+static bool empty() {
+    char coded[16];
+    if (RunCodec::encode(nullptr, 0, coded, sizeof(coded)) != 0) {
+        LogError("an empty input does not code to 0 bytes");
+        return false;
+    }
+    if (!RunCodec::decode(coded, 0, nullptr, 0)) {
+        LogError("an empty image does not decode");
+        return false;
+    }
+    return true;
+}
+
+static bool no_fit(const std::vector<char>& data) {
+    std::vector<char> coded(data.size() * 2 + 64);
+    size_t size = RunCodec::encode(data.data(), data.size(), coded.data(), coded.size());
+    if (RunCodec::encode(data.data(), data.size(), coded.data(), size - 1) != RunCodec::NO_FIT) {
+        LogError("a %zu byte image fit in %zu bytes", size, size - 1);
+        return false;
+    }
+    if (RunCodec::encode(data.data(), data.size(), coded.data(), size) != size) {
+        LogError("a %zu byte image did not fit in exactly its size", size);
+        return false;
+    }
+    return true;
+}
+
+static bool malformed(const std::vector<char>& data) {
+    std::vector<char> coded(data.size() * 2 + 64);
+    size_t size = RunCodec::encode(data.data(), data.size(), coded.data(), coded.size());
+    std::vector<char> back(data.size() + 64);
+    if (RunCodec::decode(coded.data(), size - 1, back.data(), data.size())) {
+        LogError("an image cut by a byte decoded");
+        return false;
+    }
+    if (RunCodec::decode(coded.data(), size, back.data(), data.size() - 8)
+        || RunCodec::decode(coded.data(), size, back.data(), data.size() + 8)) {
+        LogError("an image decoded to the wrong raw size");
+        return false;
+    }
+    // kind 3 is not a record
+    uint32_t header;
+    memcpy(&header, coded.data(), sizeof(header));
+    header |= 3;
+    memcpy(coded.data(), &header, sizeof(header));
+    if (RunCodec::decode(coded.data(), size, back.data(), data.size())) {
+        LogError("an image with an unknown record kind decoded");
+        return false;
+    }
+    return true;
+}
+
+static bool sampled() {
+    std::vector<char> zeros(1 << 20, 0);
+    std::vector<char> noise(1 << 20);
+    for (size_t i = 0; i < noise.size(); i++) {
+        noise[i] = (char)rand();
+    }
+    double zero_ratio = RunCodec::sample(zeros.data(), zeros.size());
+    double noise_ratio = RunCodec::sample(noise.data(), noise.size());
+    if (zero_ratio >= 1 || noise_ratio < 1) {
+        LogError("sampled ratios %f for zeros and %f for random bytes", zero_ratio, noise_ratio);
+        return false;
+    }
+    return true;
+}
+
+int main(int argc, char** argv) {
+    srand(7);
+    if (!empty())
+        return 1;
+
+    size_t sizes[] = {1, 7, 8, 9, 24, 4095, 4096, 4097, 65536 + 5};
+    for (size_t bytes : sizes) {
+        if (!round_trip(pattern(bytes)) || !round_trip(std::vector<char>(bytes, 0))
+            || !round_trip(std::vector<char>(bytes, 0x11)))
+            return 1;
+    }
+    std::vector<char> noise(4096 + 3);
+    for (size_t i = 0; i < noise.size(); i++) {
+        noise[i] = (char)rand();
+    }
+    if (!round_trip(noise))
+        return 1;
+
+    std::vector<char> data = pattern(4096 + 3);
+    if (!no_fit(data) || !no_fit(noise))
+        return 1;
+    if (!malformed(data))
+        return 1;
+    if (!sampled())
+        return 1;
+
+    LogInfo("test_RunCodec passed");
+    return 0;
+}
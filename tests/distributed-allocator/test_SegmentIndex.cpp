@@ -0,0 +1,171 @@
+#include <stdlib.h>
+
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
+
+#include "distributed-allocator/SegmentIndex.hpp"
+
+/*
+    local test for the fault handler's segment index, no RDMA connection is needed
+    - find every address of a few segments with gaps between them, and miss the gaps
+    - replace a segment at the same base, remove segments and list the rest in address order
+    - keep lookups going on several threads while a writer removes and inserts segments, every
+      lookup has to see the segment or nothing, never a retired snapshot, and the writer has to
+      finish while the readers never stop
+*/
+
+// the index only stores the pointers
+class RDMAMemory {
+public:
+    int id;
+};
+
+static const uintptr_t BASE = 0x10000000;
+static const uintptr_t SPACING = 0x100000;
+static const size_t SEGMENT_SIZE = 0x10000;
+
+static void* segment_address(int i) {
+    return (void*)(BASE + i * SPACING);
+}
+
+static bool expect(SegmentIndex& index, uintptr_t address, RDMAMemory* memory) {
+    RDMAMemory* found = index.find((void*)address);
+    if (found != memory) {
+        LogError("lookup of %p found segment %d, expected %d", (void*)address,
+            found == nullptr ? -1 : found->id, memory == nullptr ? -1 : memory->id);
+        return false;
+    }
+    return true;
+}
+
+static bool lookups(SegmentIndex& index, RDMAMemory* memories, int count) {
+    if (!expect(index, BASE - 1, nullptr))
+        return false;
+    for (int i=0; i<count; i++) {
+        uintptr_t start = (uintptr_t)segment_address(i);
+        if (!expect(index, start, &memories[i]) || !expect(index, start + SEGMENT_SIZE / 2, &memories[i])
+            || !expect(index, start + SEGMENT_SIZE - 1, &memories[i]) || !expect(index, start + SEGMENT_SIZE, nullptr))
+            return false;
+    }
+    return true;
+}
+
+static bool updates(SegmentIndex& index, RDMAMemory* memories, int count) {
+    // a segment at the same base replaces the old one, with its own size
+    RDMAMemory larger;
+    larger.id = 100;
+    index.insert(segment_address(0), 2 * SEGMENT_SIZE, &larger);
+    if (index.size() != (size_t)count || !expect(index, (uintptr_t)segment_address(0) + SEGMENT_SIZE, &larger))
+        return false;
+    index.insert(segment_address(0), SEGMENT_SIZE, &memories[0]);
+
+    // a segment that ends where the next starts hands the boundary to the next one
+    RDMAMemory before;
+    before.id = 101;
+    index.insert((char*)segment_address(1) - SEGMENT_SIZE, SEGMENT_SIZE, &before);
+    if (!expect(index, (uintptr_t)segment_address(1) - 1, &before) || !expect(index, (uintptr_t)segment_address(1), &memories[1]))
+        return false;
+    index.remove((char*)segment_address(1) - SEGMENT_SIZE);
+
+    for (int i=0; i<count; i+=2) {
+        index.remove(segment_address(i));
+    }
+    // removing what is not indexed changes nothing
+    index.remove(segment_address(0));
+    index.remove((void*)(BASE + 7));
+    if (index.size() != (size_t)count / 2) {
+        LogError("%zu segments left after removing half of %d", index.size(), count);
+        return false;
+    }
+    for (int i=0; i<count; i++) {
+        if (!expect(index, (uintptr_t)segment_address(i) + 1, i % 2 == 0 ? nullptr : &memories[i]))
+            return false;
+    }
+
+    std::vector<RDMAMemory*> listed;
+    index.list(listed);
+    for (size_t i=0; i<listed.size(); i++) {
+        if (listed[i] != &memories[2 * i + 1]) {
+            LogError("segment %zu of the list is %d, expected %d", i, listed[i]->id, memories[2 * i + 1].id);
+            return false;
+        }
+    }
+    return true;
+}
+
+static bool concurrent(int readers, int rounds) {
+    const int count = 64;
+    SegmentIndex index;
+    RDMAMemory memories[count];
+    for (int i=0; i<count; i++) {
+        memories[i].id = i;
+        index.insert(segment_address(i), SEGMENT_SIZE, &memories[i]);
+    }
+
+    std::atomic<bool> stop(false);
+    std::atomic<int> wrong(0);
+    std::atomic<uint64_t> found(0);
+    std::vector<std::thread> threads;
+    for (int t=0; t<readers; t++) {
+        threads.push_back(std::thread([&]() {
+            while (!stop.load()) {
+                for (int i=0; i<count; i++) {
+                    RDMAMemory* memory = index.find((char*)segment_address(i) + 5);
+                    if (memory != nullptr && memory != &memories[i])
+                        wrong.fetch_add(1);
+                    else if (memory != nullptr)
+                        found.fetch_add(1, std::memory_order_relaxed);
+                }
+            }
+        }));
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    for (int k=0; k<rounds; k++) {
+        int i = k % count;
+        index.remove(segment_address(i));
+        index.insert(segment_address(i), SEGMENT_SIZE, &memories[i]);
+    }
+    long ms = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count();
+    stop.store(true);
+    for (std::thread& thread : threads) {
+        thread.join();
+    }
+
+    if (wrong.load() != 0) {
+        LogError("%d lookups found the wrong segment", wrong.load());
+        return false;
+    }
+    if (index.size() != (size_t)count) {
+        LogError("%zu segments indexed after the churn, expected %d", index.size(), count);
+        return false;
+    }
+    LogInfo("%d updates in %ld ms against %d readers, %lu lookups hit",
+        2 * rounds, ms, readers, (unsigned long)found.load());
+    return true;
+}
+
+int main(int argc, char** argv) {
+    const int count = 16;
+    SegmentIndex index;
+    RDMAMemory memories[count];
+    if (!expect(index, BASE, nullptr))
+        return 1;
+    // inserted out of order, the snapshot is sorted
+    for (int i=count-1; i>=0; i--) {
+        memories[i].id = i;
+        index.insert(segment_address(i), SEGMENT_SIZE, &memories[i]);
+    }
+    if (!lookups(index, memories, count))
+        return 1;
+    if (!updates(index, memories, count))
+        return 1;
+
+    if (!concurrent(4, 2000))
+        return 1;
+
+    LogInfo("test_SegmentIndex passed");
+    return 0;
+}
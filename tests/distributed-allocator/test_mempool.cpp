@@ -0,0 +1,275 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include <atomic>
+#include <map>
+#include <random>
+#include <thread>
+#include <vector>
+
+#include "distributed-allocator/mempool.hpp"
+#include "distributed-allocator/magazine.hpp"
+
+/*
+    local test for the in-pool allocator, no RDMA connection is needed
+    - churn random sized blocks and check that live blocks never overlap
+    - check that freeing everything and trimming brings the watermark back down
+    - copy the pool to another address and keep allocating from the copy
+    - grow a pool over a chain of segments through the grow hook
+    - allocate from many threads at once through the magazine caches, and check that exiting
+      threads hand their cached blocks back
+*/
+
+static MemoryPool* make_pool(void* memory, size_t size) {
+    MemoryPool** pool_ = (MemoryPool**)memory;
+    (*pool_) = (MemoryPool*)((char*)memory + sizeof(MemoryPool**));
+    uintptr_t pool_start = (uintptr_t)memory + sizeof(MemoryPool**) + sizeof(MemoryPool) + sizeof(void*);
+    pool_start = (pool_start + MemoryPool::ALIGNMENT - 1) & ~(MemoryPool::ALIGNMENT - 1);
+    new (*pool_) MemoryPool((void*)pool_start, size - (pool_start - (uintptr_t)memory));
+    (*pool_)->size = size;
+    (*pool_)->addr = memory;
+    return *pool_;
+}
+
+static bool churn(MemoryPool* pool, int iterations, std::map<uintptr_t, size_t>& live) {
+    std::mt19937 gen(7);
+    std::uniform_int_distribution<size_t> small(1, MemoryPool::MAX_SMALL_SIZE);
+    std::uniform_int_distribution<size_t> large(MemoryPool::MAX_SMALL_SIZE + 1, 64 * 1024);
+    std::uniform_int_distribution<int> coin(0, 9);
+
+    for (int i=0; i<iterations; i++) {
+        // keep between 256 and 512 blocks live, roughly 3 MB
+        bool grow = live.size() < 256 || (live.size() < 512 && coin(gen) < 5);
+        if (grow) {
+            size_t bytes = coin(gen) == 0 ? large(gen) : small(gen);
+            void* p = pool->allocate(bytes);
+            if (p == nullptr) {
+                LogError("pool exhausted after %d iterations", i);
+                return false;
+            }
+            if ((uintptr_t)p % MemoryPool::ALIGNMENT != 0) {
+                LogError("block %p not aligned", p);
+                return false;
+            }
+            auto next = live.lower_bound((uintptr_t)p);
+            if (next != live.end() && next->first < (uintptr_t)p + bytes) {
+                LogError("block %p overlaps a live block", p);
+                return false;
+            }
+            if (next != live.begin()) {
+                auto prev = std::prev(next);
+                if (prev->first + prev->second > (uintptr_t)p) {
+                    LogError("block %p overlaps a live block", p);
+                    return false;
+                }
+            }
+            memset(p, 0xab, bytes);
+            live[(uintptr_t)p] = bytes;
+        } else {
+            auto it = live.begin();
+            std::advance(it, gen() % live.size());
+            pool->deallocate((void*)it->first, it->second);
+            live.erase(it);
+        }
+    }
+    return true;
+}
+
+static int grow_calls = 0;
+
+// the whole reservation is already backed by the test buffer, just check where the segment goes
+static void* grow_hook(void* context, void* address, size_t size) {
+    MemoryPool* pool = (MemoryPool*)context;
+    if (address != (char*)pool->addr + pool->size) {
+        LogError("segment requested at %p, chain ends at %p", address, (char*)pool->addr + pool->size);
+        return nullptr;
+    }
+    grow_calls++;
+    return address;
+}
+
+static bool grow(void* memory, size_t first_segment, size_t reserved) {
+    MemoryPool* pool = make_pool(memory, first_segment);
+    pool->set_chain(first_segment, reserved);
+    pool->set_grow_hook(grow_hook, (void*)pool);
+
+    // blocks larger than the first segment force a jump straight to a big segment
+    std::vector<std::pair<void*, size_t>> blocks;
+    size_t sizes[] = {64, 3000, 100 * 1024, 2 * first_segment, 512 * 1024};
+    for (int round=0; round<40; round++) {
+        size_t bytes = sizes[round % 5];
+        void* p = pool->allocate(bytes);
+        if (p == nullptr) {
+            LogError("pool did not grow for %zu bytes", bytes);
+            return false;
+        }
+        memset(p, 0xcd, bytes);
+        blocks.push_back(std::make_pair(p, bytes));
+    }
+
+    size_t total = 0;
+    for (int i=0; i<pool->segment_count(); i++) {
+        if (pool->segment_address(i) != (char*)memory + total) {
+            LogError("segment %d is not contiguous", i);
+            return false;
+        }
+        total += pool->segment_size(i);
+    }
+    if (total != pool->size || (char*)pool->unused_past > (char*)memory + total) {
+        LogError("chain of %zu bytes does not cover the pool", total);
+        return false;
+    }
+    LogInfo("pool grew %d times to %d segments, %zu bytes", grow_calls, pool->segment_count(), total);
+
+    // the reservation is a hard limit
+    if (pool->allocate(reserved) != nullptr) {
+        LogError("pool grew past its reservation");
+        return false;
+    }
+
+    for (auto& block : blocks) {
+        pool->deallocate(block.first, block.second);
+    }
+    return pool->in_use() == 0 && grow_calls > 0;
+}
+
+/*
+    every thread stamps its blocks with its id and checks the stamp before freeing,
+    a block handed to two threads at once shows up as a foreign stamp
+*/
+static bool threaded(void* memory, size_t size, int num_threads) {
+    MemoryPool* pool = make_pool(memory, size);
+    std::atomic<int> failures(0);
+    std::vector<std::thread> threads;
+    for (int t=0; t<num_threads; t++) {
+        threads.push_back(std::thread([pool, t, &failures]() {
+            std::mt19937 gen(t);
+            std::uniform_int_distribution<size_t> bytes(16, MemoryPool::MAX_SMALL_SIZE);
+            std::vector<std::pair<unsigned char*, size_t>> live;
+            for (int i=0; i<100000; i++) {
+                if (live.size() < 64 || (live.size() < 256 && gen() % 2 == 0)) {
+                    size_t n = bytes(gen);
+                    unsigned char* p = (unsigned char*)MagazineCache::allocate(pool, n);
+                    if (p == nullptr) {
+                        failures++;
+                        return;
+                    }
+                    memset(p, t + 1, n);
+                    live.push_back(std::make_pair(p, n));
+                } else {
+                    size_t victim = gen() % live.size();
+                    auto block = live[victim];
+                    for (size_t j=0; j<block.second; j++) {
+                        if (block.first[j] != t + 1) {
+                            failures++;
+                            break;
+                        }
+                    }
+                    MagazineCache::deallocate(pool, block.first, block.second);
+                    live[victim] = live.back();
+                    live.pop_back();
+                }
+            }
+            for (auto& block : live) {
+                MagazineCache::deallocate(pool, block.first, block.second);
+            }
+            // no flush, the cache hands its blocks back when the thread exits
+        }));
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    if (failures.load() != 0) {
+        LogError("%d blocks were handed out twice or not at all", failures.load());
+        return false;
+    }
+    LogInfo("%d threads done, %zu bytes parked in magazines, watermark at %zu bytes", num_threads,
+        pool->in_use(), (size_t)((char*)pool->unused_past - (char*)pool->pool_addr));
+
+    // everything not in the depot went back to the pool when the threads exited
+    for (int c=0; c<MemoryPool::NUM_SIZE_CLASSES; c++) {
+        for (uint64_t magazine = pool->pop_magazine(c); magazine != 0; magazine = pool->pop_magazine(c)) {
+            for (int i=0; i<MemoryPool::magazine_size(c); i++) {
+                void* block = pool->from_offset(magazine);
+                magazine = *((uint64_t*)block);
+                pool->deallocate(block, MemoryPool::class_size(c));
+            }
+        }
+    }
+    if (pool->in_use() != 0) {
+        LogError("%zu bytes left in thread caches after the threads exited", pool->in_use());
+        return false;
+    }
+    return true;
+}
+
+int main(int argc, char** argv) {
+    size_t size = (size_t)16 * 1024 * 1024;
+    void* memory = aligned_alloc(4096, size);
+    MemoryPool* pool = make_pool(memory, size);
+    void* start = pool->unused_past;
+
+    std::map<uintptr_t, size_t> live;
+    // far more traffic than the pool could hold with a bump allocator
+    if (!churn(pool, 200000, live)) {
+        return 1;
+    }
+    LogInfo("after churn %zu live blocks, %zu bytes in use, watermark at %zu bytes",
+        live.size(), pool->in_use(), (size_t)((char*)pool->unused_past - (char*)start));
+
+    // relocate, offsets are relative to the pool so the copy keeps working
+    void* copy = aligned_alloc(4096, size);
+    memcpy(copy, memory, size);
+    MemoryPool* moved = (MemoryPool*)((char*)copy + sizeof(MemoryPool**));
+    ptrdiff_t delta = (char*)copy - (char*)memory;
+    moved->pool_addr = (char*)moved->pool_addr + delta;
+    moved->unused_past = (char*)moved->unused_past + delta;
+    moved->addr = copy;
+    std::map<uintptr_t, size_t> moved_live;
+    for (auto& it : live) {
+        moved_live[it.first + delta] = it.second;
+    }
+    if (!churn(moved, 50000, moved_live)) {
+        return 1;
+    }
+
+    for (auto& it : moved_live) {
+        moved->deallocate((void*)it.first, it.second);
+    }
+    if (moved->in_use() != 0) {
+        LogError("%zu bytes still in use after freeing everything", moved->in_use());
+        return 1;
+    }
+    size_t high = (size_t)((char*)moved->unused_past - (char*)moved->pool_addr);
+    size_t trimmed = moved->trim();
+    if (moved->unused_past != moved->pool_addr || trimmed != high) {
+        LogError("watermark still at %zu bytes after trimming an empty pool",
+            (size_t)((char*)moved->unused_past - (char*)moved->pool_addr));
+        return 1;
+    }
+    LogInfo("all blocks freed, watermark came down from %zu bytes", high);
+    // the trimmed pool still hands out blocks
+    moved_live.clear();
+    if (!churn(moved, 10000, moved_live)) {
+        return 1;
+    }
+
+    free(memory);
+    free(copy);
+
+    size_t reserved = (size_t)64 * 1024 * 1024;
+    void* chain = aligned_alloc(4096, reserved);
+    if (!grow(chain, 1024 * 1024, reserved)) {
+        return 1;
+    }
+    free(chain);
+
+    void* shared = aligned_alloc(4096, size);
+    if (!threaded(shared, size, 16)) {
+        return 1;
+    }
+    free(shared);
+
+    LogInfo("test_mempool passed");
+    return 0;
+}
@@ -0,0 +1,201 @@
+#include <stdlib.h>
+
+#include <atomic>
+#include <chrono>
+#include <thread>
+
+#include "paging/paging.hpp"
+
+/*
+    local test for the packed page states, no RDMA connection is needed
+    - a segment whose last page is short starts all Remote, with the short page's size
+    - every page keeps the state set on it without touching the pages it shares a word with,
+      and local_pages counts the Local and Dirty pages
+    - find_next_remote and find_next agree with a page by page scan from every start
+    - a thread waiting on an InFlight page returns once the page goes back to Remote
+    - re-cutting into 64 KB pages keeps spans that are all Local or all Remote and cutting back
+      into 4 KB pages hands their state to every page, a span that is mixed, in flight or dirty,
+      or a size that is not allowed, fails and changes nothing
+*/
+
+static const uintptr_t START = 0x40000000;
+static const size_t PAGE_SIZE = 4096;
+static const size_t LARGE_PAGE_SIZE = 65536;
+// 37 large pages and a short one
+static const size_t MEMORY_SIZE = 37 * LARGE_PAGE_SIZE + 1000;
+
+static PageState pattern(int page_id) {
+    return (PageState)((page_id * 7 + page_id / 3) % 4);
+}
+
+static bool check_states(Pages& pages, PageState (*expected)(int)) {
+    int local = 0;
+    for (int id = 0; id < pages.num_pages; id++) {
+        PageState state = pages.getPageState(id);
+        if (state != expected(id)) {
+            LogError("page %d is in state %d, expected %d", id, (int)state, (int)expected(id));
+            return false;
+        }
+        if (state == PageState::Local || state == PageState::Dirty)
+            local++;
+    }
+    if (pages.local_pages.load() != local) {
+        LogError("%d local pages counted, expected %d", pages.local_pages.load(), local);
+        return false;
+    }
+    return true;
+}
+
+static PageState all_remote(int page_id) {
+    return PageState::Remote;
+}
+
+// large pages 0 and 2 local, in 4 KB pages
+static PageState two_spans(int page_id) {
+    int span = page_id / (LARGE_PAGE_SIZE / PAGE_SIZE);
+    return (span == 0 || span == 2) ? PageState::Local : PageState::Remote;
+}
+
+static PageState two_large_pages(int page_id) {
+    return (page_id == 0 || page_id == 2) ? PageState::Local : PageState::Remote;
+}
+
+static bool fresh(Pages& pages) {
+    int expected = 37 * (LARGE_PAGE_SIZE / PAGE_SIZE) + 1;
+    if (pages.num_pages != expected) {
+        LogError("%d pages, expected %d", pages.num_pages, expected);
+        return false;
+    }
+    if (pages.getPageSize(pages.num_pages - 1) != 1000 || pages.getPageSize(0) != PAGE_SIZE) {
+        LogError("pages of %zu and %zu bytes, expected %zu and 1000", pages.getPageSize(0),
+            pages.getPageSize(pages.num_pages - 1), PAGE_SIZE);
+        return false;
+    }
+    void* address = (void*)(START + 5 * PAGE_SIZE + 17);
+    if (pages.getPageId(address) != 5 || pages.getPageAddress(address) != (void*)(START + 5 * PAGE_SIZE)) {
+        LogError("address %p is on page %d at %p", address, pages.getPageId(address), pages.getPageAddress(address));
+        return false;
+    }
+    return check_states(pages, all_remote);
+}
+
+static bool scans(Pages& pages) {
+    PageState states[] = {PageState::Remote, PageState::InFlight, PageState::Local, PageState::Dirty};
+    for (int start = 0; start <= pages.num_pages; start++) {
+        for (PageState state : states) {
+            int expected = start;
+            while (expected < pages.num_pages && pages.getPageState(expected) != state)
+                expected++;
+            int found = state == PageState::Remote ? pages.find_next_remote(start) : pages.find_next(start, state);
+            if (found != expected) {
+                LogError("scan for state %d from page %d found %d, expected %d", (int)state, start, found, expected);
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+static bool wakeup(Pages& pages) {
+    void* address = (void*)(START + 3 * PAGE_SIZE);
+    pages.setPageState(address, PageState::InFlight);
+    std::atomic<bool> woken(false);
+    std::thread waiter([&]() {
+        pages.waitForPage(address);
+        woken.store(true);
+    });
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    if (woken.load()) {
+        LogError("waitForPage returned while the page was in flight");
+        pages.setPageState(address, PageState::Remote);
+        waiter.join();
+        return false;
+    }
+    pages.setPageState(address, PageState::Remote);
+    waiter.join();
+    return true;
+}
+
+static bool refused(Pages& pages, size_t page_size, const char* why) {
+    if (pages.setPageSize(page_size)) {
+        LogError("re-cutting into %zu byte pages worked %s", page_size, why);
+        return false;
+    }
+    if (pages.getPageSize() != PAGE_SIZE || !check_states(pages, two_spans)) {
+        LogError("a failed re-cut %s changed the pages", why);
+        return false;
+    }
+    return true;
+}
+
+static bool recut(Pages& pages) {
+    for (int id = 0; id < pages.num_pages; id++) {
+        if (two_spans(id) == PageState::Local)
+            pages.setPageState(id, PageState::Local);
+    }
+
+    if (!refused(pages, 12288, "for a size that is not a power of two") || !refused(pages, 2048, "below the minimum")
+        || !refused(pages, 2 * Pages::MAX_PAGE_SIZE, "above the maximum"))
+        return false;
+
+    PageState bad[] = {PageState::Remote, PageState::InFlight, PageState::Dirty};
+    const char* why[] = {"over a mixed span", "over an in flight page", "over a dirty page"};
+    for (int i = 0; i < 3; i++) {
+        // page 5 is in the local large page 0
+        pages.setPageState(5, bad[i]);
+        bool result = pages.setPageSize(LARGE_PAGE_SIZE);
+        pages.setPageState(5, PageState::Local);
+        if (result) {
+            LogError("re-cutting into large pages worked %s", why[i]);
+            return false;
+        }
+        if (pages.getPageSize() != PAGE_SIZE || !check_states(pages, two_spans))
+            return false;
+    }
+
+    if (!pages.setPageSize(LARGE_PAGE_SIZE)) {
+        LogError("re-cutting into large pages failed");
+        return false;
+    }
+    if (pages.num_pages != 38 || pages.getPageSize(37) != 1000 || !check_states(pages, two_large_pages)) {
+        LogError("%d large pages, the last of %zu bytes", pages.num_pages, pages.getPageSize(37));
+        return false;
+    }
+    if (!scans(pages))
+        return false;
+
+    if (!pages.setPageSize(PAGE_SIZE)) {
+        LogError("re-cutting back into 4 KB pages failed");
+        return false;
+    }
+    return pages.num_pages == 37 * 16 + 1 && check_states(pages, two_spans);
+}
+
+int main(int argc, char** argv) {
+    Pages pages(START, MEMORY_SIZE, PAGE_SIZE);
+    if (!fresh(pages))
+        return 1;
+
+    for (int id = 0; id < pages.num_pages; id++) {
+        pages.setPageState(id, pattern(id));
+    }
+    if (!check_states(pages, pattern))
+        return 1;
+    if (!scans(pages))
+        return 1;
+    for (int id = 0; id < pages.num_pages; id++) {
+        pages.setPageState(id, PageState::Remote);
+    }
+    if (!check_states(pages, all_remote))
+        return 1;
+    if (!scans(pages))
+        return 1;
+
+    if (!wakeup(pages))
+        return 1;
+    if (!recut(pages))
+        return 1;
+
+    LogInfo("test_paging passed");
+    return 0;
+}